@@ -0,0 +1,269 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Analyser class.
+ * @see analysis/analyser.hpp
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "../audio/audio_decoder.hpp"
+#include "../errors.hpp"
+#include "../sample_formats.hpp"
+
+#include "analyser.hpp"
+#include "loudness.hpp"
+#include "silence.hpp"
+#include "waveform.hpp"
+
+/**
+ * Converts a run of samples to floating point, with full scale at 1.
+ * Called through OnSampleFormat, which picks the channel value type.
+ */
+struct ToFloatCall {
+	std::size_t count; ///< Number of channel values.
+	float *out;        ///< Where to put the converted values.
+
+	template <typename T>
+	void operator()(const T *in)
+	{
+		using Traits = SampleTraits<T>;
+		using Calc = typename Traits::Calc;
+
+		const Calc scale = Calc(1) / Traits::FullScale();
+		for (std::size_t i = 0; i < count; i++) {
+			out[i] = static_cast<float>(Traits::Unpack(in[i]) * scale);
+		}
+	}
+};
+
+/**
+ * Drops the calling thread to the lowest scheduling priority available.
+ */
+static void LowerPriority()
+{
+#if defined(SCHED_IDLE) && !defined(WIN32)
+	struct sched_param param;
+	param.sched_priority = 0;
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+}
+
+Analyser::Analyser(const AnalysisCache &cache, const DecoderOptions &options,
+                   std::size_t threads)
+        : cache(cache),
+          options(options),
+          next_watch(0),
+          stopping(false),
+          pool(threads)
+{
+}
+
+Analyser::~Analyser()
+{
+	// Files not yet started would each open a decoder just to notice
+	// they're stopping, so don't start them at all.
+	this->stopping = true;
+	auto dropped = this->pool.Drop();
+	if (0 < dropped) {
+		Debug("dropped", dropped, "queued analyses");
+	}
+}
+
+std::size_t Analyser::DefaultThreads()
+{
+	unsigned int cores = std::thread::hardware_concurrency();
+	return (cores <= 1) ? 1 : cores - 1;
+}
+
+void Analyser::Queue(const std::string &path)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!this->pending.insert(path).second) {
+			return;
+		}
+	}
+
+	this->pool.Push([this, path] {
+		Analyse(path);
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->pending.erase(path);
+	});
+}
+
+bool Analyser::Lookup(const std::string &path, Analysis &analysis) const
+{
+	return this->cache.Load(path, analysis);
+}
+
+void Analyser::Analyse(const std::string &path)
+{
+	// Every job does this, as the pool's threads start at normal priority;
+	// it's cheap next to decoding a whole file.
+	LowerPriority();
+
+	try
+	{
+		AudioDecoder decoder(path, this->options, &this->stopping);
+		LoudnessMeter meter(decoder.SampleRate(),
+		                    decoder.ChannelCount());
+		SilenceDetector silence(decoder.SampleRate(),
+		                        decoder.ChannelCount());
+		WaveformBuilder waveform(
+		                decoder.ChannelCount(),
+		                static_cast<std::uint32_t>(decoder.SampleRate()));
+		auto format = decoder.OutputSampleFormat();
+		std::size_t channels = decoder.ChannelCount();
+
+		std::vector<float> block;
+		while (!this->stopping) {
+			std::vector<char> frame = decoder.Decode();
+			if (frame.empty()) {
+				break;
+			}
+
+			std::size_t count = decoder.SampleCountForByteCount(
+			                frame.size());
+			block.resize(count * channels);
+			OnSampleFormat(format, frame.data(),
+			               ToFloatCall{block.size(), block.data()});
+			meter.Feed(block.data(), count);
+			silence.Feed(block.data(), count);
+			waveform.Feed(block.data(), count);
+			Publish(path, waveform, false);
+		}
+		if (this->stopping) {
+			return;
+		}
+		waveform.Finish();
+
+		Analysis analysis;
+		analysis.loudness = meter.IntegratedLoudness();
+		analysis.true_peak = meter.TruePeak();
+		analysis.audio_start = decoder.PositionMicrosecondsForSampleCount(
+		                silence.AudioStart());
+		analysis.audio_end = decoder.PositionMicrosecondsForSampleCount(
+		                silence.AudioEnd());
+		this->cache.Store(path, analysis);
+		this->cache.StoreWaveform(path, waveform);
+		Publish(path, waveform, true);
+
+		Debug("analysed", path, analysis.loudness, "LUFS",
+		      analysis.true_peak, "dBTP");
+	}
+	catch (Error &e)
+	{
+		Warn("can't analyse", path, e.Message());
+		Unwatch(path);
+	}
+	catch (std::exception &e)
+	{
+		// Pool jobs mustn't throw, so this has to stop here too.
+		auto what = e.what();
+		Warn("can't analyse", path, what);
+		Unwatch(path);
+	}
+	catch (...)
+	{
+		Warn("can't analyse", path);
+		Unwatch(path);
+	}
+}
+
+std::uint64_t Analyser::Watch(const std::string &path, std::size_t level)
+{
+	std::uint64_t id;
+	{
+		// Each watch starts from the first point, so a late watcher
+		// still gets the whole overview.
+		std::lock_guard<std::mutex> lock(this->mutex);
+		id = this->next_watch++;
+		this->watches[path].push_back(WatchState{id, level, 0});
+	}
+	Queue(path);
+	return id;
+}
+
+void Analyser::TakeProgress(std::vector<WaveProgress> &progress)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	for (auto &p : this->progress) {
+		progress.push_back(std::move(p));
+	}
+	this->progress.clear();
+}
+
+void Analyser::Publish(const std::string &path, const WaveformBuilder &builder,
+                       bool done)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto watches = this->watches.find(path);
+	if (watches == this->watches.end()) {
+		return;
+	}
+
+	std::size_t channels = builder.Channels();
+	for (auto &w : watches->second) {
+		WaveProgress p;
+		p.watch = w.id;
+		p.path = path;
+		p.level = w.level;
+		p.first = w.taken;
+		p.channels = builder.Channels();
+		p.done = done;
+		if (w.level < builder.Levels()) {
+			const auto &points = builder.Level(w.level);
+			if (w.taken < points.size() / channels) {
+				p.points.assign(points.begin() +
+				                                w.taken * channels,
+				                points.end());
+				w.taken = points.size() / channels;
+			}
+		}
+
+		if (done || !p.points.empty()) {
+			this->progress.push_back(std::move(p));
+		}
+	}
+
+	if (done) {
+		this->watches.erase(watches);
+	}
+}
+
+void Analyser::Unwatch(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto watches = this->watches.find(path);
+	if (watches == this->watches.end()) {
+		return;
+	}
+
+	for (const auto &w : watches->second) {
+		WaveProgress p;
+		p.watch = w.id;
+		p.path = path;
+		p.level = w.level;
+		p.first = w.taken;
+		p.channels = 0;
+		p.done = true;
+		this->progress.push_back(std::move(p));
+	}
+	this->watches.erase(watches);
+}
@@ -0,0 +1,166 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Analyser class.
+ * @see analysis/analyser.cpp
+ */
+
+#ifndef PS_ANALYSER_HPP
+#define PS_ANALYSER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../audio/audio_decoder.hpp"
+#include "../library/work_pool.hpp"
+
+#include "analysis_cache.hpp"
+#include "waveform.hpp"
+
+/**
+ * Waveform overview points computed since they were last taken.
+ * @see Analyser::Watch
+ */
+struct WaveProgress {
+	std::uint64_t watch;    ///< The watch the points are for.
+	std::string path;       ///< The path of the file.
+	std::size_t level;      ///< The level of the points.
+	std::size_t first;      ///< The index of the first point.
+	std::uint8_t channels;  ///< The WavePoints in each point.
+	std::vector<WavePoint> points; ///< The points; possibly none.
+	bool done; ///< Whether these are the last points of the file.
+};
+
+/**
+ * Analyses files in the background, storing the results in an
+ * AnalysisCache.
+ *
+ * Each file is decoded with an AudioDecoder, exactly as it would be played,
+ * and measured with a LoudnessMeter, a SilenceDetector and a WaveformBuilder
+ * in the same pass.  The analysis threads run at the lowest scheduling
+ * priority the system has, so they only use CPU time that nothing else (and
+ * in particular, no audio thread) wants.
+ */
+class Analyser {
+public:
+	/**
+	 * Constructs an Analyser.
+	 * @param cache The cache to store results in, which must outlive the
+	 *   Analyser.
+	 * @param options Settings for opening and decoding files.
+	 * @param threads The number of threads to analyse on.
+	 */
+	Analyser(const AnalysisCache &cache, const DecoderOptions &options,
+	         std::size_t threads);
+
+	/**
+	 * Drops any analyses still queued, abandons those in progress, and
+	 * waits for them to stop.
+	 */
+	~Analyser();
+
+	Analyser(const Analyser &) = delete;
+	Analyser &operator=(const Analyser &) = delete;
+
+	/**
+	 * Queues a file for analysis, unless it is already queued.
+	 * @param path The path of the file.
+	 */
+	void Queue(const std::string &path);
+
+	/**
+	 * Looks up the stored analysis of a file.
+	 * @param path The path of the file.
+	 * @param analysis Set to the analysis, if there is one.
+	 * @return True if the file has an up-to-date analysis; false
+	 *   otherwise.
+	 */
+	bool Lookup(const std::string &path, Analysis &analysis) const;
+
+	/**
+	 * Queues a file for analysis, if it isn't already, and streams its
+	 * waveform overview as it is computed.
+	 * From then on, points of the given level are made available to
+	 * TakeProgress as they are completed, starting from the first, until
+	 * the analysis finishes or fails.  Each watch keeps its own level and
+	 * place, so a file may be watched several times at once.
+	 * @param path The path of the file.
+	 * @param level The level of the overview to stream.
+	 * @return The watch's ID, which its WaveProgress carries.
+	 */
+	std::uint64_t Watch(const std::string &path, std::size_t level);
+
+	/**
+	 * Takes the waveform points computed for watched files since the last
+	 * call.
+	 * @param progress The vector to append the points to.
+	 */
+	void TakeProgress(std::vector<WaveProgress> &progress);
+
+	/**
+	 * The default number of analysis threads: one fewer than the number of
+	 * cores, so that one is always left for playback.
+	 * @return The thread count, at least 1.
+	 */
+	static std::size_t DefaultThreads();
+
+private:
+	const AnalysisCache &cache; ///< Where results go.
+	DecoderOptions options;     ///< Settings for opening files.
+
+	/// One watch on a file.
+	struct WatchState {
+		std::uint64_t id;  ///< The watch's ID.
+		std::size_t level; ///< The level being watched.
+		std::size_t taken; ///< How many of its points are taken.
+	};
+
+	std::mutex mutex;              ///< Protects the below.
+	std::set<std::string> pending; ///< Files queued or being analysed.
+	std::uint64_t next_watch;      ///< The ID of the next watch.
+
+	/// The watches on each watched file.
+	std::map<std::string, std::vector<WatchState>> watches;
+
+	std::vector<WaveProgress> progress; ///< Points not yet taken.
+
+	/// Set to make analyses in progress give up.
+	std::atomic<bool> stopping;
+
+	/// The analysis threads.  This is last, so that it is destroyed (and
+	/// its threads finish) before anything they use.
+	WorkStealingPool pool;
+
+	/**
+	 * Analyses a file, and stores the results.
+	 * @param path The path of the file.
+	 */
+	void Analyse(const std::string &path);
+
+	/**
+	 * Makes the newly completed points of a file available to each of its
+	 * watches.
+	 * @param path The path of the file.
+	 * @param builder The file's overview so far.
+	 * @param done Whether the overview is finished, which ends the
+	 *   watches.
+	 */
+	void Publish(const std::string &path, const WaveformBuilder &builder,
+	             bool done);
+
+	/**
+	 * Ends the watches on a file whose analysis failed, if any.
+	 * @param path The path of the file.
+	 */
+	void Unwatch(const std::string &path);
+};
+
+#endif // PS_ANALYSER_HPP
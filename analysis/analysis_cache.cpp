@@ -0,0 +1,188 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the AnalysisCache class.
+ * @see analysis/analysis_cache.hpp
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+
+#include "../errors.hpp"
+#include "../messages.h"
+
+#include "analysis_cache.hpp"
+
+/// The magic number starting every cache entry.
+static const char ENTRY_MAGIC[4] = {'P', 'S', 'A', 'C'};
+
+/// The entry format version; bump this when the layout changes.
+static const std::uint32_t ENTRY_VERSION = 2;
+
+/// The cache entry header.  The analysed file's path follows it.
+struct EntryHeader {
+	char magic[4];              ///< ENTRY_MAGIC.
+	std::uint32_t version;      ///< ENTRY_VERSION.
+	std::uint64_t source_size;  ///< The analysed file's size, in bytes.
+	std::int64_t source_mtime;  ///< The analysed file's modification time.
+	std::uint32_t path_size;    ///< The length of the analysed file's path.
+	std::uint32_t reserved;     ///< Padding; zero.
+	double loudness;            ///< Analysis::loudness.
+	double true_peak;           ///< Analysis::true_peak.
+	std::int64_t audio_start;   ///< Analysis::audio_start, in microseconds.
+	std::int64_t audio_end;     ///< Analysis::audio_end, in microseconds.
+};
+
+AnalysisCache::AnalysisCache(const std::string &dir) : dir(dir)
+{
+	// If this fails, so will every Store, which is reported there.
+#ifdef WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0777);
+#endif
+}
+
+bool AnalysisCache::Load(const std::string &path, Analysis &analysis) const
+{
+	std::uint64_t size;
+	std::int64_t mtime;
+	if (!Stamp(path, size, mtime)) {
+		return false;
+	}
+
+	std::ifstream in(EntryPath(path, ".ana"), std::ios::binary);
+	EntryHeader h;
+	if (!in.read(reinterpret_cast<char *>(&h), sizeof(h))) {
+		return false;
+	}
+	if (std::memcmp(h.magic, ENTRY_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.version != ENTRY_VERSION || h.source_size != size ||
+	    h.source_mtime != mtime || h.path_size != path.size()) {
+		return false;
+	}
+
+	std::string stored(h.path_size, '\0');
+	if (!in.read(&stored[0], static_cast<std::streamsize>(h.path_size)) ||
+	    stored != path) {
+		return false;
+	}
+
+	analysis.loudness = h.loudness;
+	analysis.true_peak = h.true_peak;
+	analysis.audio_start = std::chrono::microseconds(h.audio_start);
+	analysis.audio_end = std::chrono::microseconds(h.audio_end);
+	return true;
+}
+
+void AnalysisCache::Store(const std::string &path,
+                          const Analysis &analysis) const
+{
+	EntryHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, ENTRY_MAGIC, sizeof(h.magic));
+	h.version = ENTRY_VERSION;
+	if (!Stamp(path, h.source_size, h.source_mtime)) {
+		throw FileError(MSG_ANALYSIS_WRITE_FAIL);
+	}
+	h.path_size = static_cast<std::uint32_t>(path.size());
+	h.loudness = analysis.loudness;
+	h.true_peak = analysis.true_peak;
+	h.audio_start = analysis.audio_start.count();
+	h.audio_end = analysis.audio_end.count();
+
+	std::string entry = EntryPath(path, ".ana");
+	std::string temp = entry + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+		out.write(path.data(), static_cast<std::streamsize>(path.size()));
+		out.close();
+		if (out.fail()) {
+			std::remove(temp.c_str());
+			throw FileError(MSG_ANALYSIS_WRITE_FAIL);
+		}
+	}
+	if (std::rename(temp.c_str(), entry.c_str()) != 0) {
+		std::remove(temp.c_str());
+		throw FileError(MSG_ANALYSIS_WRITE_FAIL);
+	}
+}
+
+std::unique_ptr<Waveform> AnalysisCache::LoadWaveform(
+                const std::string &path) const
+{
+	std::uint64_t size;
+	std::int64_t mtime;
+	if (!Stamp(path, size, mtime)) {
+		return nullptr;
+	}
+
+	std::unique_ptr<Waveform> waveform;
+	try
+	{
+		waveform = decltype(waveform)(
+		                new Waveform(EntryPath(path, ".wave")));
+	}
+	catch (FileError &)
+	{
+		return nullptr;
+	}
+
+	if (!waveform->Matches(path, size, mtime)) {
+		return nullptr;
+	}
+	return waveform;
+}
+
+void AnalysisCache::StoreWaveform(const std::string &path,
+                                  const WaveformBuilder &builder) const
+{
+	std::uint64_t size;
+	std::int64_t mtime;
+	if (!Stamp(path, size, mtime)) {
+		throw FileError(MSG_ANALYSIS_WRITE_FAIL);
+	}
+	WriteWaveform(EntryPath(path, ".wave"), path, size, mtime, builder);
+}
+
+std::string AnalysisCache::EntryPath(const std::string &path,
+                                     const std::string &extension) const
+{
+	// 64-bit FNV-1a: short, and plenty to tell a library's files apart.
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : path) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+
+	std::ostringstream os;
+	os << this->dir << '/' << std::hex << std::setw(16) << std::setfill('0')
+	   << hash << extension;
+	return os.str();
+}
+
+bool AnalysisCache::Stamp(const std::string &path, std::uint64_t &size,
+                          std::int64_t &mtime)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		return false;
+	}
+	size = static_cast<std::uint64_t>(st.st_size);
+	mtime = static_cast<std::int64_t>(st.st_mtime);
+	return true;
+}
@@ -0,0 +1,109 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the AnalysisCache class.
+ * @see analysis/analysis_cache.cpp
+ */
+
+#ifndef PS_ANALYSIS_CACHE_HPP
+#define PS_ANALYSIS_CACHE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "waveform.hpp"
+
+/**
+ * The results of analysing one file.
+ */
+struct Analysis {
+	double loudness;  ///< The integrated loudness, in LUFS.
+	double true_peak; ///< The true peak, in dBTP.
+
+	/// Where the audio starts, after any leading silence.
+	std::chrono::microseconds audio_start;
+
+	/// Where the audio ends, before any trailing silence.
+	std::chrono::microseconds audio_end;
+};
+
+/**
+ * A directory of analysis results, with a small file of measurements and a
+ * memory-mappable waveform overview per analysed file.
+ *
+ * Each entry is named after a hash of the analysed file's path, and records
+ * the path (to catch hash collisions) and the file's size and modification
+ * time when it was analysed; an entry for a file that has since changed is
+ * ignored.  Entries are written to a temporary file and renamed into place,
+ * so readers never see half of one.
+ */
+class AnalysisCache {
+public:
+	/**
+	 * Constructs an AnalysisCache, creating its directory if needed.
+	 * @param dir The directory holding the entries.
+	 */
+	AnalysisCache(const std::string &dir);
+
+	/**
+	 * Looks up the analysis of a file.
+	 * @param path The path of the analysed file.
+	 * @param analysis Set to the analysis, if there is one.
+	 * @return True if there is an up-to-date analysis; false otherwise.
+	 */
+	bool Load(const std::string &path, Analysis &analysis) const;
+
+	/**
+	 * Stores the analysis of a file.
+	 * @param path The path of the analysed file.
+	 * @param analysis The analysis.
+	 * @throws FileError if the analysed file has gone, or the entry can't
+	 *   be written.
+	 */
+	void Store(const std::string &path, const Analysis &analysis) const;
+
+	/**
+	 * Maps the waveform overview of a file.
+	 * @param path The path of the analysed file.
+	 * @return The overview, or nullptr if there is no up-to-date one.
+	 */
+	std::unique_ptr<Waveform> LoadWaveform(const std::string &path) const;
+
+	/**
+	 * Stores the waveform overview of a file.
+	 * @param path The path of the analysed file.
+	 * @param builder The finished overview.
+	 * @throws FileError if the analysed file has gone, or the overview
+	 *   can't be written.
+	 */
+	void StoreWaveform(const std::string &path,
+	                   const WaveformBuilder &builder) const;
+
+private:
+	std::string dir; ///< The directory holding the entries.
+
+	/**
+	 * The path of a file's entry.
+	 * @param path The path of the analysed file.
+	 * @param extension The extension of the entry, including the dot.
+	 * @return The path of the entry.
+	 */
+	std::string EntryPath(const std::string &path,
+	                      const std::string &extension) const;
+
+	/**
+	 * Finds a file's size and modification time.
+	 * @param path The path of the file.
+	 * @param size Set to the file's size, in bytes.
+	 * @param mtime Set to the file's modification time, in seconds.
+	 * @return False if the file can't be found; true otherwise.
+	 */
+	static bool Stamp(const std::string &path, std::uint64_t &size,
+	                  std::int64_t &mtime);
+};
+
+#endif // PS_ANALYSIS_CACHE_HPP
@@ -0,0 +1,279 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the LoudnessMeter class.
+ * @see analysis/loudness.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../constants.h"
+
+#include "loudness.hpp"
+
+/// The number of upsampled values per input sample, for the true peak.
+static const std::size_t TRUE_PEAK_PHASES = 4;
+
+/// The offset from mean square to LUFS, from BS.1770.
+static const double LUFS_OFFSET = -0.691;
+
+/// The absolute gate, in LUFS.
+static const double ABSOLUTE_GATE = -70.0;
+
+/// The relative gate, in LU below the absolutely gated loudness.
+static const double RELATIVE_GATE = -10.0;
+
+/**
+ * Converts a weighted mean square to LUFS.
+ * @param z The mean square.
+ * @return The loudness.
+ */
+static double Lufs(double z)
+{
+	return LUFS_OFFSET + 10.0 * std::log10(z);
+}
+
+/**
+ * Converts LUFS to a weighted mean square.
+ * @param l The loudness.
+ * @return The mean square.
+ */
+static double MeanSquare(double l)
+{
+	return std::pow(10.0, (l - LUFS_OFFSET) / 10.0);
+}
+
+/**
+ * Computes the coefficients of the K-weighting stages for a sample rate.
+ * BS.1770 only gives them at 48kHz; these are the analogue prototypes,
+ * which reproduce those and work at any rate.
+ * @param fs The sample rate.
+ * @param shelf Set to the high shelf stage.
+ * @param highpass Set to the high pass stage.
+ */
+template <typename Biquad>
+static void KWeighting(double fs, Biquad &shelf, Biquad &highpass)
+{
+	const double pi = 3.14159265358979323846;
+
+	double f0 = 1681.974450955533;
+	double gain_db = 3.999843853973347;
+	double q = 0.7071752369554196;
+
+	double k = std::tan(pi * f0 / fs);
+	double vh = std::pow(10.0, gain_db / 20.0);
+	double vb = std::pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	shelf.b0 = (vh + vb * k / q + k * k) / a0;
+	shelf.b1 = 2.0 * (k * k - vh) / a0;
+	shelf.b2 = (vh - vb * k / q + k * k) / a0;
+	shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+	shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = std::tan(pi * f0 / fs);
+	a0 = 1.0 + k / q + k * k;
+	highpass.b0 = 1.0;
+	highpass.b1 = -2.0;
+	highpass.b2 = 1.0;
+	highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+	highpass.a2 = (1.0 - k / q + k * k) / a0;
+}
+
+LoudnessMeter::LoudnessMeter(double sample_rate, std::uint8_t channels)
+        : channels(channels),
+          step_size(std::max<std::size_t>(
+                          1, static_cast<std::size_t>(sample_rate / 10.0))),
+          weights(channels, 1.0),
+          state(4 * channels, 0.0),
+          history(TRUE_PEAK_TAPS * channels, 0.0f),
+          fir(TRUE_PEAK_PHASES * TRUE_PEAK_TAPS),
+          step_sums(channels, 0.0),
+          step_filled(0),
+          recent(),
+          steps(0),
+          peak(0.0f)
+{
+	KWeighting(sample_rate, this->shelf, this->highpass);
+
+	// Surround channels count for more, and the LFE not at all; these are
+	// the 5.0 and 5.1 layouts, in ffmpeg's order.
+	if (channels == 5) {
+		this->weights = {1.0, 1.0, 1.0, 1.41, 1.41};
+	} else if (channels == 6) {
+		this->weights = {1.0, 1.0, 1.0, 0.0, 1.41, 1.41};
+	}
+
+	// The interpolation filter is a Hann-windowed sinc, split into one
+	// filter per phase.  Each phase's taps are stored reversed, so that
+	// filtering is a plain dot product with the input, and normalised to
+	// unity gain.
+	const double pi = 3.14159265358979323846;
+	const std::size_t n = TRUE_PEAK_PHASES * TRUE_PEAK_TAPS;
+	const double centre = (n - 1) / 2.0;
+	for (std::size_t p = 0; p < TRUE_PEAK_PHASES; p++) {
+		double sum = 0.0;
+		for (std::size_t k = 0; k < TRUE_PEAK_TAPS; k++) {
+			double t = (p + TRUE_PEAK_PHASES * k) - centre;
+			double x = t / TRUE_PEAK_PHASES;
+			double sinc = (x == 0.0) ? 1.0
+			                         : std::sin(pi * x) / (pi * x);
+			double window = 0.5 + 0.5 * std::cos(2.0 * pi * t / n);
+			double h = sinc * window;
+
+			this->fir[p * TRUE_PEAK_TAPS + TRUE_PEAK_TAPS - 1 - k] =
+			                static_cast<float>(h);
+			sum += h;
+		}
+		for (std::size_t k = 0; k < TRUE_PEAK_TAPS; k++) {
+			this->fir[p * TRUE_PEAK_TAPS + k] /=
+			                static_cast<float>(sum);
+		}
+	}
+}
+
+void LoudnessMeter::Feed(const float *samples, std::size_t count)
+{
+	while (0 < count) {
+		// Never cross a step boundary within one pass.
+		std::size_t n = std::min(count,
+		                         this->step_size - this->step_filled);
+
+		// The history sits in front of the samples, so the true-peak
+		// filter can read back past the start of this pass.
+		this->planar.resize(TRUE_PEAK_TAPS + n);
+		for (std::uint8_t c = 0; c < this->channels; c++) {
+			float *x = this->planar.data() + TRUE_PEAK_TAPS;
+			for (std::size_t i = 0; i < n; i++) {
+				x[i] = samples[i * this->channels + c];
+			}
+			FeedChannel(c, x, n);
+		}
+
+		samples += n * this->channels;
+		count -= n;
+		this->step_filled += n;
+		if (this->step_filled == this->step_size) {
+			EndStep();
+		}
+	}
+}
+
+void LoudnessMeter::FeedChannel(std::uint8_t c, float *x, std::size_t count)
+{
+	// True peak: each output is a dot product of TRUE_PEAK_TAPS inputs
+	// with one phase of the filter.
+	float *h = &this->history[c * TRUE_PEAK_TAPS];
+	std::copy(h, h + TRUE_PEAK_TAPS, x - TRUE_PEAK_TAPS);
+
+	float pk = this->peak;
+	for (std::size_t i = 0; i < count; i++) {
+		const float *in = x + i + 1 - TRUE_PEAK_TAPS;
+		for (std::size_t p = 0; p < TRUE_PEAK_PHASES; p++) {
+			const float *taps = &this->fir[p * TRUE_PEAK_TAPS];
+			float y = 0.0f;
+			for (std::size_t k = 0; k < TRUE_PEAK_TAPS; k++) {
+				y += taps[k] * in[k];
+			}
+			pk = std::max(pk, std::abs(y));
+		}
+	}
+	this->peak = pk;
+
+	std::size_t keep = std::min<std::size_t>(count, TRUE_PEAK_TAPS);
+	std::copy(h + keep, h + TRUE_PEAK_TAPS, h);
+	std::copy(x + count - keep, x + count, h + TRUE_PEAK_TAPS - keep);
+
+	// K-weighting: two biquads in transposed direct form II.  Each is a
+	// recurrence on its own output, so this loop is inherently serial.
+	if (this->weights[c] == 0.0) {
+		return;
+	}
+	const Biquad &f = this->shelf;
+	const Biquad &g = this->highpass;
+	double *s = &this->state[4 * c];
+	double s0 = s[0], s1 = s[1], s2 = s[2], s3 = s[3];
+	double sum = 0.0;
+	for (std::size_t i = 0; i < count; i++) {
+		double in = x[i];
+		double y = f.b0 * in + s0;
+		s0 = f.b1 * in - f.a1 * y + s1;
+		s1 = f.b2 * in - f.a2 * y;
+
+		double z = g.b0 * y + s2;
+		s2 = g.b1 * y - g.a1 * z + s3;
+		s3 = g.b2 * y - g.a2 * z;
+
+		sum += z * z;
+	}
+	s[0] = s0;
+	s[1] = s1;
+	s[2] = s2;
+	s[3] = s3;
+	this->step_sums[c] += sum;
+}
+
+void LoudnessMeter::EndStep()
+{
+	double z = 0.0;
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		z += this->weights[c] * this->step_sums[c] / this->step_size;
+		this->step_sums[c] = 0.0;
+	}
+	this->step_filled = 0;
+
+	// Every step ends a 400ms block, once there have been four.
+	if (3 <= this->steps) {
+		double block = (z + this->recent[0] + this->recent[1] +
+		                this->recent[2]) /
+		               4.0;
+		this->blocks.push_back(block);
+	}
+	this->recent[0] = this->recent[1];
+	this->recent[1] = this->recent[2];
+	this->recent[2] = z;
+	this->steps++;
+}
+
+double LoudnessMeter::IntegratedLoudness() const
+{
+	auto gated_mean = [this](double gate, double &mean) {
+		double sum = 0.0;
+		std::size_t n = 0;
+		for (double z : this->blocks) {
+			if (gate < z) {
+				sum += z;
+				n++;
+			}
+		}
+		mean = (n == 0) ? 0.0 : sum / n;
+		return 0 < n;
+	};
+
+	double absolute;
+	if (!gated_mean(MeanSquare(ABSOLUTE_GATE), absolute)) {
+		return LOUDNESS_FLOOR_DB;
+	}
+
+	double relative_gate = MeanSquare(Lufs(absolute) + RELATIVE_GATE);
+	double relative;
+	gated_mean(std::max(relative_gate, MeanSquare(ABSOLUTE_GATE)),
+	           relative);
+	return std::max(Lufs(relative), LOUDNESS_FLOOR_DB);
+}
+
+double LoudnessMeter::TruePeak() const
+{
+	if (this->peak <= 0.0f) {
+		return LOUDNESS_FLOOR_DB;
+	}
+	return std::max(20.0 * std::log10(this->peak), LOUDNESS_FLOOR_DB);
+}
@@ -0,0 +1,112 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the LoudnessMeter class.
+ * @see analysis/loudness.cpp
+ */
+
+#ifndef PS_LOUDNESS_HPP
+#define PS_LOUDNESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Measures the integrated loudness and true peak of a whole programme, as
+ * per ITU-R BS.1770-4 and EBU R128.
+ *
+ * Audio is K-weighted (a high shelf, then a high pass, each one biquad),
+ * squared and summed per channel into 100ms steps; each 400ms gating block
+ * is four consecutive steps.  The integrated loudness is the mean of the
+ * blocks passing an absolute gate of -70 LUFS, and then a relative gate 10
+ * LU below the mean of those.  The true peak is the largest magnitude of
+ * the signal upsampled four times.
+ */
+class LoudnessMeter {
+public:
+	/**
+	 * Constructs a LoudnessMeter.
+	 * @param sample_rate The sample rate of the audio, in Hz.
+	 * @param channels The number of channels, in the usual ffmpeg order.
+	 */
+	LoudnessMeter(double sample_rate, std::uint8_t channels);
+
+	/**
+	 * Measures some audio.
+	 * @param samples Interleaved samples, normalised so that full scale
+	 *   is 1.
+	 * @param count The number of samples (each holding every channel).
+	 */
+	void Feed(const float *samples, std::size_t count);
+
+	/**
+	 * The integrated loudness of everything fed so far.
+	 * @return The loudness in LUFS, or LOUDNESS_FLOOR_DB if no block
+	 *   passed the gates.
+	 */
+	double IntegratedLoudness() const;
+
+	/**
+	 * The true peak of everything fed so far.
+	 * @return The peak in dBTP, or LOUDNESS_FLOOR_DB if everything was
+	 *   that quiet.
+	 */
+	double TruePeak() const;
+
+private:
+	/// One biquad section's coefficients, with a0 normalised to 1.
+	struct Biquad {
+		double b0, b1, b2, a1, a2;
+	};
+
+	std::uint8_t channels; ///< The number of channels.
+	std::size_t step_size; ///< The number of samples in a 100ms step.
+
+	Biquad shelf;    ///< The first K-weighting stage.
+	Biquad highpass; ///< The second K-weighting stage.
+
+	/// Each channel's weight in the sum, or 0 to leave it out (the LFE).
+	std::vector<double> weights;
+
+	/// The filter state: four values per channel, two per stage.
+	std::vector<double> state;
+
+	/// The last TRUE_PEAK_TAPS samples of each channel, oldest first.
+	std::vector<float> history;
+
+	/// The true-peak interpolation filter, one row of taps per phase.
+	std::vector<float> fir;
+
+	std::vector<float> planar; ///< Scratch: one channel of a Feed.
+
+	std::vector<double> step_sums; ///< Each channel's sum in this step.
+	std::size_t step_filled;       ///< The samples in this step so far.
+
+	/// The weighted mean squares of the last three whole steps.
+	double recent[3];
+	std::size_t steps; ///< The number of whole steps so far.
+
+	/// The weighted mean square of each 400ms block so far.
+	std::vector<double> blocks;
+
+	float peak; ///< The largest upsampled magnitude so far.
+
+	/**
+	 * Filters one channel of a Feed, adding to the step sums and peak.
+	 * @param c The channel.
+	 * @param x The channel's samples, preceded by TRUE_PEAK_TAPS samples of
+	 *   scratch space for the history.
+	 * @param count The number of samples.
+	 */
+	void FeedChannel(std::uint8_t c, float *x, std::size_t count);
+
+	/**
+	 * Finishes a 100ms step, and the 400ms block ending with it.
+	 */
+	void EndStep();
+};
+
+#endif // PS_LOUDNESS_HPP
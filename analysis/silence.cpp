@@ -0,0 +1,93 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the SilenceDetector class.
+ * @see analysis/silence.hpp
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "../constants.h"
+
+#include "silence.hpp"
+
+SilenceDetector::SilenceDetector(double sample_rate, std::uint8_t channels)
+        : channels(channels),
+          threshold(static_cast<float>(
+                          std::pow(10.0, SILENCE_THRESHOLD_DB / 20.0))),
+          min_samples(static_cast<std::uint64_t>(
+                          sample_rate *
+                          std::chrono::duration<double>(SILENCE_MIN_LENGTH)
+                                          .count())),
+          fed(0),
+          heard(false),
+          first_loud(0),
+          last_loud(0)
+{
+}
+
+void SilenceDetector::Feed(const float *samples, std::size_t count)
+{
+	while (0 < count) {
+		std::size_t n = std::min(count, SILENCE_BLOCK_SAMPLES);
+		FeedBlock(samples, n);
+		samples += n * this->channels;
+		count -= n;
+	}
+}
+
+void SilenceDetector::FeedBlock(const float *samples, std::size_t count)
+{
+	const std::size_t values = count * this->channels;
+
+	// Nearly every block is either all silence or all audio, so one
+	// pass taking the whole block's peak settles it.
+	float peak = 0.0f;
+	for (std::size_t i = 0; i < values; i++) {
+		peak = std::max(peak, std::abs(samples[i]));
+	}
+
+	if (this->threshold <= peak) {
+		auto loud = [this](float v) {
+			return this->threshold <= std::abs(v);
+		};
+		if (!this->heard) {
+			std::size_t i = std::find_if(samples, samples + values,
+			                             loud) -
+			                samples;
+			this->first_loud = this->fed + i / this->channels;
+			this->heard = true;
+		}
+
+		std::size_t i = values - 1;
+		while (!loud(samples[i])) {
+			i--;
+		}
+		this->last_loud = this->fed + i / this->channels;
+	}
+
+	this->fed += count;
+}
+
+std::uint64_t SilenceDetector::AudioStart() const
+{
+	if (!this->heard || this->first_loud < this->min_samples) {
+		return 0;
+	}
+	return this->first_loud;
+}
+
+std::uint64_t SilenceDetector::AudioEnd() const
+{
+	std::uint64_t end = this->last_loud + 1;
+	if (!this->heard || this->fed - end < this->min_samples) {
+		return this->fed;
+	}
+	return end;
+}
@@ -0,0 +1,75 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the SilenceDetector class.
+ * @see analysis/silence.cpp
+ */
+
+#ifndef PS_SILENCE_HPP
+#define PS_SILENCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Finds where the audio in a programme starts and ends, ignoring leading and
+ * trailing silence.
+ *
+ * A sample is silent if every channel is quieter than SILENCE_THRESHOLD_DB.
+ * Audio is scanned in blocks of SILENCE_BLOCK_SAMPLES, taking the largest
+ * magnitude of each block; only blocks that aren't wholly silent are
+ * searched sample by sample.  Runs of silence shorter than
+ * SILENCE_MIN_LENGTH are not trimmed.
+ */
+class SilenceDetector {
+public:
+	/**
+	 * Constructs a SilenceDetector.
+	 * @param sample_rate The sample rate of the audio, in Hz.
+	 * @param channels The number of channels.
+	 */
+	SilenceDetector(double sample_rate, std::uint8_t channels);
+
+	/**
+	 * Scans some audio.
+	 * @param samples Interleaved samples, normalised so that full scale
+	 *   is 1.
+	 * @param count The number of samples (each holding every channel).
+	 */
+	void Feed(const float *samples, std::size_t count);
+
+	/**
+	 * Where the audio starts, after any leading silence.
+	 * @return The number of samples of leading silence; 0 if there is
+	 *   none (or too little to trim).
+	 */
+	std::uint64_t AudioStart() const;
+
+	/**
+	 * Where the audio ends, before any trailing silence.
+	 * @return The number of samples before trailing silence; the number
+	 *   of samples fed if there is none (or too little to trim).
+	 */
+	std::uint64_t AudioEnd() const;
+
+private:
+	std::uint8_t channels;     ///< The number of channels.
+	float threshold;           ///< The silence threshold, linear.
+	std::uint64_t min_samples; ///< The shortest silence trimmed.
+
+	std::uint64_t fed;        ///< The number of samples fed so far.
+	bool heard;               ///< Whether any sample wasn't silent.
+	std::uint64_t first_loud; ///< The first sample that wasn't silent.
+	std::uint64_t last_loud;  ///< The last sample that wasn't silent.
+
+	/**
+	 * Scans one block of audio.
+	 * @param samples The block's interleaved samples.
+	 * @param count The number of samples in the block.
+	 */
+	void FeedBlock(const float *samples, std::size_t count);
+};
+
+#endif // PS_SILENCE_HPP
@@ -0,0 +1,429 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the WaveformBuilder and Waveform classes.
+ * @see analysis/waveform.hpp
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../constants.h"
+#include "../errors.hpp"
+#include "../messages.h"
+#include "../sample_formats.hpp"
+
+#include "waveform.hpp"
+
+/// The magic number starting every overview file.
+static const char WAVE_MAGIC[4] = {'P', 'S', 'W', 'V'};
+
+/// The overview format version; bump this when the layout changes.
+static const std::uint32_t WAVE_VERSION = 1;
+
+/// The overview file header.  The analysed file's path follows it, padded
+/// to a multiple of 8 bytes, then the levels.
+struct WaveHeader {
+	char magic[4];              ///< WAVE_MAGIC.
+	std::uint32_t version;      ///< WAVE_VERSION.
+	std::uint64_t source_size;  ///< The analysed file's size, in bytes.
+	std::int64_t source_mtime;  ///< The analysed file's modification time.
+	std::uint32_t path_size;    ///< The length of the analysed file's path.
+	std::uint32_t sample_rate;  ///< The sample rate, in Hz.
+	std::uint32_t bucket;       ///< The samples per level 0 point.
+	std::uint16_t channels;     ///< The number of channels.
+	std::uint16_t level_count;  ///< The number of levels.
+	std::uint64_t base_points;  ///< The number of level 0 points.
+};
+
+/**
+ * The size of a path in an overview file, including padding.
+ * @param path_size The length of the path.
+ * @return The padded length.
+ */
+static std::uint64_t PaddedPathSize(std::uint64_t path_size)
+{
+	return (path_size + 7) & ~std::uint64_t(7);
+}
+
+/**
+ * Converts a normalised value to a WavePoint value.
+ * @param v The value, with full scale at 1.
+ * @return The value, with full scale at 32767.
+ */
+static std::int16_t ToWave(float v)
+{
+	return SaturateSample<std::int16_t>(v * 32767.0f);
+}
+
+//
+// WaveformBuilder
+//
+
+WaveformBuilder::WaveformBuilder(std::uint8_t channels,
+                                 std::uint32_t sample_rate)
+        : channels(channels),
+          sample_rate(sample_rate),
+          levels(1),
+          min(channels, std::numeric_limits<float>::infinity()),
+          max(channels, -std::numeric_limits<float>::infinity()),
+          sum_sq(channels, 0.0),
+          filled(0)
+{
+}
+
+void WaveformBuilder::Feed(const float *samples, std::size_t count)
+{
+	const std::uint8_t nc = this->channels;
+
+	while (0 < count) {
+		std::size_t n = std::min(count, WAVE_BUCKET_SAMPLES - this->filled);
+
+		// Plain loops over local accumulators, which the compiler can
+		// keep in registers.
+		for (std::uint8_t c = 0; c < nc; c++) {
+			float lo = this->min[c];
+			float hi = this->max[c];
+			double sq = 0.0;
+			for (std::size_t i = 0; i < n; i++) {
+				float v = samples[i * nc + c];
+				lo = std::min(lo, v);
+				hi = std::max(hi, v);
+				sq += v * v;
+			}
+			this->min[c] = lo;
+			this->max[c] = hi;
+			this->sum_sq[c] += sq;
+		}
+
+		samples += n * nc;
+		count -= n;
+		this->filled += n;
+		if (this->filled == WAVE_BUCKET_SAMPLES) {
+			EndBucket();
+		}
+	}
+}
+
+void WaveformBuilder::EndBucket()
+{
+	auto &base = this->levels[0];
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		double ms = this->sum_sq[c] / this->filled;
+		WavePoint p;
+		p.min = ToWave(this->min[c]);
+		p.max = ToWave(this->max[c]);
+		p.rms = ToWave(static_cast<float>(std::sqrt(ms)));
+		base.push_back(p);
+
+		this->min[c] = std::numeric_limits<float>::infinity();
+		this->max[c] = -std::numeric_limits<float>::infinity();
+		this->sum_sq[c] = 0.0;
+	}
+	this->filled = 0;
+
+	// Like carrying in binary addition: each second point of a level
+	// completes a point of the next.
+	for (std::size_t l = 0;
+	     (this->levels[l].size() / this->channels) % 2 == 0; l++) {
+		Merge(l);
+	}
+}
+
+void WaveformBuilder::Merge(std::size_t level)
+{
+	if (level + 1 == this->levels.size()) {
+		this->levels.emplace_back();
+	}
+
+	const std::vector<WavePoint> &from = this->levels[level];
+	std::vector<WavePoint> &to = this->levels[level + 1];
+	const WavePoint *a = &from[from.size() - 2 * this->channels];
+	const WavePoint *b = a + this->channels;
+
+	for (std::uint8_t c = 0; c < this->channels; c++) {
+		float ra = a[c].rms;
+		float rb = b[c].rms;
+		WavePoint p;
+		p.min = std::min(a[c].min, b[c].min);
+		p.max = std::max(a[c].max, b[c].max);
+		p.rms = static_cast<std::int16_t>(
+		                std::sqrt((ra * ra + rb * rb) / 2.0f));
+		to.push_back(p);
+	}
+}
+
+void WaveformBuilder::Finish()
+{
+	if (0 < this->filled) {
+		EndBucket();
+	}
+
+	// Each level so far only holds points for whole pairs merged below
+	// it.  Going up, each level may lack one point: either an odd point
+	// left over below, which is carried up as it is, or a pair made whole
+	// by such a carry, which is merged.
+	for (std::size_t l = 0; l < this->levels.size(); l++) {
+		std::size_t points = this->levels[l].size() / this->channels;
+		if (points <= 1) {
+			this->levels.resize(l + 1);
+			break;
+		}
+		if (l + 1 == this->levels.size()) {
+			this->levels.emplace_back();
+		}
+
+		auto &from = this->levels[l];
+		auto &to = this->levels[l + 1];
+		if (to.size() / this->channels == (points + 1) / 2) {
+			continue;
+		}
+		if (points % 2 == 0) {
+			Merge(l);
+		} else {
+			to.insert(to.end(), from.end() - this->channels,
+			          from.end());
+		}
+	}
+}
+
+std::uint8_t WaveformBuilder::Channels() const
+{
+	return this->channels;
+}
+
+std::uint32_t WaveformBuilder::SampleRate() const
+{
+	return this->sample_rate;
+}
+
+std::size_t WaveformBuilder::Levels() const
+{
+	return this->levels.size();
+}
+
+const std::vector<WavePoint> &WaveformBuilder::Level(std::size_t level) const
+{
+	assert(level < this->levels.size());
+	return this->levels[level];
+}
+
+//
+// Writing
+//
+
+void WriteWaveform(const std::string &file, const std::string &path,
+                   std::uint64_t source_size, std::int64_t source_mtime,
+                   const WaveformBuilder &builder)
+{
+	WaveHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, WAVE_MAGIC, sizeof(h.magic));
+	h.version = WAVE_VERSION;
+	h.source_size = source_size;
+	h.source_mtime = source_mtime;
+	h.path_size = static_cast<std::uint32_t>(path.size());
+	h.sample_rate = builder.SampleRate();
+	h.bucket = static_cast<std::uint32_t>(WAVE_BUCKET_SAMPLES);
+	h.channels = builder.Channels();
+	h.level_count = static_cast<std::uint16_t>(builder.Levels());
+	h.base_points = builder.Level(0).size() / builder.Channels();
+
+	std::string padded = path;
+	padded.resize(PaddedPathSize(path.size()), '\0');
+
+	std::string temp = file + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+		out.write(padded.data(),
+		          static_cast<std::streamsize>(padded.size()));
+		for (std::size_t l = 0; l < builder.Levels(); l++) {
+			const auto &points = builder.Level(l);
+			out.write(reinterpret_cast<const char *>(points.data()),
+			          static_cast<std::streamsize>(
+			                          points.size() *
+			                          sizeof(WavePoint)));
+		}
+		out.close();
+		if (out.fail()) {
+			std::remove(temp.c_str());
+			throw FileError(MSG_ANALYSIS_WRITE_FAIL);
+		}
+	}
+	if (std::rename(temp.c_str(), file.c_str()) != 0) {
+		std::remove(temp.c_str());
+		throw FileError(MSG_ANALYSIS_WRITE_FAIL);
+	}
+}
+
+//
+// Reading
+//
+
+#ifdef WIN32
+
+// Windows has no mmap, so the overview is read into memory instead.
+Waveform::Waveform(const std::string &file)
+        : data(nullptr), size(0), header(nullptr), path(nullptr)
+{
+	std::ifstream in(file, std::ios::binary | std::ios::ate);
+	std::streamoff length = in ? static_cast<std::streamoff>(in.tellg())
+	                           : 0;
+	if (length <= 0) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+
+	std::unique_ptr<char[]> buffer(
+	                new char[static_cast<std::size_t>(length)]);
+	in.seekg(0);
+	if (!in.read(buffer.get(), length)) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+	this->data = buffer.get();
+	this->size = static_cast<std::size_t>(length);
+
+	// If this throws, the buffer frees itself.
+	Validate();
+	buffer.release();
+}
+
+Waveform::~Waveform()
+{
+	delete[] this->data;
+}
+
+#else
+
+Waveform::Waveform(const std::string &file)
+        : data(nullptr), size(0), header(nullptr), path(nullptr)
+{
+	int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 < st.st_size) {
+		map = mmap(nullptr, static_cast<std::size_t>(st.st_size),
+		           PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+	this->data = static_cast<const char *>(map);
+	this->size = static_cast<std::size_t>(st.st_size);
+
+	try
+	{
+		Validate();
+	}
+	catch (...)
+	{
+		munmap(const_cast<char *>(this->data), this->size);
+		throw;
+	}
+}
+
+Waveform::~Waveform()
+{
+	munmap(const_cast<char *>(this->data), this->size);
+}
+
+#endif // WIN32
+
+void Waveform::Validate()
+{
+	if (this->size < sizeof(WaveHeader)) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+	this->header = reinterpret_cast<const WaveHeader *>(this->data);
+
+	const WaveHeader &h = *this->header;
+	if (std::memcmp(h.magic, WAVE_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.version != WAVE_VERSION || h.channels == 0 ||
+	    h.level_count == 0) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+
+	// Work out where each level is, checking against the file size as we
+	// go, so that a huge point count can't overflow anything.
+	std::uint64_t point_size = std::uint64_t(h.channels) * sizeof(WavePoint);
+	std::uint64_t offset = sizeof(WaveHeader) + PaddedPathSize(h.path_size);
+	std::uint64_t points = h.base_points;
+	this->offsets.clear();
+	for (std::uint16_t l = 0; l < h.level_count; l++) {
+		if (this->size < offset ||
+		    (this->size - offset) / point_size < points) {
+			throw FileError(MSG_WAVEFORM_BAD);
+		}
+		this->offsets.push_back(offset);
+		offset += points * point_size;
+		points = (points + 1) / 2;
+	}
+	if (offset != this->size) {
+		throw FileError(MSG_WAVEFORM_BAD);
+	}
+	this->offsets.push_back(offset);
+
+	this->path = this->data + sizeof(WaveHeader);
+}
+
+bool Waveform::Matches(const std::string &path, std::uint64_t size,
+                       std::int64_t mtime) const
+{
+	const WaveHeader &h = *this->header;
+	return h.source_size == size && h.source_mtime == mtime &&
+	       h.path_size == path.size() &&
+	       std::memcmp(this->path, path.data(), path.size()) == 0;
+}
+
+std::uint8_t Waveform::Channels() const
+{
+	return static_cast<std::uint8_t>(this->header->channels);
+}
+
+std::uint32_t Waveform::SampleRate() const
+{
+	return this->header->sample_rate;
+}
+
+std::size_t Waveform::Levels() const
+{
+	return this->header->level_count;
+}
+
+std::size_t Waveform::Points(std::size_t level) const
+{
+	assert(level < Levels());
+	return (this->offsets[level + 1] - this->offsets[level]) /
+	       (this->header->channels * sizeof(WavePoint));
+}
+
+const WavePoint *Waveform::Level(std::size_t level) const
+{
+	assert(level < Levels());
+	return reinterpret_cast<const WavePoint *>(this->data +
+	                                           this->offsets[level]);
+}
@@ -0,0 +1,214 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the WaveformBuilder and Waveform classes.
+ * @see analysis/waveform.cpp
+ */
+
+#ifndef PS_WAVEFORM_HPP
+#define PS_WAVEFORM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct WaveHeader;
+
+/**
+ * One channel of one point of a waveform overview.
+ * Values are scaled so that full scale is 32767.
+ */
+struct WavePoint {
+	std::int16_t min; ///< The lowest sample value.
+	std::int16_t max; ///< The highest sample value.
+	std::int16_t rms; ///< The root mean square of the sample values.
+};
+
+/**
+ * A waveform overview: a pyramid of min/max/RMS points at successively
+ * halved resolutions.
+ *
+ * Each point of level 0 summarises one bucket of WAVE_BUCKET_SAMPLES
+ * samples; each point of level n+1 summarises two of level n, so a UI can
+ * draw any zoom level by picking the level nearest the resolution it wants,
+ * without touching the audio.  The last level has one point.  Points hold
+ * one WavePoint per channel.
+ */
+class WaveformBuilder {
+public:
+	/**
+	 * Constructs an empty WaveformBuilder.
+	 * @param channels The number of channels.
+	 * @param sample_rate The sample rate, in Hz.
+	 */
+	WaveformBuilder(std::uint8_t channels, std::uint32_t sample_rate);
+
+	/**
+	 * Adds some audio to the overview, completing any points it fills.
+	 * @param samples Interleaved samples, normalised so that full scale
+	 *   is 1.
+	 * @param count The number of samples (each holding every channel).
+	 */
+	void Feed(const float *samples, std::size_t count);
+
+	/**
+	 * Completes the overview, once all audio has been fed.
+	 * This adds a point for any partly filled bucket, and completes each
+	 * level above it.
+	 */
+	void Finish();
+
+	/**
+	 * The number of channels.
+	 * @return The channel count.
+	 */
+	std::uint8_t Channels() const;
+
+	/**
+	 * The sample rate of the audio.
+	 * @return The sample rate, in Hz.
+	 */
+	std::uint32_t SampleRate() const;
+
+	/**
+	 * The number of levels so far.  Before Finish, the top levels are
+	 * only those that have a complete point.
+	 * @return The level count.
+	 */
+	std::size_t Levels() const;
+
+	/**
+	 * The points of a level completed so far.
+	 * @param level The level, which must be less than Levels().
+	 * @return The points, each holding Channels() WavePoints.
+	 */
+	const std::vector<WavePoint> &Level(std::size_t level) const;
+
+private:
+	std::uint8_t channels;     ///< The number of channels.
+	std::uint32_t sample_rate; ///< The sample rate, in Hz.
+
+	/// The points of each level, each point holding channels WavePoints.
+	std::vector<std::vector<WavePoint>> levels;
+
+	std::vector<float> min;    ///< The current bucket's lows.
+	std::vector<float> max;    ///< The current bucket's highs.
+	std::vector<double> sum_sq; ///< The current bucket's sums of squares.
+	std::size_t filled;        ///< The samples in the current bucket.
+
+	/**
+	 * Turns the current bucket into a level 0 point, and merges it upward.
+	 */
+	void EndBucket();
+
+	/**
+	 * Merges the last two points of a level into a point of the next.
+	 * @param level The level whose points are merged.
+	 */
+	void Merge(std::size_t level);
+};
+
+/**
+ * Writes a waveform overview file.
+ *
+ * The file holds a header, the analysed file's path, then each level's
+ * points in turn, lowest first.  It is written to a temporary file which
+ * then replaces the old one.
+ *
+ * @param file The path of the overview file.
+ * @param path The path of the analysed file.
+ * @param source_size The analysed file's size, in bytes.
+ * @param source_mtime The analysed file's modification time, in seconds.
+ * @param builder The finished overview.
+ * @throws FileError if the file can't be written.
+ */
+void WriteWaveform(const std::string &file, const std::string &path,
+                   std::uint64_t source_size, std::int64_t source_mtime,
+                   const WaveformBuilder &builder);
+
+/**
+ * A read-only, memory-mapped waveform overview file.
+ * (Windows has no mmap, so there the file is read into memory whole.)
+ * @see WriteWaveform
+ */
+class Waveform {
+public:
+	/**
+	 * Maps a waveform overview file.
+	 * @param file The path of the overview file.
+	 * @throws FileError if the file can't be mapped, or isn't a valid
+	 *   overview.
+	 */
+	Waveform(const std::string &file);
+
+	/**
+	 * Unmaps the overview.
+	 */
+	~Waveform();
+
+	Waveform(const Waveform &) = delete;
+	Waveform &operator=(const Waveform &) = delete;
+
+	/**
+	 * Checks whether the overview is of a given file, as it is now.
+	 * @param path The path of the file.
+	 * @param size The file's current size, in bytes.
+	 * @param mtime The file's current modification time, in seconds.
+	 * @return True if the overview is up to date; false otherwise.
+	 */
+	bool Matches(const std::string &path, std::uint64_t size,
+	             std::int64_t mtime) const;
+
+	/**
+	 * The number of channels.
+	 * @return The channel count.
+	 */
+	std::uint8_t Channels() const;
+
+	/**
+	 * The sample rate of the audio.
+	 * @return The sample rate, in Hz.
+	 */
+	std::uint32_t SampleRate() const;
+
+	/**
+	 * The number of levels.
+	 * @return The level count.
+	 */
+	std::size_t Levels() const;
+
+	/**
+	 * The number of points in a level.
+	 * @param level The level, which must be less than Levels().
+	 * @return The point count.
+	 */
+	std::size_t Points(std::size_t level) const;
+
+	/**
+	 * The points of a level.
+	 * @param level The level, which must be less than Levels().
+	 * @return The points, each holding Channels() WavePoints.
+	 */
+	const WavePoint *Level(std::size_t level) const;
+
+private:
+	const char *data; ///< The mapped file.
+	std::size_t size; ///< The size of the mapped file.
+
+	const WaveHeader *header; ///< The header, at the start of data.
+	const char *path;         ///< The analysed file's path.
+
+	/// Each level's offset into data, then the offset of the end.
+	std::vector<std::size_t> offsets;
+
+	/**
+	 * Checks that the mapped file is a valid overview, and finds its parts.
+	 * @throws FileError if it isn't.
+	 */
+	void Validate();
+};
+
+#endif // PS_WAVEFORM_HPP
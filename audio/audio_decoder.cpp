@@ -31,17 +31,22 @@ extern "C" {
 #include "../constants.h"
 #include "../messages.h"
 #include "../sample_formats.hpp"
+#include "../stage_timer.hpp"
 
 #include "audio_decoder.hpp"
 #include "audio_resample.hpp"
 
-AudioDecoder::AudioDecoder(const std::string &path)
+AudioDecoder::AudioDecoder(const std::string &path,
+                           const DecoderOptions &options,
+                           const std::atomic<bool> *cancel)
+        : draining(false),
+          frame_count(0),
+          decode_time(0),
+          frame_latency(nullptr)
 {
-	this->buffer = std::unique_ptr<unsigned char[]>(
-	                new unsigned char[BUFFER_SIZE]);
-
-	Open(path);
-	InitialiseStream();
+	Open(path, options, cancel);
+	InitialiseStream(options);
+	InitialiseSource(options);
 	InitialisePacket();
 	InitialiseFrame();
 	InitialiseResampler();
@@ -52,6 +57,30 @@ AudioDecoder::AudioDecoder(const std::string &path)
 
 AudioDecoder::~AudioDecoder()
 {
+	// Enough to compare codecs and thread settings across runs.
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+	                this->decode_time).count();
+	Debug("decoded", this->frame_count, "frames of",
+	      this->stream->codec->codec->name, "in", us, "us on",
+	      this->stream->codec->thread_count, "threads");
+}
+
+LatencyHistogram &AudioDecoder::FrameLatency(int thread_type)
+{
+	// Kept apart, as frame threading trades each frame's latency for
+	// throughput, and mixing them would hide both.
+	static LatencyHistogram single;
+	static LatencyHistogram frame;
+	static LatencyHistogram slice;
+
+	switch (thread_type) {
+	case FF_THREAD_FRAME:
+		return frame;
+	case FF_THREAD_SLICE:
+		return slice;
+	default:
+		return single;
+	}
 }
 
 /* @return The number of channels this decoder outputs. */
@@ -116,10 +145,14 @@ void AudioDecoder::SeekToPositionMicroseconds(
 
 	Debug("Seeking to:", ffmpeg_position);
 
-	if (av_seek_frame(this->context.get(), this->stream_id, ffmpeg_position,
-	                  AVSEEK_FLAG_ANY) != 0) {
+	if (!this->source->Seek(ffmpeg_position)) {
 		throw InternalError(MSG_SEEK_FAIL);
 	}
+
+	// Otherwise, frames the codec was holding back from before the seek
+	// would come out after it.
+	avcodec_flush_buffers(this->stream->codec);
+	this->draining = false;
 }
 
 std::int64_t AudioDecoder::AvPositionFromMicroseconds(
@@ -143,18 +176,37 @@ std::int64_t AudioDecoder::AvPositionFromMicroseconds(
 std::vector<char> AudioDecoder::Decode()
 {
 	bool complete = false;
-	bool more = true;
 	std::vector<char> vec;
 
-	while (!complete && more) {
-		if (av_read_frame(this->context.get(), this->packet.get()) <
-		    0) {
-			more = false;
-		} else if (this->packet->stream_index == this->stream_id) {
-			complete = DecodePacket();
-			if (complete) {
-				vec = Resample();
-			}
+	while (!complete) {
+		if (!this->draining &&
+		    !this->source->Next(this->packet.get())) {
+			// A threaded codec still holds the last few frames;
+			// empty packets ask it for them.
+			this->draining = true;
+		}
+		if (this->draining) {
+			this->packet->data = nullptr;
+			this->packet->size = 0;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		complete = DecodePacket();
+		av_packet_unref(this->packet.get());
+		if (complete) {
+			vec = Resample();
+		}
+
+		// Time decoding only, not waiting for packets.
+		auto took = std::chrono::duration_cast<LatencyHistogram::Unit>(
+		                std::chrono::steady_clock::now() - start);
+		this->decode_time += took;
+		if (complete) {
+			this->frame_count++;
+			this->frame_latency->Record(took);
+		} else if (this->draining) {
+			// The codec has nothing left.
+			break;
 		}
 	}
 
@@ -163,7 +215,10 @@ std::vector<char> AudioDecoder::Decode()
 
 std::vector<char> AudioDecoder::Resample()
 {
-	return this->resampler->Resample(this->frame.get());
+	StageTimer timer(Stage::RESAMPLE);
+	auto vec = this->resampler->Resample(this->frame.get());
+	timer.AddBytes(vec.size());
+	return vec;
 }
 
 static std::map<AVSampleFormat, SampleFormat> sf_from_av = {
@@ -187,15 +242,61 @@ SampleFormat AudioDecoder::OutputSampleFormat() const
 	}
 }
 
-void AudioDecoder::Open(const std::string &path)
+/**
+ * ffmpeg interrupt callback, which aborts blocking I/O once a flag is set.
+ * @param opaque The std::atomic<bool> flag.
+ * @return Nonzero if the I/O should be aborted; zero otherwise.
+ */
+static int InterruptIfSet(void *opaque)
+{
+	auto cancel = static_cast<const std::atomic<bool> *>(opaque);
+	return cancel->load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+/**
+ * Opens a file in ffmpeg.
+ * @param path The path to the file.
+ * @param reader The reader to read the file through, or nullptr to let ffmpeg
+ *   read it.  This must outlive the returned context.
+ * @param cancel If not nullptr, a flag which, when set, makes any blocking
+ *   I/O give up.
+ * @return The opened context, which must be closed with avformat_close_input.
+ */
+static AVFormatContext *OpenInput(const std::string &path, AvioReader *reader,
+                                  const std::atomic<bool> *cancel)
 {
-	AVFormatContext *ctx = nullptr;
+	AVFormatContext *ctx = avformat_alloc_context();
+	if (ctx == nullptr) {
+		throw std::bad_alloc();
+	}
+
+	if (cancel != nullptr) {
+		ctx->interrupt_callback.callback = InterruptIfSet;
+		ctx->interrupt_callback.opaque = const_cast<void *>(
+		                static_cast<const void *>(cancel));
+	}
+
+	if (reader != nullptr) {
+		ctx->pb = reader->Context();
+		ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
 
+	// avformat_open_input frees the context itself if it fails.
 	if (avformat_open_input(&ctx, path.c_str(), NULL, NULL) < 0) {
 		std::ostringstream os;
 		os << "couldn't open " << path;
 		throw FileError(os.str());
 	}
+	return ctx;
+}
+
+void AudioDecoder::Open(const std::string &path,
+                        const DecoderOptions &options,
+                        const std::atomic<bool> *cancel)
+{
+	this->reader = decltype(this->reader)(
+	                AvioReader::ForPath(path, options, cancel));
+	AVFormatContext *ctx = OpenInput(path, this->reader.get(), cancel);
 
 	auto free_context = [](AVFormatContext *ctx) {
 		avformat_close_input(&ctx);
@@ -205,10 +306,67 @@ void AudioDecoder::Open(const std::string &path)
 	                                                        free_context);
 }
 
-void AudioDecoder::InitialiseStream()
+/**
+ * Adds every entry in an ffmpeg metadata dictionary to a list of tags.
+ * @param dict The dictionary, which may be nullptr.
+ * @param tags The list to add to.
+ */
+static void AddTags(const AVDictionary *dict,
+                    std::vector<std::pair<std::string, std::string>> &tags)
+{
+	AVDictionaryEntry *tag = nullptr;
+	while ((tag = av_dict_get(dict, "", tag, AV_DICT_IGNORE_SUFFIX)) !=
+	       nullptr) {
+		tags.emplace_back(tag->key, tag->value);
+	}
+}
+
+FileInfo AudioDecoder::Probe(const std::string &path,
+                             const DecoderOptions &options)
+{
+	std::unique_ptr<AvioReader> reader(
+	                AvioReader::ForPath(path, options, nullptr));
+	auto close = [](AVFormatContext *ctx) { avformat_close_input(&ctx); };
+	std::unique_ptr<AVFormatContext, decltype(close)> context(
+	                OpenInput(path, reader.get(), nullptr), close);
+	AVFormatContext *ctx = context.get();
+
+	if (avformat_find_stream_info(ctx, NULL) < 0) {
+		throw FileError(MSG_DECODE_NOAUDIO);
+	}
+
+	AVCodec *codec = nullptr;
+	int id = av_find_best_stream(ctx, AVMEDIA_TYPE_AUDIO, -1, -1, &codec,
+	                             0);
+	if (id < 0) {
+		throw FileError(MSG_DECODE_NOSTREAM);
+	}
+	AVStream *stream = ctx->streams[id];
+
+	FileInfo info;
+	info.duration = std::chrono::microseconds(0);
+	if (ctx->duration != AV_NOPTS_VALUE) {
+		// AV_TIME_BASE is one microsecond.
+		info.duration = std::chrono::microseconds(ctx->duration);
+	}
+	info.format = ctx->iformat->name;
+	info.codec = (codec == nullptr) ? "" : codec->name;
+	info.sample_rate = static_cast<std::uint32_t>(
+	                stream->codec->sample_rate);
+	info.channels = static_cast<std::uint16_t>(stream->codec->channels);
+	info.bit_rate = ctx->bit_rate;
+
+	// Some containers (Ogg, for one) keep their tags on the stream.
+	AddTags(ctx->metadata, info.tags);
+	AddTags(stream->metadata, info.tags);
+
+	return info;
+}
+
+void AudioDecoder::InitialiseStream(const DecoderOptions &options)
 {
 	FindStreamInfo();
-	FindStreamAndInitialiseCodec();
+	FindStreamAndInitialiseCodec(options);
 }
 
 void AudioDecoder::FindStreamInfo()
@@ -218,7 +376,8 @@ void AudioDecoder::FindStreamInfo()
 	}
 }
 
-void AudioDecoder::FindStreamAndInitialiseCodec()
+void AudioDecoder::FindStreamAndInitialiseCodec(
+                const DecoderOptions &options)
 {
 	AVCodec *codec;
 	int stream = av_find_best_stream(this->context.get(),
@@ -228,18 +387,62 @@ void AudioDecoder::FindStreamAndInitialiseCodec()
 		throw FileError(MSG_DECODE_NOSTREAM);
 	}
 
-	InitialiseCodec(stream, codec);
+	InitialiseCodec(stream, codec, options);
 }
 
-void AudioDecoder::InitialiseCodec(int stream, AVCodec *codec)
+void AudioDecoder::InitialiseCodec(int stream, AVCodec *codec,
+                                   const DecoderOptions &options)
 {
 	AVCodecContext *codec_context = this->context->streams[stream]->codec;
+	if (WantsCodecThreads(options)) {
+		codec_context->thread_count = options.codec_threads;
+		codec_context->thread_type = options.codec_thread_type;
+	} else {
+		codec_context->thread_count = 1;
+	}
+
 	if (avcodec_open2(codec_context, codec, NULL) < 0) {
 		throw FileError(MSG_DECODE_NOCODEC);
 	}
 
 	this->stream = this->context->streams[stream];
 	this->stream_id = stream;
+	this->frame_latency = &FrameLatency(codec_context->active_thread_type);
+
+	Debug("codec threads:", codec_context->thread_count);
+}
+
+bool AudioDecoder::WantsCodecThreads(const DecoderOptions &options) const
+{
+	if (options.codec_threads == 1) {
+		return false;
+	}
+
+	// Files of unknown length are assumed to be long.
+	std::int64_t duration = this->context->duration;
+	if (duration == AV_NOPTS_VALUE) {
+		return true;
+	}
+
+	auto length = std::chrono::seconds(duration / AV_TIME_BASE);
+	return CODEC_THREADS_MIN_LENGTH <= length;
+}
+
+void AudioDecoder::InitialiseSource(const DecoderOptions &options)
+{
+	if (options.cache_packets) {
+		this->source = decltype(this->source)(
+		                new PacketStore(this->context.get(),
+		                                this->stream_id));
+	} else if (0 < options.demux_queue) {
+		this->source = decltype(this->source)(new DemuxStage(
+		                this->context.get(), this->stream_id,
+		                options.demux_queue));
+	} else {
+		this->source = decltype(this->source)(
+		                new DemuxSource(this->context.get(),
+		                                this->stream_id));
+	}
 }
 
 void AudioDecoder::InitialiseFrame()
@@ -254,17 +457,12 @@ void AudioDecoder::InitialiseFrame()
 
 void AudioDecoder::InitialisePacket()
 {
-	auto packet_deleter = [](AVPacket *packet) {
-		av_free_packet(packet);
-		delete packet;
-	};
+	auto packet_deleter = [](AVPacket *packet) { av_packet_free(&packet); };
 	this->packet = std::unique_ptr<AVPacket, decltype(packet_deleter)>(
-	                new AVPacket, packet_deleter);
-
-	AVPacket *pkt = this->packet.get();
-	av_init_packet(pkt);
-	pkt->data = this->buffer.get();
-	pkt->size = BUFFER_SIZE;
+	                av_packet_alloc(), packet_deleter);
+	if (this->packet == nullptr) {
+		throw std::bad_alloc();
+	}
 }
 
 void AudioDecoder::InitialiseResampler()
@@ -293,6 +491,8 @@ bool AudioDecoder::DecodePacket()
 {
 	int frame_finished = 0;
 
+	StageTimer timer(Stage::DECODE);
+	timer.AddBytes(static_cast<std::uint64_t>(this->packet->size));
 	if (avcodec_decode_audio4(this->stream->codec, this->frame.get(),
 	                          &frame_finished, this->packet.get()) < 0) {
 		throw FileError(MSG_DECODE_FAIL);
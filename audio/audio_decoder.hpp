@@ -10,10 +10,12 @@
 #ifndef PS_AUDIO_DECODER_HPP
 #define PS_AUDIO_DECODER_HPP
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <functional>
 #include <string>
+#include <utility>
 #include <vector>
 
 extern "C" {
@@ -21,10 +23,67 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
+#include "../constants.h"
 #include "../errors.hpp"
+#include "../latency_histogram.hpp"
 #include "../sample_formats.hpp"
 
 #include "audio_resample.hpp"
+#include "avio_reader.hpp"
+#include "packet_source.hpp"
+
+/**
+ * Settings affecting how AudioDecoders open and decode files.
+ */
+struct DecoderOptions {
+	/// The number of blocks to keep reading ahead of the decoder, or 0 to
+	/// read local files through a memory mapping instead.
+	std::size_t readahead_blocks;
+
+	/// Whether to demux each file into memory in the background, so that
+	/// decoding and seeking don't touch storage once it is loaded.
+	bool cache_packets;
+
+	/// The number of packets to demux ahead of the decoder on a separate
+	/// thread, or 0 to demux on the decoding thread.  This must be a power
+	/// of two, and is ignored if cache_packets is set.
+	std::size_t demux_queue;
+
+	/// The number of threads each codec may decode on, or 0 to let ffmpeg
+	/// pick one per core.  This is ignored for files shorter than
+	/// CODEC_THREADS_MIN_LENGTH, which always decode on one thread.
+	int codec_threads;
+
+	/// The kinds of codec threading allowed, as FF_THREAD_* flags.
+	int codec_thread_type;
+
+	/**
+	 * Constructs the default DecoderOptions.
+	 */
+	DecoderOptions()
+	        : readahead_blocks(0),
+	          cache_packets(false),
+	          demux_queue(DEMUX_QUEUE_PACKETS),
+	          codec_threads(1),
+	          codec_thread_type(FF_THREAD_FRAME | FF_THREAD_SLICE)
+	{
+	}
+};
+
+/**
+ * What probing a file finds out about it, without decoding it.
+ */
+struct FileInfo {
+	std::chrono::microseconds duration; ///< The length, or 0 if unknown.
+	std::string format;                 ///< The container format's name.
+	std::string codec;                  ///< The audio codec's name.
+	std::uint32_t sample_rate;          ///< The sample rate, in Hz.
+	std::uint16_t channels;             ///< The channel count.
+	std::int64_t bit_rate;              ///< The bit rate, or 0 if unknown.
+
+	/// The file's tags (container and stream metadata), as key-value pairs.
+	std::vector<std::pair<std::string, std::string>> tags;
+};
 
 /**
  * An object responsible for decoding an audio file.
@@ -39,8 +98,13 @@ public:
 	 * Constructs an AudioDecoder.
 	 * @param path The path to the file to load and decode using this
 	 * decoder.
+	 * @param options Settings for opening and decoding the file.
+	 * @param cancel If not nullptr, a flag which, when set, makes any
+	 *   blocking I/O in this decoder give up.
 	 */
-	AudioDecoder(const std::string &path);
+	AudioDecoder(const std::string &path,
+	             const DecoderOptions &options = DecoderOptions(),
+	             const std::atomic<bool> *cancel = nullptr);
 
 	/**
 	 * Destructs an AudioDecoder.
@@ -75,6 +139,27 @@ public:
 	 */
 	SampleFormat OutputSampleFormat() const;
 
+	/**
+	 * The histogram of times taken to decode and resample each frame, for
+	 * one kind of codec threading.
+	 * @param thread_type The codec's active thread type: 0 for none, or
+	 *   FF_THREAD_FRAME or FF_THREAD_SLICE.
+	 * @return The histogram, shared by all AudioDecoders threaded that way.
+	 */
+	static LatencyHistogram &FrameLatency(int thread_type);
+
+	/**
+	 * Probes a file, without opening its codec or decoding it.
+	 * This opens the file the same way as the constructor does, so finds
+	 * the same stream an AudioDecoder for it would decode.
+	 * @param path The path to the file to probe.
+	 * @param options Settings for opening the file.
+	 * @return What was found out about the file.
+	 * @throws FileError if the file can't be opened or has no audio.
+	 */
+	static FileInfo Probe(const std::string &path,
+	                      const DecoderOptions &options);
+
 	/**
 	 * Returns the number of samples this decoder's buffer can store.
 	 * @return The buffer sample capacity, in samples.
@@ -116,23 +201,42 @@ private:
 	AVStream *stream; ///< The FFmpeg stream being decoded.
 	int stream_id; ///< The ID of the input file's audio stream to decode.
 
+	/// Our own reader for the input file, or nullptr if ffmpeg is
+	/// reading it.  This must outlive the context.
+	std::unique_ptr<AvioReader> reader;
+
 	std::unique_ptr<AVFormatContext, std::function<void(AVFormatContext *)>>
 	                context; ///< The input codec context.
+
+	/// Where packets of the stream come from.  This may use the context
+	/// from another thread, so must be destroyed before it.
+	std::unique_ptr<PacketSource> source;
+
 	std::unique_ptr<AVPacket, std::function<void(AVPacket *)>>
 	                packet; ///< The last undecoded packet.
 	std::unique_ptr<AVFrame, std::function<void(AVFrame *)>>
-	                frame;                   ///< The last decoded frame.
-	std::unique_ptr<unsigned char[]> buffer; ///< The decoding buffer.
-	std::unique_ptr<Resampler> resampler;    ///< The object providing
-	                                         ///resampling.
+	                frame;                ///< The last decoded frame.
+	std::unique_ptr<Resampler> resampler; ///< The object providing
+	                                      ///resampling.
+
+	/// Whether the source has run out, and the codec is being emptied.
+	bool draining;
+
+	std::uint64_t frame_count;          ///< The frames decoded so far.
+	LatencyHistogram::Unit decode_time; ///< The time spent decoding them.
+	LatencyHistogram *frame_latency;    ///< Where each frame's time goes.
 
-	void Open(const std::string &path);
+	void Open(const std::string &path, const DecoderOptions &options,
+	          const std::atomic<bool> *cancel);
 
-	void InitialiseStream();
+	void InitialiseStream(const DecoderOptions &options);
+	void InitialiseSource(const DecoderOptions &options);
 	void FindStreamInfo();
-	void FindStreamAndInitialiseCodec();
+	void FindStreamAndInitialiseCodec(const DecoderOptions &options);
 
-	void InitialiseCodec(int stream, AVCodec *codec);
+	void InitialiseCodec(int stream, AVCodec *codec,
+	                     const DecoderOptions &options);
+	bool WantsCodecThreads(const DecoderOptions &options) const;
 	void InitialiseFrame();
 	void InitialisePacket();
 	void InitialiseResampler();
@@ -0,0 +1,127 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Gain class.
+ * @see audio/audio_gain.hpp
+ */
+
+#include <algorithm>
+#include <cstdint>
+
+#include "../sample_formats.hpp"
+
+#include "audio_gain.hpp"
+
+/**
+ * Applies a ramped, then constant, gain to packed samples of type T.
+ *
+ * The constant section is a flat loop over every channel value, with no
+ * per-sample ramp arithmetic.
+ *
+ * @tparam T  The channel value type.
+ */
+template <typename T>
+static void GainKernel(T *s, unsigned long count, std::uint8_t channels,
+                       float &current, float step, std::uint64_t &ramp_left,
+                       float ramp_to)
+{
+	using Traits = SampleTraits<T>;
+	using Calc = typename Traits::Calc;
+
+	unsigned long ramped = static_cast<unsigned long>(
+	                std::min<std::uint64_t>(ramp_left, count));
+	for (unsigned long i = 0; i < ramped; i++) {
+		current += step;
+		Calc g = static_cast<Calc>(current);
+		for (std::uint8_t c = 0; c < channels; c++, s++) {
+			*s = Traits::Pack(Traits::Unpack(*s) * g);
+		}
+	}
+	ramp_left -= ramped;
+	if (ramp_left == 0) {
+		current = ramp_to;
+	}
+
+	// Unity gain outside a ramp is the common case, so skip it.
+	if (current == 1.0f) {
+		return;
+	}
+
+	Calc g = static_cast<Calc>(current);
+	unsigned long n = (count - ramped) * channels;
+	for (unsigned long i = 0; i < n; i++) {
+		s[i] = Traits::Pack(Traits::Unpack(s[i]) * g);
+	}
+}
+
+/**
+ * Function object binding the arguments of GainKernel, so that it can be
+ * dispatched on sample format with OnSampleFormat.
+ */
+struct GainKernelCall {
+	unsigned long count;     ///< Number of samples.
+	std::uint8_t channels;   ///< Number of channels per sample.
+	float &current;          ///< The gain currently being applied.
+	float step;              ///< Per-sample change in gain during a ramp.
+	std::uint64_t &ramp_left; ///< Samples left in the current ramp.
+	float ramp_to;           ///< The gain at the end of the ramp.
+
+	template <typename T>
+	void operator()(T *s)
+	{
+		GainKernel(s, count, channels, current, step, ramp_left,
+		           ramp_to);
+	}
+};
+
+Gain::Gain(std::uint64_t ramp_samples)
+    : target(1.0f),
+      primed(false),
+      current(1.0f),
+      ramp_to(1.0f),
+      ramp_step(0.0f),
+      ramp_left(0),
+      ramp_samples(std::max<std::uint64_t>(ramp_samples, 1))
+{
+}
+
+void Gain::SetTarget(float linear)
+{
+	this->target.store(linear, std::memory_order_relaxed);
+}
+
+void Gain::CheckTarget()
+{
+	float t = this->target.load(std::memory_order_relaxed);
+
+	// The first buffer played should start at the target, not ramp to it.
+	if (!this->primed) {
+		this->current = this->ramp_to = t;
+		this->primed = true;
+	}
+
+	if (t != this->ramp_to) {
+		this->ramp_to = t;
+		this->ramp_left = this->ramp_samples;
+		this->ramp_step = (t - this->current) /
+		                  static_cast<float>(this->ramp_samples);
+	}
+}
+
+void Gain::Apply(SampleFormat fmt, char *samples, unsigned long count,
+                 std::uint8_t channels)
+{
+	CheckTarget();
+
+	// Nothing to do if we're at unity gain and not ramping.
+	if (this->ramp_left == 0 && this->current == 1.0f) {
+		return;
+	}
+
+	OnSampleFormat(fmt, samples,
+	               GainKernelCall{count, channels, this->current,
+	                              this->ramp_step, this->ramp_left,
+	                              this->ramp_to});
+}
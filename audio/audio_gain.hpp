@@ -0,0 +1,72 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Gain class.
+ * @see audio/audio_gain.cpp
+ */
+
+#ifndef PS_AUDIO_GAIN_HPP
+#define PS_AUDIO_GAIN_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "../sample_formats.hpp"
+
+/**
+ * A click-free gain stage, applied to packed samples in the play callback.
+ *
+ * The control thread sets a target gain with SetTarget; the play callback
+ * calls Apply, which moves the gain it is actually applying towards the
+ * target in a linear ramp lasting a fixed number of samples.  The only
+ * state shared between the two threads is the target, which is atomic, so
+ * Apply never blocks.
+ */
+class Gain {
+public:
+	/**
+	 * Constructs a Gain, initially at unity.
+	 * @param ramp_samples  The number of samples over which gain changes
+	 *                      are ramped.
+	 */
+	Gain(std::uint64_t ramp_samples);
+
+	/**
+	 * Sets the gain to ramp towards.
+	 * This may be called from any thread.
+	 * @param linear  The new target gain, as a linear multiplier.
+	 */
+	void SetTarget(float linear);
+
+	/**
+	 * Applies the gain to a buffer of packed samples, in place.
+	 * This must only be called from the play callback.
+	 * @param fmt       The format of the samples in @a samples.
+	 * @param samples   The sample buffer.
+	 * @param count     The number of samples in @a samples.
+	 * @param channels  The number of channels in each sample.
+	 */
+	void Apply(SampleFormat fmt, char *samples, unsigned long count,
+	           std::uint8_t channels);
+
+private:
+	std::atomic<float> target; ///< The gain to ramp towards.
+
+	// The following are only touched by the play callback.
+
+	bool primed;         ///< Whether Apply has been called yet.
+	float current;       ///< The gain currently being applied.
+	float ramp_to;       ///< The gain the current ramp ends at.
+	float ramp_step;     ///< The change in gain per sample in the ramp.
+	std::uint64_t ramp_left;    ///< Samples left in the current ramp.
+	std::uint64_t ramp_samples; ///< The length of a full ramp.
+
+	/**
+	 * Starts a new ramp if the target has changed.
+	 */
+	void CheckTarget();
+};
+
+#endif // PS_AUDIO_GAIN_HPP
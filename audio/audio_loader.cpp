@@ -0,0 +1,88 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the AudioLoader class.
+ * @see audio/audio_loader.hpp
+ */
+
+#include <cassert>
+#include <exception>
+#include <string>
+
+#include "../errors.hpp"
+
+#include "audio_loader.hpp"
+#include "audio_output.hpp"
+
+AudioLoader::AudioLoader(const std::string &path, const StreamConfigurator &c,
+                         const DecoderOptions &options)
+        : path(path),
+          configurator(c),
+          options(options),
+          cancelled(std::make_shared<std::atomic<bool>>(false)),
+          done(false),
+          taken(false)
+{
+	// Start the worker last: it reads the members above.
+	this->worker = std::thread(&AudioLoader::Run, this);
+}
+
+AudioLoader::~AudioLoader()
+{
+	// A taken output's decoder still checks the flag, so only cancel a
+	// load nobody has taken.
+	if (!this->taken) {
+		Cancel();
+	}
+	this->worker.join();
+}
+
+bool AudioLoader::IsDone() const
+{
+	return this->done.load(std::memory_order_acquire);
+}
+
+void AudioLoader::Cancel()
+{
+	this->cancelled->store(true, std::memory_order_relaxed);
+}
+
+const std::string &AudioLoader::Path() const
+{
+	return this->path;
+}
+
+AudioOutput *AudioLoader::Take()
+{
+	assert(IsDone());
+	assert(!this->cancelled->load(std::memory_order_relaxed));
+
+	if (this->error != nullptr) {
+		std::rethrow_exception(this->error);
+	}
+
+	assert(this->output != nullptr);
+	this->taken = true;
+	this->output->OpenStream(this->configurator);
+	return this->output.release();
+}
+
+void AudioLoader::Run()
+{
+	try
+	{
+		this->output = decltype(this->output)(
+		                new AudioOutput(this->path, this->options,
+		                                this->cancelled));
+		this->output->PreFillRingBuffer();
+		Debug("loaded", this->path);
+	}
+	catch (...)
+	{
+		this->error = std::current_exception();
+	}
+
+	this->done.store(true, std::memory_order_release);
+}
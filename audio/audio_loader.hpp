@@ -0,0 +1,109 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the AudioLoader class.
+ * @see audio/audio_loader.cpp
+ */
+
+#ifndef PS_AUDIO_LOADER_HPP
+#define PS_AUDIO_LOADER_HPP
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "audio_output.hpp"
+
+/**
+ * A file being loaded into an AudioOutput on a worker thread.
+ *
+ * The worker opens and probes the file, opens its codec, and pre-fills the
+ * ring buffer, none of which need the control thread.  Once IsDone, the
+ * control thread calls Take to attach the output to a PortAudio stream and
+ * take ownership of it.
+ *
+ * Destroying an AudioLoader cancels it, unless its output has been taken,
+ * and waits for the worker to finish; cancellation interrupts any blocking
+ * ffmpeg I/O, so this is usually quick, but callers that can't afford to
+ * wait should Cancel the loader and keep it until IsDone.
+ */
+class AudioLoader {
+public:
+	/**
+	 * Starts loading a file.
+	 * @param path The path to the file to load.
+	 * @param c An object that can configure PortAudio streams.  This will
+	 *   usually be the AudioSystem, and must outlive the AudioLoader.
+	 * @param options Settings for opening and decoding the file.
+	 * @see AudioSystem::Load
+	 */
+	AudioLoader(const std::string &path, const StreamConfigurator &c,
+	            const DecoderOptions &options);
+
+	/**
+	 * Cancels the load, if its output hasn't been taken, and waits for the
+	 * worker to finish.
+	 */
+	~AudioLoader();
+
+	AudioLoader(const AudioLoader &) = delete;
+	AudioLoader &operator=(const AudioLoader &) = delete;
+
+	/**
+	 * Checks whether the worker has finished.
+	 * @return True if the load has succeeded, failed or been cancelled;
+	 *   false if it is still in progress.
+	 */
+	bool IsDone() const;
+
+	/**
+	 * Asks the worker to give up as soon as possible.
+	 */
+	void Cancel();
+
+	/**
+	 * Opens the loaded output's stream and takes ownership of the output.
+	 * This must only be called once, after IsDone returns true, and not
+	 * after Cancel.
+	 * @return The loaded AudioOutput, which is owned by the caller.
+	 * @throws Error (or a subclass) if the load failed.
+	 */
+	AudioOutput *Take();
+
+	/**
+	 * The path of the file being loaded.
+	 * @return The path.
+	 */
+	const std::string &Path() const;
+
+private:
+	std::string path; ///< The path of the file being loaded.
+	const StreamConfigurator &configurator; ///< Opens the output stream.
+	DecoderOptions options; ///< Settings for opening and decoding.
+
+	/// Set to ask the worker to give up.  This is shared with the output,
+	/// whose decoder keeps checking it after the loader is gone.
+	std::shared_ptr<std::atomic<bool>> cancelled;
+
+	std::atomic<bool> done; ///< Set by the worker when it finishes.
+	bool taken;             ///< Whether Take has handed the output over.
+
+	/// The loaded output; only valid once done, and if error is null.
+	std::unique_ptr<AudioOutput> output;
+
+	/// The exception that ended the load, if any; only valid once done.
+	std::exception_ptr error;
+
+	std::thread worker; ///< The thread doing the load.
+
+	/**
+	 * The body of the worker thread.
+	 */
+	void Run();
+};
+
+#endif // PS_AUDIO_LOADER_HPP
@@ -0,0 +1,119 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the LevelMeter class.
+ * @see audio/audio_meter.hpp
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "../constants.h"
+#include "../sample_formats.hpp"
+
+#include "audio_meter.hpp"
+
+/**
+ * Function object computing the peak and sum of squares of each channel of a
+ * block of packed samples, normalised to full scale.
+ *
+ * The reductions are branch-free max and multiply-add chains over fixed-size
+ * per-channel accumulators, which are folded into the totals once a block.
+ */
+struct MeterKernelCall {
+	unsigned long count;   ///< Number of samples.
+	std::uint8_t channels; ///< Number of channels per sample.
+	std::uint8_t metered;  ///< Number of channels to meter.
+	float *peak;           ///< Per-channel peaks to update.
+	std::uint64_t *sum_sq; ///< Per-channel scaled sums of squares to add to.
+
+	template <typename T>
+	void operator()(const T *s)
+	{
+		using Traits = SampleTraits<T>;
+		using Calc = typename Traits::Calc;
+
+		Calc pk[METER_MAX_CHANNELS] = {};
+		Calc sq[METER_MAX_CHANNELS] = {};
+
+		for (unsigned long i = 0; i < count; i++, s += channels) {
+			for (std::uint8_t c = 0; c < metered; c++) {
+				Calc v = Traits::Unpack(s[c]);
+				pk[c] = std::max(pk[c], std::abs(v));
+				sq[c] += v * v;
+			}
+		}
+
+		Calc scale = 1 / Traits::FullScale();
+		for (std::uint8_t c = 0; c < metered; c++) {
+			peak[c] = std::max(peak[c],
+			                   static_cast<float>(pk[c] * scale));
+			double block = static_cast<double>(sq[c]) * scale *
+			               scale;
+			sum_sq[c] += static_cast<std::uint64_t>(
+			                std::llround(block * METER_SUM_SCALE));
+		}
+	}
+};
+
+LevelMeter::LevelMeter(SampleFormat fmt, std::uint8_t channels)
+    : format(fmt),
+      channels(channels),
+      metered(std::min<std::uint8_t>(channels, METER_MAX_CHANNELS)),
+      totals(),
+      taken(),
+      published()
+{
+	for (auto &p : this->peak) {
+		p.store(0.0f, std::memory_order_relaxed);
+	}
+}
+
+void LevelMeter::Feed(const char *samples, unsigned long count)
+{
+	float pk[METER_MAX_CHANNELS] = {};
+	OnSampleFormat(this->format, const_cast<char *>(samples),
+	               MeterKernelCall{count, this->channels, this->metered,
+	                               pk, this->totals.sum_sq});
+	this->totals.count += count;
+
+	// Only Take competes for the peaks, so this rarely goes round twice.
+	for (std::uint8_t c = 0; c < this->metered; c++) {
+		float old = this->peak[c].load(std::memory_order_relaxed);
+		while (old < pk[c] &&
+		       !this->peak[c].compare_exchange_weak(
+		                       old, pk[c], std::memory_order_relaxed)) {
+		}
+	}
+
+	this->published.Store(this->totals);
+}
+
+bool LevelMeter::Take(Levels &levels)
+{
+	Totals t = this->published.Load();
+	std::uint64_t count = t.count - this->taken.count;
+
+	// If the callback hasn't run since the last Take, there is nothing
+	// to report.  Any peak it is raising now goes in the next report.
+	if (count == 0) {
+		return false;
+	}
+
+	levels.channels = this->metered;
+	for (std::uint8_t c = 0; c < this->metered; c++) {
+		double sum_sq = static_cast<double>(
+		                        t.sum_sq[c] - this->taken.sum_sq[c]) /
+		                METER_SUM_SCALE;
+		levels.peak[c] = this->peak[c].exchange(
+		                0.0f, std::memory_order_relaxed);
+		levels.rms[c] = static_cast<float>(std::sqrt(sum_sq / count));
+	}
+
+	this->taken = t;
+	return true;
+}
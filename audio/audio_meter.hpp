@@ -0,0 +1,98 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the LevelMeter class.
+ * @see audio/audio_meter.cpp
+ */
+
+#ifndef PS_AUDIO_METER_HPP
+#define PS_AUDIO_METER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "../constants.h"
+#include "../sample_formats.hpp"
+#include "../seqlock.hpp"
+
+/**
+ * Per-channel peak and RMS levels over some stretch of audio.
+ *
+ * Levels are linear and relative to full scale, so a full-scale square
+ * wave has peak and RMS of 1.
+ */
+struct Levels {
+	std::uint8_t channels; ///< The number of channels metered.
+	float peak[METER_MAX_CHANNELS]; ///< Per-channel peak level.
+	float rms[METER_MAX_CHANNELS];  ///< Per-channel RMS level.
+};
+
+/**
+ * A streaming peak and RMS level meter, fed by the play callback.
+ *
+ * The play callback calls Feed on each block it sends to PortAudio, and the
+ * meter accumulates the peak and sum of squares of each channel.  The
+ * control thread calls Take to get the levels since it last called Take.
+ *
+ * The callback never resets its totals, so no block can fall between two
+ * reports.  Sample counts and sums of squares only ever grow, and are
+ * published through a SeqLock; Take reports the difference from the
+ * totals it saw last time.  Sums of squares are kept in fixed point, so
+ * the differences are exact however long the meter runs.  Peaks can't be
+ * differenced, so each channel's peak is an atomic that the callback
+ * raises and Take swaps back to zero.  Neither side ever waits on the
+ * other.
+ */
+class LevelMeter {
+public:
+	/**
+	 * Constructs a LevelMeter.
+	 * @param fmt       The format of the samples to be metered.
+	 * @param channels  The number of channels in each sample.  Channels
+	 *                  past METER_MAX_CHANNELS are ignored.
+	 */
+	LevelMeter(SampleFormat fmt, std::uint8_t channels);
+
+	/**
+	 * Meters a block of packed samples.
+	 * This must only be called from the play callback.
+	 * @param samples  The sample buffer.
+	 * @param count    The number of samples in @a samples.
+	 */
+	void Feed(const char *samples, unsigned long count);
+
+	/**
+	 * Gets the levels since the last call to Take, and starts afresh.
+	 * This must only be called from one thread.
+	 * @param levels  Where to put the levels.
+	 * @return  False, leaving @a levels alone, if nothing has been metered
+	 *   since the last call to Take; true otherwise.
+	 */
+	bool Take(Levels &levels);
+
+private:
+	/// Running totals of the metered audio.
+	struct Totals {
+		std::uint64_t count; ///< The number of samples metered.
+
+		/// Per-channel sums of squares, scaled by METER_SUM_SCALE.
+		/// These wrap, but their differences don't.
+		std::uint64_t sum_sq[METER_MAX_CHANNELS];
+	};
+
+	SampleFormat format;    ///< The format of metered samples.
+	std::uint8_t channels;  ///< The number of channels per sample.
+	std::uint8_t metered;   ///< The number of channels metered.
+
+	Totals totals; ///< The play callback's running totals.
+	Totals taken;  ///< The totals as of the last Take.
+
+	SeqLock<Totals> published; ///< The last published totals.
+
+	/// Per-channel peaks since the last Take.
+	std::atomic<float> peak[METER_MAX_CHANNELS];
+};
+
+#endif // PS_AUDIO_METER_HPP
@@ -20,7 +20,10 @@ extern "C" {
 
 #include <cassert>
 #include <climits>
+#include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <limits>
 #include <string>
 
 #include "portaudiocpp/PortAudioCpp.hxx"
@@ -29,6 +32,8 @@ extern "C" {
 #include "../errors.hpp"
 #include "../sample_formats.hpp"
 #include "../messages.h"
+#include "../stage_timer.hpp"
+#include "../status_page.hpp"
 
 #include "audio_output.hpp"
 #include "audio_decoder.hpp"
@@ -52,15 +57,56 @@ using ConcreteRingBuffer = PaRingBuffer<char, std::uint64_t, RINGBUF_POWER>;
 
 #endif
 
+/// The value of pending_seek when there is no seek pending.
+static const std::uint64_t NO_SEEK = std::numeric_limits<std::uint64_t>::max();
+
 AudioOutput::AudioOutput(const std::string &path, const StreamConfigurator &c)
+        : AudioOutput(path, DecoderOptions(), nullptr)
 {
-	this->av = decltype(this->av)(new AudioDecoder(path));
-	this->out_strm = decltype(this->out_strm)(
-	                c.Configure(*this, *(this->av)));
+	OpenStream(c);
+}
+
+AudioOutput::AudioOutput(const std::string &path,
+                         const DecoderOptions &options,
+                         std::shared_ptr<const std::atomic<bool>> cancel)
+        : cancel(cancel),
+          pending_seek(NO_SEEK),
+          cued(false),
+          cue_time(0),
+          cue_offset(0),
+          cue_fired(false)
+{
+	this->av = decltype(this->av)(
+	                new AudioDecoder(path, options, this->cancel.get()));
 	this->ring_buf = decltype(this->ring_buf)(
 	                new ConcreteRingBuffer(ByteCountForSampleCount(1L)));
 
 	this->position_sample_count = 0;
+	this->playhead_floor = 0;
+	this->published_playhead.Store(Playhead());
+	this->output_latency = 0;
+	this->status = nullptr;
+	this->file_id = 0;
+	this->callback_count = 0;
+
+	this->xruns = XrunStats();
+	this->xruns.min_ring_fill = RINGBUF_SIZE;
+	this->published_xruns.Store(this->xruns);
+
+	// Construct the callback histograms now, rather than on the first
+	// callback, where it would take a lock.
+	CallbackTime();
+	CallbackLoad();
+
+	this->sample_format = this->av->OutputSampleFormat();
+	this->channel_count = this->av->ChannelCount();
+	this->gain = decltype(this->gain)(new Gain(
+	                this->av->SampleCountForPositionMicroseconds(
+	                                GAIN_RAMP_PERIOD)));
+	this->meter = decltype(this->meter)(
+	                new LevelMeter(this->sample_format, this->channel_count));
+	this->watchdog = decltype(this->watchdog)(new DeadAirWatchdog(
+	                this->sample_format, this->channel_count));
 
 	ClearFrame();
 }
@@ -71,31 +117,149 @@ AudioOutput::~AudioOutput()
 	Debug("closed output stream");
 }
 
+void AudioOutput::OpenStream(const StreamConfigurator &c)
+{
+	assert(this->out_strm == nullptr);
+	this->out_strm = decltype(this->out_strm)(
+	                c.Configure(*this, *(this->av)));
+}
+
 void AudioOutput::Start()
+{
+	this->cued.store(false, std::memory_order_relaxed);
+	StartStream();
+}
+
+void AudioOutput::StartAt(std::chrono::system_clock::time_point when)
+{
+	this->cue_target = when;
+	this->cue_time.store(0, std::memory_order_relaxed);
+	this->cue_fired.store(false, std::memory_order_relaxed);
+	this->cued.store(true, std::memory_order_relaxed);
+	StartStream();
+
+	// The stream clock only runs once the stream has started.
+	this->cue_remap = std::chrono::steady_clock::time_point();
+	UpdateCue();
+}
+
+void AudioOutput::UpdateCue()
+{
+	if (!this->cued.load(std::memory_order_acquire)) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (now < this->cue_remap) {
+		return;
+	}
+	this->cue_remap = now + CUE_REMAP_PERIOD;
+
+	this->cue_time.store(StreamTimeAt(this->cue_target),
+	                     std::memory_order_release);
+}
+
+bool AudioOutput::TakeCueOffset(std::chrono::nanoseconds &offset)
+{
+	if (!this->cue_fired.exchange(false, std::memory_order_acquire)) {
+		return false;
+	}
+
+	offset = std::chrono::nanoseconds(
+	                this->cue_offset.load(std::memory_order_relaxed));
+	return true;
+}
+
+PaTime AudioOutput::StreamTimeAt(std::chrono::system_clock::time_point when)
+                const
+{
+	using Clock = std::chrono::system_clock;
+
+	// Bracket each stream clock reading with wall clock readings, and
+	// trust the tightest bracket most.
+	Clock::duration best = Clock::duration::max();
+	Clock::time_point wall;
+	PaTime stream = 0;
+	for (unsigned int i = 0; i < CUE_MAP_TRIES; i++) {
+		auto before = Clock::now();
+		PaTime t = this->out_strm->time();
+		auto after = Clock::now();
+
+		if (after - before < best) {
+			best = after - before;
+			wall = before + (after - before) / 2;
+			stream = t;
+		}
+	}
+
+	if (stream <= 0) {
+		return 0;
+	}
+
+	std::chrono::duration<double> until = when - wall;
+	return stream + until.count();
+}
+
+void AudioOutput::StartStream()
 {
 	PreFillRingBuffer();
 
+	// Nothing before here can be heard once the stream starts.
+	this->playhead_floor = this->position_sample_count;
+	this->output_latency = this->out_strm->outputLatency();
+
 	this->out_strm->start();
 	Debug("audio started");
 }
 
 void AudioOutput::Stop()
 {
+	auto heard = HeardSampleCount();
 	this->out_strm->abort();
 	Debug("audio stopped");
 
-	// TODO: Possibly recover from dropping frames due to abort.
+	// Whatever was decoded but not yet heard (in the ring, or still in
+	// the device's buffers when it was aborted) would otherwise be
+	// skipped on the next start, so go back to what was heard.  With the
+	// callback finished, this also holds the playhead there.
+	SeekToPositionMicroseconds(
+	                this->av->PositionMicrosecondsForSampleCount(heard));
 }
 
 bool AudioOutput::IsStopped()
 {
-	return !this->out_strm->isActive();
+	return this->out_strm == nullptr || !this->out_strm->isActive();
 }
 
 std::chrono::microseconds AudioOutput::CurrentPositionMicroseconds()
 {
 	return this->av->PositionMicrosecondsForSampleCount(
-	                this->position_sample_count);
+	                HeardSampleCount());
+}
+
+std::uint64_t AudioOutput::HeardSampleCount() const
+{
+	Playhead p = this->published_playhead.Load();
+	std::uint64_t end = p.start + p.count;
+	// Once the stream has run out by itself, everything has been heard.
+	if (!p.running || p.dac_time <= 0 || !this->out_strm->isActive()) {
+		return end;
+	}
+
+	// Samples before the buffer's first are still playing out of earlier
+	// buffers until its DAC time, and it plays out at the sample rate
+	// after; it can't get past the end of the buffer until the next
+	// callback says so.
+	double since = this->out_strm->time() - p.dac_time;
+	double heard = p.start + since * SampleRate();
+	heard = std::min(heard, static_cast<double>(end));
+	heard = std::max(heard, static_cast<double>(p.floor));
+	return static_cast<std::uint64_t>(heard);
+}
+
+double AudioOutput::SampleRate() const
+{
+	return this->av->SampleRate();
 }
 
 std::uint64_t AudioOutput::ByteCountForSampleCount(std::uint64_t samples) const
@@ -121,16 +285,95 @@ void AudioOutput::PreFillRingBuffer()
 	}
 }
 
+void AudioOutput::SetGain(float linear)
+{
+	this->gain->SetTarget(linear);
+}
+
+bool AudioOutput::TakeLevels(Levels &levels)
+{
+	return this->meter->Take(levels);
+}
+
+void AudioOutput::SetDeadAirThreshold(std::chrono::microseconds period)
+{
+	this->watchdog->SetThreshold(
+	                this->av->SampleCountForPositionMicroseconds(period));
+}
+
+std::uint64_t AudioOutput::DeadAirAlarms() const
+{
+	return this->watchdog->Alarms();
+}
+
+std::chrono::microseconds AudioOutput::DeadAirLength() const
+{
+	return this->av->PositionMicrosecondsForSampleCount(
+	                this->watchdog->DeadSamples());
+}
+
+XrunStats AudioOutput::Xruns() const
+{
+	return this->published_xruns.Load();
+}
+
+LatencyHistogram &AudioOutput::CallbackTime()
+{
+	static LatencyHistogram histogram;
+	return histogram;
+}
+
+LatencyHistogram &AudioOutput::CallbackLoad()
+{
+	static LatencyHistogram histogram;
+	return histogram;
+}
+
+void AudioOutput::SetStatusPage(StatusPage *page, std::uint64_t file_id)
+{
+	this->status = page;
+	this->file_id = file_id;
+	PublishStatus();
+}
+
+void AudioOutput::PublishStatus()
+{
+	if (this->status == nullptr) {
+		return;
+	}
+
+	StatusTransport t;
+	t.file_id = this->file_id;
+	t.position_samples = this->position_sample_count;
+	t.ring_fill = this->ring_buf->ReadCapacity();
+	t.underruns = this->xruns.ring_underruns + this->xruns.partial_fills;
+	t.callbacks = this->callback_count;
+	t.dead_air_alarms = this->watchdog->Alarms();
+	t.dead_air_samples = this->watchdog->DeadSamples();
+	this->status->UpdateTransport(t);
+}
+
 void AudioOutput::SeekToPositionMicroseconds(
                 std::chrono::microseconds microseconds)
 {
 	this->av->SeekToPositionMicroseconds(microseconds);
-	this->position_sample_count =
-	                this->av->SampleCountForPositionMicroseconds(
-	                                microseconds);
+	auto samples = this->av->SampleCountForPositionMicroseconds(
+	                microseconds);
 
 	ClearFrame();
 	this->ring_buf->Flush();
+
+	// The callback owns the position while it's running, so it picks the
+	// seek up itself; it won't notice a seek while stopped, though.
+	if (IsStopped()) {
+		this->pending_seek.store(NO_SEEK, std::memory_order_relaxed);
+		this->position_sample_count = samples;
+		this->published_playhead.Store(
+		                Playhead{samples, 0, samples, 0, false});
+		PublishStatus();
+	} else {
+		this->pending_seek.store(samples, std::memory_order_release);
+	}
 }
 
 void AudioOutput::ClearFrame()
@@ -188,6 +431,7 @@ void AudioOutput::WriteToRingBuffer(std::uint64_t sample_count)
 	// This should have been established by WriteAllAvailableToRingBuffer.
 	assert(0 < sample_count);
 
+	StageTimer timer(Stage::RING_WRITE);
 	std::uint64_t written_count = this->ring_buf->Write(
 	                &(*this->frame_iterator),
 	                static_cast<ring_buffer_size_t>(sample_count));
@@ -195,6 +439,7 @@ void AudioOutput::WriteToRingBuffer(std::uint64_t sample_count)
 		throw InternalError(MSG_OUTPUT_RINGWRITE);
 	}
 	assert(0 < written_count);
+	timer.AddBytes(ByteCountForSampleCount(written_count));
 
 	AdvanceFrameIterator(written_count);
 }
@@ -245,26 +490,138 @@ std::uint64_t AudioOutput::RingBufferTransferCount()
 
 int AudioOutput::paCallbackFun(const void *, void *out,
                                unsigned long frames_per_buf,
-                               const PaStreamCallbackTimeInfo *,
-                               PaStreamCallbackFlags)
+                               const PaStreamCallbackTimeInfo *time_info,
+                               PaStreamCallbackFlags flags)
 {
+	auto start = std::chrono::steady_clock::now();
 	char *cout = static_cast<char *>(out);
 
+	auto seek = this->pending_seek.exchange(NO_SEEK,
+	                                        std::memory_order_acquire);
+	if (seek != NO_SEEK) {
+		this->position_sample_count = seek;
+		this->playhead_floor = seek;
+	}
+	std::uint64_t buffer_start = this->position_sample_count;
+
+	CountDeviceXruns(flags);
+	std::uint64_t fill = this->ring_buf->ReadCapacity();
+	this->xruns.min_ring_fill = std::min(this->xruns.min_ring_fill, fill);
+
+	// A scheduled start holds the output silent up to its cue.
+	PaTime dac_time = DacTime(time_info);
+	unsigned long lead = CueLead(frames_per_buf, dac_time);
+	std::memset(cout, 0, ByteCountForSampleCount(lead));
+
 	std::pair<PaStreamCallbackResult, unsigned long> result =
-	                std::make_pair(paContinue, 0);
+	                std::make_pair(paContinue, lead);
 
 	while (result.first == paContinue && result.second < frames_per_buf) {
 		result = PlayCallbackStep(cout, frames_per_buf, result);
 	}
+
+	char *played = cout + ByteCountForSampleCount(lead);
+	this->meter->Feed(played, result.second - lead);
+	this->watchdog->Feed(played, result.second - lead);
+
+	if (0 < dac_time) {
+		dac_time += lead / SampleRate();
+	}
+	this->published_playhead.Store(Playhead{
+	                buffer_start,
+	                this->position_sample_count - buffer_start,
+	                this->playhead_floor, dac_time, true});
+
+	this->callback_count++;
+	this->published_xruns.Store(this->xruns);
+	PublishStatus();
+
+	RecordCallbackTime(start, frames_per_buf);
 	return static_cast<int>(result.first);
 }
 
+PaTime AudioOutput::DacTime(const PaStreamCallbackTimeInfo *time_info) const
+{
+	if (time_info == nullptr) {
+		return 0;
+	}
+
+	// Some host APIs leave the DAC time unset, but do give the current
+	// time; the buffer is then heard one output latency later.
+	if (0 < time_info->outputBufferDacTime) {
+		return time_info->outputBufferDacTime;
+	}
+	if (0 < time_info->currentTime) {
+		return time_info->currentTime + this->output_latency;
+	}
+	return 0;
+}
+
+unsigned long AudioOutput::CueLead(unsigned long frames_per_buf,
+                                   PaTime dac_time)
+{
+	if (!this->cued.load(std::memory_order_relaxed)) {
+		return 0;
+	}
+
+	// How long after this buffer starts being heard the cue falls.
+	double until;
+	PaTime cue = this->cue_time.load(std::memory_order_acquire);
+	if (0 < cue && 0 < dac_time) {
+		until = cue - dac_time;
+	} else {
+		// Without a stream clock, fall back on the wall clock, and
+		// take the buffer to be heard one output latency from now.
+		// This is coarser, but still fires, and the offset it reports
+		// says how far out it is.
+		auto now = std::chrono::system_clock::now();
+		std::chrono::duration<double> left = this->cue_target - now;
+		until = left.count() - this->output_latency;
+	}
+
+	// Start at whichever sample is heard nearest the cue, or straight
+	// away if that has already gone.
+	double rate = SampleRate();
+	double lead = std::round(until * rate);
+	if (static_cast<double>(frames_per_buf) <= lead) {
+		return frames_per_buf;
+	}
+	lead = std::max(lead, 0.0);
+
+	double offset = lead / rate - until;
+	this->cue_offset.store(static_cast<std::int64_t>(offset * 1e9),
+	                       std::memory_order_relaxed);
+	this->cued.store(false, std::memory_order_relaxed);
+	this->cue_fired.store(true, std::memory_order_release);
+	return static_cast<unsigned long>(lead);
+}
+
+void AudioOutput::RecordCallbackTime(
+                std::chrono::steady_clock::time_point start,
+                unsigned long frames_per_buf)
+{
+	using Unit = LatencyHistogram::Unit;
+	auto used = std::chrono::duration_cast<Unit>(
+	                std::chrono::steady_clock::now() - start);
+	CallbackTime().Record(used);
+
+	// Nanoseconds used per second of deadline is billionths of it.
+	double deadline = frames_per_buf / SampleRate();
+	if (0 < deadline) {
+		auto load = static_cast<Unit::rep>(used.count() / deadline);
+		CallbackLoad().Record(Unit(load));
+	}
+}
+
 PlayCallbackStepResult AudioOutput::PlayCallbackStep(
                 char *out, unsigned long frames_per_buf,
                 PlayCallbackStepResult in)
 {
 	unsigned long avail = this->ring_buf->ReadCapacity();
 
+	// Carry on from wherever the last step left off.
+	out += ByteCountForSampleCount(in.second);
+
 	auto fn = (avail == 0) ? &AudioOutput::PlayCallbackFailure
 	                       : &AudioOutput::PlayCallbackSuccess;
 	return (this->*fn)(out, avail, frames_per_buf, in);
@@ -286,17 +643,38 @@ PlayCallbackStepResult AudioOutput::PlayCallbackFailure(
 {
 	decltype(in) result;
 
+	// Whatever happens, the rest of the buffer is played, so silence it.
+	memset(out, 0, ByteCountForSampleCount(frames_per_buf - in.second));
+
 	if (FileEnded()) {
 		result = std::make_pair(paComplete, in.second);
 	} else {
-		// Make up some silence to plug the gap.
-		memset(out, 0, ByteCountForSampleCount(frames_per_buf));
+		// The silence plugs the gap.
+		auto now = XrunStats::Clock::now();
+		if (in.second == 0) {
+			this->xruns.ring_underruns++;
+			this->xruns.last_ring_underrun = now;
+		} else {
+			this->xruns.partial_fills++;
+			this->xruns.last_partial_fill = now;
+		}
 		result = std::make_pair(paContinue, frames_per_buf);
 	}
 
 	return result;
 }
 
+void AudioOutput::CountDeviceXruns(PaStreamCallbackFlags flags)
+{
+	if ((flags & paOutputUnderflow) != 0) {
+		this->xruns.device_underflows++;
+		this->xruns.last_device_underflow = XrunStats::Clock::now();
+	}
+	if ((flags & paOutputOverflow) != 0) {
+		this->xruns.device_overflows++;
+	}
+}
+
 unsigned long AudioOutput::ReadSamplesToOutput(char *&output,
                                                unsigned long output_capacity,
                                                unsigned long buffered_count)
@@ -305,8 +683,11 @@ unsigned long AudioOutput::ReadSamplesToOutput(char *&output,
 	                std::min({output_capacity, buffered_count,
 	                          static_cast<unsigned long>(LONG_MAX)}));
 
-	output += this->ring_buf->Read(output, transfer_sample_count);
+	auto read_count = this->ring_buf->Read(output, transfer_sample_count);
+	this->gain->Apply(this->sample_format, output, read_count,
+	                  this->channel_count);
+	output += ByteCountForSampleCount(read_count);
 
-	this->position_sample_count += transfer_sample_count;
-	return transfer_sample_count;
+	this->position_sample_count += read_count;
+	return static_cast<unsigned long>(read_count);
 }
@@ -10,6 +10,7 @@
 #ifndef PS_AUDIO_OUTPUT_HPP
 #define PS_AUDIO_OUTPUT_HPP
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <memory>
@@ -17,6 +18,9 @@
 #include <utility>
 #include <vector>
 
+#include "../latency_histogram.hpp"
+#include "../seqlock.hpp"
+
 #include "portaudio.h"
 #include "portaudiocpp/CallbackInterface.hxx"
 namespace portaudio {
@@ -26,12 +30,58 @@ class Stream;
 template <typename RepT, typename SampleCountT>
 class RingBuffer;
 
+class StatusPage;
+
 #include "audio_decoder.hpp"
+#include "audio_gain.hpp"
+#include "audio_meter.hpp"
 #include "audio_resample.hpp"
+#include "audio_watchdog.hpp"
 
 /// Type of results emitted during the play callback step.
 using PlayCallbackStepResult = std::pair<PaStreamCallbackResult, unsigned long>;
 
+/**
+ * Counts of the ways the play callback has come up short since a file was
+ * loaded, and when each last happened.
+ * Times that have never happened are the clock's epoch.
+ */
+struct XrunStats {
+	/// The clock used to time xruns.
+	using Clock = std::chrono::steady_clock;
+
+	std::uint64_t ring_underruns;    ///< Callbacks with an empty ring.
+	std::uint64_t partial_fills;     ///< Callbacks the ring ran dry in.
+	std::uint64_t device_underflows; ///< Gaps PortAudio reported.
+	std::uint64_t device_overflows;  ///< Overruns PortAudio reported.
+	std::uint64_t min_ring_fill; ///< Fewest samples a callback found.
+
+	Clock::time_point last_ring_underrun;    ///< See ring_underruns.
+	Clock::time_point last_partial_fill;     ///< See partial_fills.
+	Clock::time_point last_device_underflow; ///< See device_underflows.
+};
+
+/**
+ * Where the play callback last left the playhead: which samples of the file
+ * its last buffer held, and when the first of them reaches the DAC.
+ * The playhead between callbacks is interpolated from this.
+ */
+struct Playhead {
+	std::uint64_t start; ///< The position of the buffer's first sample.
+	std::uint64_t count; ///< The number of file samples in the buffer.
+
+	/// The earliest position that can be audible: where playback last
+	/// started or seeked to.  Anything earlier still in flight is from
+	/// before the jump.
+	std::uint64_t floor;
+
+	/// The stream time at which the buffer's first sample is heard, or
+	/// zero if unknown.
+	PaTime dac_time;
+
+	bool running; ///< Whether the stream is playing.
+};
+
 /**
  * Abstract class for objects that can configure PortAudio streams for audio
  * files.
@@ -68,8 +118,32 @@ public:
 	 * @see AudioSystem::Load
 	 */
 	AudioOutput(const std::string &path, const StreamConfigurator &c);
+
+	/**
+	 * Loads a file and constructs an AudioOutput for it, without opening
+	 * its stream.
+	 * The output can be pre-filled, but not started, until OpenStream is
+	 * called; this lets the slow parts of loading happen off the control
+	 * thread.
+	 * @param path The absolute path to the file to open.
+	 * @param options Settings for opening and decoding the file.
+	 * @param cancel If not nullptr, a flag which, when set, interrupts
+	 *   any blocking I/O in the decoder.  The output shares ownership of
+	 *   it, as the decoder may check it at any time.
+	 * @see AudioLoader
+	 */
+	AudioOutput(const std::string &path, const DecoderOptions &options,
+	            std::shared_ptr<const std::atomic<bool>> cancel);
+
 	~AudioOutput();
 
+	/**
+	 * Opens the PortAudio stream for this output.
+	 * @param c An object that can configure PortAudio streams.  This will
+	 *   usually be the AudioSystem.
+	 */
+	void OpenStream(const StreamConfigurator &c);
+
 	/**
 	 * Starts the audio stream.
 	 * @see Stop
@@ -78,7 +152,34 @@ public:
 	void Start();
 
 	/**
-	 * Stops the audio stream.
+	 * Starts the audio stream now, but holds the output silent until a
+	 * given wall-clock time.
+	 * The callback starts the cued audio at the sample that reaches the
+	 * DAC closest to that time.  UpdateCue must be called regularly until
+	 * then.
+	 * @param when The time at which the first sample should be heard.
+	 * @see TakeCueOffset
+	 */
+	void StartAt(std::chrono::system_clock::time_point when);
+
+	/**
+	 * Keeps a scheduled start's target mapped onto the stream clock.
+	 * This does nothing unless a scheduled start is pending.
+	 * @see StartAt
+	 */
+	void UpdateCue();
+
+	/**
+	 * Takes the result of a scheduled start, once it has happened.
+	 * @param offset Set to how far after the target the first sample is
+	 *   heard; negative if before it.
+	 * @return True if the start has happened since the last call; false
+	 *   otherwise, in which case @a offset is unchanged.
+	 */
+	bool TakeCueOffset(std::chrono::nanoseconds &offset);
+
+	/**
+	 * Stops the audio stream, rewinding to the last sample heard.
 	 * @see Start
 	 * @see IsHalted
 	 */
@@ -130,12 +231,19 @@ public:
 
 	/**
 	 * Gets the current played position in the song, in microseconds.
-	 * As this may be executing whilst the playing callback is running,
-	 * do not expect it to be highly accurate.
+	 * This is the position of the sample being heard now, interpolated
+	 * from the DAC time of the last buffer the callback filled, so it
+	 * allows for the output latency.
 	 * @return The current position, in microseconds.
 	 */
 	std::chrono::microseconds CurrentPositionMicroseconds();
 
+	/**
+	 * Returns the sample rate of the output.
+	 * @return The sample rate, in Hz.
+	 */
+	double SampleRate() const;
+
 	/**
 	 * Seek to a position expressed as a std::chrono::duration.
 	 * @param position The position to seek to in the audio.
@@ -159,9 +267,77 @@ public:
 	 */
 	void PreFillRingBuffer();
 
+	/**
+	 * Sets the gain applied to this output's samples.
+	 * Changes are ramped in over GAIN_RAMP_PERIOD to avoid clicks.
+	 * @param linear  The new gain, as a linear multiplier.
+	 */
+	void SetGain(float linear);
+
+	/**
+	 * Gets the output levels since the last call to TakeLevels.
+	 * @param levels  Where to put the per-channel peak and RMS levels.
+	 * @return  False if nothing has been played since the last call;
+	 *   true otherwise.
+	 */
+	bool TakeLevels(Levels &levels);
+
+	/**
+	 * Sets how long output must be dead air before an alarm is raised.
+	 * @param period  The threshold, or zero for no alarms.
+	 * @see DeadAirWatchdog
+	 */
+	void SetDeadAirThreshold(std::chrono::microseconds period);
+
+	/**
+	 * The number of dead air alarms raised since the output was loaded.
+	 * @return The alarm count.
+	 */
+	std::uint64_t DeadAirAlarms() const;
+
+	/**
+	 * How long the output has been dead air, as of the last callback.
+	 * @return The length of the current dead run, or zero if the output
+	 *   is live.
+	 */
+	std::chrono::microseconds DeadAirLength() const;
+
+	/**
+	 * Gets the xrun statistics, as of the last callback.
+	 * This may be called while the stream is running.
+	 * @return The statistics.
+	 */
+	XrunStats Xruns() const;
+
+	/**
+	 * The time each play callback took to run.
+	 * @return The histogram, shared by all AudioOutputs.
+	 */
+	static LatencyHistogram &CallbackTime();
+
+	/**
+	 * The fraction of its deadline (the time its buffer takes to play)
+	 * each play callback took to run.  Fractions are recorded in
+	 * billionths, so a callback that used all of its deadline records as
+	 * one second.
+	 * @return The histogram, shared by all AudioOutputs.
+	 */
+	static LatencyHistogram &CallbackLoad();
+
+	/**
+	 * Sets the status page to which this output publishes its status.
+	 * This must be called before the output is started.
+	 * @param page     The status page, or nullptr for none.
+	 * @param file_id  The ID of this output's file in the status page.
+	 */
+	void SetStatusPage(StatusPage *page, std::uint64_t file_id);
+
 private:
 	bool file_ended; ///< Whether the current file has stopped decoding.
 
+	/// The flag interrupting the decoder's I/O; this must outlive av.
+	std::shared_ptr<const std::atomic<bool>> cancel;
+
 	/// The audio decoder providing the actual audio data.
 	std::unique_ptr<AudioDecoder> av;
 
@@ -177,9 +353,83 @@ private:
 	/// The PortAudio stream to which this AudioOutput outputs.
 	std::unique_ptr<portaudio::Stream> out_strm;
 
-	/// The current position, in samples.
+	/// The position of the next sample to send to PortAudio; only
+	/// touched by the callback once started.
 	uint64_t position_sample_count;
 
+	/// The floor of the callback's next Playhead; only touched by the
+	/// callback once started.
+	uint64_t playhead_floor;
+
+	/// The playhead, as published by the callback.
+	SeqLock<Playhead> published_playhead;
+
+	/// A position the callback should jump to before its next buffer, or
+	/// NO_SEEK.
+	std::atomic<std::uint64_t> pending_seek;
+
+	/// The output latency of the stream, in seconds.
+	PaTime output_latency;
+
+	/// Whether the callback is holding the output until cue_time.
+	std::atomic<bool> cued;
+
+	/// The stream time at which a scheduled start should be heard, or
+	/// zero if not yet mapped.
+	std::atomic<PaTime> cue_time;
+
+	/// How far after cue_time the scheduled start was heard, in
+	/// nanoseconds; valid once cue_fired is set.
+	std::atomic<std::int64_t> cue_offset;
+
+	/// Whether a scheduled start has happened, and not yet been taken.
+	std::atomic<bool> cue_fired;
+
+	/// The wall-clock time of the pending scheduled start.  Set before
+	/// the stream starts, so the callback may read it.
+	std::chrono::system_clock::time_point cue_target;
+
+	/// When cue_target is next mapped onto the stream clock.
+	std::chrono::steady_clock::time_point cue_remap;
+
+	/// The format of the samples sent to PortAudio.
+	SampleFormat sample_format;
+
+	/// The number of channels in each sample sent to PortAudio.
+	std::uint8_t channel_count;
+
+	/// The gain stage applied to samples as they are sent to PortAudio.
+	std::unique_ptr<Gain> gain;
+
+	/// The level meter fed with samples as they are sent to PortAudio.
+	std::unique_ptr<LevelMeter> meter;
+
+	/// The dead air watchdog fed with samples as they are sent to
+	/// PortAudio.
+	std::unique_ptr<DeadAirWatchdog> watchdog;
+
+	/// The status page to publish to, if any.
+	StatusPage *status;
+
+	/// The ID of this output's file in the status page.
+	std::uint64_t file_id;
+
+	/// The xrun statistics; only touched by the callback once started.
+	XrunStats xruns;
+
+	/// The xrun statistics, as published by the callback.
+	SeqLock<XrunStats> published_xruns;
+
+	/// The number of callbacks run.
+	std::uint64_t callback_count;
+
+	/**
+	 * Publishes this output's status to the status page, if any.
+	 * This must only be called from the play callback, or when the
+	 * stream is stopped.
+	 */
+	void PublishStatus();
+
 	/**
 	 * Clears the current frame and its iterator.
 	 */
@@ -211,6 +461,62 @@ private:
 	                                           unsigned long frames_per_buf,
 	                                           PlayCallbackStepResult in);
 
+	/**
+	 * Starts the audio stream, pre-filling the ring buffer first.
+	 */
+	void StartStream();
+
+	/**
+	 * Maps a wall-clock time onto the stream clock.
+	 * @param when The wall-clock time.
+	 * @return The equivalent stream time, or zero if the stream clock
+	 *   can't be read.
+	 */
+	PaTime StreamTimeAt(std::chrono::system_clock::time_point when) const;
+
+	/**
+	 * Works out how many samples of silence the callback must output
+	 * before a scheduled start, firing the start if it falls within the
+	 * buffer.
+	 * If the stream clock or the DAC time is unavailable, this goes by
+	 * the wall clock and the output latency instead.
+	 * @param frames_per_buf The number of samples in the buffer.
+	 * @param dac_time The stream time at which the buffer is heard, or
+	 *   zero if unknown.
+	 * @return The number of samples of silence to lead with.
+	 */
+	unsigned long CueLead(unsigned long frames_per_buf, PaTime dac_time);
+
+	/**
+	 * Works out the position of the sample being heard now.
+	 * @return The position, in samples.
+	 */
+	std::uint64_t HeardSampleCount() const;
+
+	/**
+	 * Works out when the first sample of the callback's buffer will be
+	 * heard.
+	 * @param time_info The timing information passed to the callback.
+	 * @return The stream time at which it will be heard, or zero if
+	 *   PortAudio doesn't say.
+	 */
+	PaTime DacTime(const PaStreamCallbackTimeInfo *time_info) const;
+
+	/**
+	 * Counts any xruns PortAudio reports to the callback.
+	 * @param flags The status flags passed to the callback.
+	 */
+	void CountDeviceXruns(PaStreamCallbackFlags flags);
+
+	/**
+	 * Records how long the callback took, and how much of its deadline
+	 * that was.
+	 * @param start When the callback started.
+	 * @param frames_per_buf The number of samples the callback filled.
+	 */
+	void RecordCallbackTime(std::chrono::steady_clock::time_point start,
+	                        unsigned long frames_per_buf);
+
 	/**
 	 * Reads from the ringbuffer to output, updating the used samples count.
 	 * @param output A reference to the output buffer's current pointer.
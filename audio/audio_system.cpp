@@ -9,11 +9,14 @@
 
 #include <algorithm>
 #include <map>
+#include <mutex>
+#include <new>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 
 extern "C" {
+#include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
 #include "portaudio.h"
 }
@@ -35,19 +38,49 @@ namespace portaudio {
 #include "../sample_formats.hpp"
 
 #include "audio_decoder.hpp"
+#include "audio_loader.hpp"
 #include "audio_output.hpp"
 #include "audio_system.hpp"
 
+/**
+ * Lock manager for ffmpeg, which needs one now that files are opened on
+ * several threads at once.
+ * @param mutex The mutex being operated on.
+ * @param op The operation.
+ * @return Zero on success; nonzero otherwise.
+ */
+static int AvLockManager(void **mutex, AVLockOp op)
+{
+	switch (op) {
+	case AV_LOCK_CREATE:
+		*mutex = new (std::nothrow) std::mutex;
+		return (*mutex == nullptr) ? 1 : 0;
+	case AV_LOCK_OBTAIN:
+		static_cast<std::mutex *>(*mutex)->lock();
+		return 0;
+	case AV_LOCK_RELEASE:
+		static_cast<std::mutex *>(*mutex)->unlock();
+		return 0;
+	case AV_LOCK_DESTROY:
+		delete static_cast<std::mutex *>(*mutex);
+		*mutex = nullptr;
+		return 0;
+	}
+	return 1;
+}
+
 AudioSystem::AudioSystem()
 {
 	portaudio::System::initialize();
 	av_register_all();
+	av_lockmgr_register(AvLockManager);
 
 	SetDeviceID("0");
 }
 
 AudioSystem::~AudioSystem()
 {
+	av_lockmgr_register(nullptr);
 	portaudio::System::terminate();
 }
 
@@ -67,9 +100,14 @@ void AudioSystem::SetDeviceID(const std::string &id)
 	this->device_id = std::string(id);
 }
 
-AudioOutput *AudioSystem::Load(const std::string &path) const
+void AudioSystem::SetDecoderOptions(const DecoderOptions &options)
+{
+	this->decoder_options = options;
+}
+
+AudioLoader *AudioSystem::Load(const std::string &path) const
 {
-	return new AudioOutput(path, *this);
+	return new AudioLoader(path, *this, this->decoder_options);
 }
 
 portaudio::Stream *AudioSystem::Configure(portaudio::CallbackInterface &cb,
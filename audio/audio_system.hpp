@@ -24,6 +24,7 @@ class Device;
 #include "../sample_formats.hpp"
 
 #include "audio_decoder.hpp"
+#include "audio_loader.hpp"
 #include "audio_output.hpp"
 
 /**
@@ -55,11 +56,12 @@ public:
 	~AudioSystem();
 
 	/**
-	 * Loads a file, creating an AudioOutput for it.
+	 * Starts loading a file in the background.
 	 * @param path  The path to a file.
-	 * @return      The AudioOutput for that file.
+	 * @return      An AudioLoader, from which the AudioOutput for that
+	 *              file can be taken once loaded.
 	 */
-	AudioOutput *Load(const std::string &path) const;
+	AudioLoader *Load(const std::string &path) const;
 
 	/**
 	 * Sets the current device ID.
@@ -67,6 +69,12 @@ public:
 	 */
 	void SetDeviceID(const std::string &id);
 
+	/**
+	 * Sets the decoder options.
+	 * @param options  The options to use for subsequent loads.
+	 */
+	void SetDecoderOptions(const DecoderOptions &options);
+
 	/**
 	 * Performs a function on each device entry in the AudioSystem.
 	 * @param f  The function to call on each device.
@@ -78,6 +86,7 @@ public:
 
 private:
 	std::string device_id; ///< The current device ID.
+	DecoderOptions decoder_options; ///< The current decoder options.
 
 	/**
 	 * Converts a string device ID to a PortAudio device.
@@ -0,0 +1,131 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the DeadAirWatchdog class.
+ * @see audio/audio_watchdog.hpp
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "../constants.h"
+#include "../sample_formats.hpp"
+
+#include "audio_watchdog.hpp"
+
+/**
+ * Function object widening the per-channel range of a dead run to cover a
+ * block of packed samples, normalised to full scale.
+ *
+ * Like the level meter's kernel, this reduces into fixed-size per-channel
+ * accumulators with branch-free min and max chains.
+ */
+struct WatchdogKernelCall {
+	unsigned long count;   ///< Number of samples.
+	std::uint8_t channels; ///< Number of channels per sample.
+	std::uint8_t watched;  ///< Number of channels to watch.
+	float *low;            ///< Per-channel minima to update.
+	float *high;           ///< Per-channel maxima to update.
+
+	template <typename T>
+	void operator()(const T *s)
+	{
+		using Traits = SampleTraits<T>;
+		using Calc = typename Traits::Calc;
+
+		Calc lo[METER_MAX_CHANNELS];
+		Calc hi[METER_MAX_CHANNELS];
+		std::fill(lo, lo + METER_MAX_CHANNELS,
+		          std::numeric_limits<Calc>::infinity());
+		std::fill(hi, hi + METER_MAX_CHANNELS,
+		          -std::numeric_limits<Calc>::infinity());
+
+		for (unsigned long i = 0; i < count; i++, s += channels) {
+			for (std::uint8_t c = 0; c < watched; c++) {
+				Calc v = Traits::Unpack(s[c]);
+				lo[c] = std::min(lo[c], v);
+				hi[c] = std::max(hi[c], v);
+			}
+		}
+
+		Calc scale = 1 / Traits::FullScale();
+		for (std::uint8_t c = 0; c < watched; c++) {
+			low[c] = std::min(low[c],
+			                  static_cast<float>(lo[c] * scale));
+			high[c] = std::max(high[c],
+			                   static_cast<float>(hi[c] * scale));
+		}
+	}
+};
+
+DeadAirWatchdog::DeadAirWatchdog(SampleFormat fmt, std::uint8_t channels)
+        : format(fmt),
+          channels(channels),
+          watched(std::min<std::uint8_t>(channels, METER_MAX_CHANNELS)),
+          band(static_cast<float>(std::pow(10.0, DEAD_AIR_BAND_DB / 20.0))),
+          threshold(0),
+          alarms(0),
+          dead_samples(0)
+{
+	ResetRun();
+}
+
+void DeadAirWatchdog::SetThreshold(std::uint64_t samples)
+{
+	this->threshold.store(samples, std::memory_order_relaxed);
+}
+
+void DeadAirWatchdog::Feed(const char *samples, unsigned long count)
+{
+	if (count == 0) {
+		return;
+	}
+
+	OnSampleFormat(this->format, const_cast<char *>(samples),
+	               WatchdogKernelCall{count, this->channels, this->watched,
+	                                  this->low, this->high});
+
+	bool dead = true;
+	for (std::uint8_t c = 0; c < this->watched; c++) {
+		dead = dead && this->high[c] - this->low[c] <= this->band;
+	}
+
+	if (dead) {
+		this->run += count;
+	} else {
+		// Any life in the block ends the run, so start the next one
+		// afresh from the following block.
+		ResetRun();
+	}
+
+	auto t = this->threshold.load(std::memory_order_relaxed);
+	if (!this->alarmed && 0 < t && t <= this->run) {
+		this->alarmed = true;
+		this->alarms.fetch_add(1, std::memory_order_release);
+	}
+	this->dead_samples.store(this->run, std::memory_order_relaxed);
+}
+
+std::uint64_t DeadAirWatchdog::Alarms() const
+{
+	return this->alarms.load(std::memory_order_acquire);
+}
+
+std::uint64_t DeadAirWatchdog::DeadSamples() const
+{
+	return this->dead_samples.load(std::memory_order_relaxed);
+}
+
+void DeadAirWatchdog::ResetRun()
+{
+	std::fill(this->low, this->low + METER_MAX_CHANNELS,
+	          std::numeric_limits<float>::infinity());
+	std::fill(this->high, this->high + METER_MAX_CHANNELS,
+	          -std::numeric_limits<float>::infinity());
+	this->run = 0;
+	this->alarmed = false;
+}
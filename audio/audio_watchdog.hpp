@@ -0,0 +1,95 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the DeadAirWatchdog class.
+ * @see audio/audio_watchdog.cpp
+ */
+
+#ifndef PS_AUDIO_WATCHDOG_HPP
+#define PS_AUDIO_WATCHDOG_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "../constants.h"
+#include "../sample_formats.hpp"
+
+/**
+ * A watchdog that notices when the output has gone dead.
+ *
+ * Output is dead while every channel stays within a narrow band: this
+ * catches silence, and also output stuck at a constant value, which sounds
+ * the same on air but isn't near zero.  Once a dead run lasts longer than
+ * the threshold, the watchdog raises one alarm, and stays quiet until the
+ * output comes back to life.
+ *
+ * The play callback feeds the watchdog, which never blocks or allocates;
+ * other threads only read atomic counters, so can poll it at any time.
+ */
+class DeadAirWatchdog {
+public:
+	/**
+	 * Constructs a DeadAirWatchdog with no threshold.
+	 * @param fmt       The format of the samples to watch.
+	 * @param channels  The number of channels in each sample.
+	 */
+	DeadAirWatchdog(SampleFormat fmt, std::uint8_t channels);
+
+	/**
+	 * Sets how long output must be dead for before an alarm is raised.
+	 * This may be called from any thread.
+	 * @param samples  The threshold, in samples, or zero for no alarms.
+	 */
+	void SetThreshold(std::uint64_t samples);
+
+	/**
+	 * Watches a block of samples as they are sent to the output.
+	 * This must only be called from the play callback.
+	 * @param samples  The packed samples.
+	 * @param count    The number of samples.
+	 */
+	void Feed(const char *samples, unsigned long count);
+
+	/**
+	 * The number of alarms raised so far.
+	 * This may be called from any thread.
+	 * @return The alarm count.
+	 */
+	std::uint64_t Alarms() const;
+
+	/**
+	 * The length of the current dead run, as of the last Feed.
+	 * This may be called from any thread.
+	 * @return The run length, in samples, or zero if the output is live.
+	 */
+	std::uint64_t DeadSamples() const;
+
+private:
+	SampleFormat format;   ///< The format of the samples watched.
+	std::uint8_t channels; ///< The number of channels per sample.
+	std::uint8_t watched;  ///< The number of channels watched.
+
+	/// The widest swing, normalised to full scale, of dead output.
+	float band;
+
+	/// The lowest and highest value, normalised to full scale, of each
+	/// channel during the current dead run.  Callback-only.
+	float low[METER_MAX_CHANNELS];
+	float high[METER_MAX_CHANNELS]; ///< See low.
+
+	std::uint64_t run; ///< The dead run so far, in samples; callback-only.
+	bool alarmed;      ///< Whether the run has raised one; callback-only.
+
+	std::atomic<std::uint64_t> threshold;    ///< Zero if alarms are off.
+	std::atomic<std::uint64_t> alarms;       ///< Alarms raised so far.
+	std::atomic<std::uint64_t> dead_samples; ///< Published copy of run.
+
+	/**
+	 * Forgets the current dead run.
+	 */
+	void ResetRun();
+};
+
+#endif // PS_AUDIO_WATCHDOG_HPP
@@ -0,0 +1,209 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the MappedAvioReader class.
+ * @see audio/avio_mapped.hpp
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef WIN32
+#error "MappedAvioReader needs POSIX mmap; don't build it on Windows"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+extern "C" {
+#ifdef WIN32
+#define inline __inline
+#endif
+#include <libavformat/avio.h>
+#include <libavutil/avutil.h>
+#ifdef WIN32
+#undef inline
+#endif
+}
+
+#include "../constants.h"
+#include "../errors.hpp"
+
+#include "avio_mapped.hpp"
+
+MappedAvioReader *MappedAvioReader::Open(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 < st.st_size &&
+	    IsLocal(fd)) {
+		data = mmap(nullptr, static_cast<std::size_t>(st.st_size),
+		            PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	if (data == MAP_FAILED) {
+		Debug("not mapping", path);
+		close(fd);
+		return nullptr;
+	}
+
+	auto size = static_cast<std::size_t>(st.st_size);
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	return new MappedAvioReader(
+	                fd, static_cast<const std::uint8_t *>(data), size);
+}
+
+MappedAvioReader::~MappedAvioReader()
+{
+	munmap(const_cast<std::uint8_t *>(this->data), this->mapped_size);
+	close(this->fd);
+}
+
+bool MappedAvioReader::IsLocal(int fd)
+{
+#ifdef __linux__
+	struct statfs fs;
+	if (fstatfs(fd, &fs) != 0) {
+		return false;
+	}
+
+	// Filesystems whose files can change under us without our kernel
+	// knowing straight away.
+	switch (static_cast<unsigned long>(fs.f_type)) {
+	case 0x6969UL:     // NFS
+	case 0x517BUL:     // SMB
+	case 0xFF534D42UL: // CIFS
+	case 0xFE534D42UL: // SMB2
+	case 0x65735546UL: // FUSE (sshfs, and the like)
+	case 0x00C36400UL: // Ceph
+	case 0x01021997UL: // 9P
+	case 0x5346414FUL: // AFS
+		return false;
+	default:
+		return true;
+	}
+#else
+	// Without a way to tell, be safe.
+	(void)fd;
+	return false;
+#endif
+}
+
+bool MappedAvioReader::CheckSize()
+{
+	struct stat st;
+	if (fstat(this->fd, &st) != 0) {
+		return false;
+	}
+
+	auto now = static_cast<std::size_t>(st.st_size);
+	if (now < this->size) {
+		Debug("mapped file shrank from", this->size, "to", now);
+		this->size = now;
+	}
+	return true;
+}
+
+void MappedAvioReader::AdviseAhead(std::size_t want)
+{
+	// Re-advise once the read gets within half a window of the end of the
+	// last advice, so the kernel stays ahead of the decoder.
+	if (this->position + want + MMAP_ADVISE_WINDOW / 2 <=
+	    this->advised_end) {
+		return;
+	}
+
+	static const std::size_t page = sysconf(_SC_PAGESIZE);
+	std::size_t start = this->position - (this->position % page);
+	std::size_t end = std::min(this->size,
+	                           this->position + MMAP_ADVISE_WINDOW);
+	if (start < end) {
+		madvise(const_cast<std::uint8_t *>(this->data) + start,
+		        end - start, MADV_WILLNEED);
+	}
+	this->advised_end = end;
+}
+
+MappedAvioReader::MappedAvioReader(int fd, const std::uint8_t *data,
+                                   std::size_t size)
+        : fd(fd),
+          data(data),
+          mapped_size(size),
+          size(size),
+          position(0),
+          advised_end(0)
+{
+}
+
+int MappedAvioReader::Read(std::uint8_t *buf, int size)
+{
+	// Copying from past the end of a truncated file would raise SIGBUS,
+	// so read only what is still there.  A truncation racing the copy
+	// itself can still fault, but only on a local file, whose writer
+	// is on this machine.
+	if (!CheckSize()) {
+		return AVERROR(EIO);
+	}
+	if (this->size <= this->position) {
+		return AVERROR_EOF;
+	}
+
+	std::size_t count = std::min(static_cast<std::size_t>(size),
+	                             this->size - this->position);
+
+	AdviseAhead(count);
+
+	std::memcpy(buf, this->data + this->position, count);
+	this->position += count;
+	return static_cast<int>(count);
+}
+
+std::int64_t MappedAvioReader::Seek(std::int64_t offset, int whence)
+{
+	auto size = static_cast<std::int64_t>(this->size);
+	std::int64_t base;
+
+	switch (whence) {
+	case AVSEEK_SIZE:
+		return size;
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = static_cast<std::int64_t>(this->position);
+		break;
+	case SEEK_END:
+		base = size;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	std::int64_t target = base + offset;
+	if (target < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	// Seeking past the end is allowed; reads there just hit EOF.
+	this->position = static_cast<std::size_t>(target);
+	this->advised_end = this->position;
+	return target;
+}
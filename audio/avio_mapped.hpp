@@ -0,0 +1,92 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the MappedAvioReader class.
+ * @see audio/avio_mapped.cpp
+ */
+
+#ifndef PS_AVIO_MAPPED_HPP
+#define PS_AVIO_MAPPED_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "avio_reader.hpp"
+
+/**
+ * An AvioReader that reads a local file through a memory mapping.
+ *
+ * Reads are copies out of the mapping rather than read syscalls, and seeks
+ * just move an offset, so probing and seeking in large files cost nearly
+ * nothing.  The kernel is told the file is read sequentially, and is asked
+ * to fault in a window of pages ahead of the read position.
+ *
+ * Touching a page past the end of a file that has shrunk raises SIGBUS, so
+ * only files on local filesystems are mapped, and each read checks the
+ * file's size first.  A network filesystem can shrink a file without its
+ * client noticing in time, so files there are left to ffmpeg.
+ */
+class MappedAvioReader : public AvioReader {
+public:
+	/**
+	 * Maps a file.
+	 * @param path The path to the file.
+	 * @return A new MappedAvioReader, owned by the caller, or nullptr if
+	 *   the path isn't a regular file on a local filesystem that can be
+	 *   mapped.
+	 */
+	static MappedAvioReader *Open(const std::string &path);
+
+	/**
+	 * Destructs a MappedAvioReader, unmapping and closing its file.
+	 */
+	~MappedAvioReader();
+
+protected:
+	int Read(std::uint8_t *buf, int size) override;
+	std::int64_t Seek(std::int64_t offset, int whence) override;
+
+private:
+	int fd;                   ///< The file, for checking its size.
+	const std::uint8_t *data; ///< The start of the mapping.
+	std::size_t mapped_size;  ///< The size of the mapping, in bytes.
+	std::size_t size;         ///< The readable size of the file, in bytes.
+	std::size_t position;     ///< The current read position, in bytes.
+	std::size_t advised_end;  ///< The end of the last WILLNEED advice.
+
+	/**
+	 * Constructs a MappedAvioReader for an existing mapping.
+	 * @param fd The mapped file, which the reader takes ownership of.
+	 * @param data The start of the mapping.
+	 * @param size The size of the mapping, in bytes.
+	 */
+	MappedAvioReader(int fd, const std::uint8_t *data, std::size_t size);
+
+	/**
+	 * Checks whether a file is on a local filesystem, where it is safe to
+	 * map.
+	 * @param fd The file.
+	 * @return False if the file is on a network or FUSE filesystem;
+	 *   true otherwise.
+	 */
+	static bool IsLocal(int fd);
+
+	/**
+	 * Shrinks the readable size to the file's current size, if the file
+	 * has been truncated since it was mapped.
+	 * @return False if the file's size can't be checked; true otherwise.
+	 */
+	bool CheckSize();
+
+	/**
+	 * Asks the kernel to fault in the pages ahead of the read position,
+	 * if the last request's window is nearly used up.
+	 * @param want The number of bytes about to be read.
+	 */
+	void AdviseAhead(std::size_t want);
+};
+
+#endif // PS_AVIO_MAPPED_HPP
@@ -0,0 +1,607 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the ReadAheadAvioReader class.
+ * @see audio/avio_readahead.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef WIN32
+#error "ReadAheadAvioReader needs POSIX pread; don't build it on Windows"
+#endif
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
+
+extern "C" {
+#ifdef WIN32
+#define inline __inline
+#endif
+#include <libavformat/avio.h>
+#include <libavutil/avutil.h>
+#ifdef WIN32
+#undef inline
+#endif
+}
+
+#include "../constants.h"
+#include "../errors.hpp"
+#include "../latency_histogram.hpp"
+
+#include "avio_readahead.hpp"
+
+using Block = ReadAheadAvioReader::Block;
+using Clock = std::chrono::steady_clock;
+
+LatencyHistogram &ReadAheadAvioReader::ReadLatency()
+{
+	static LatencyHistogram histogram;
+	return histogram;
+}
+
+LatencyHistogram &ReadAheadAvioReader::StallLatency()
+{
+	static LatencyHistogram histogram;
+	return histogram;
+}
+
+/**
+ * Records the time since a block was requested as its read latency.
+ * @param block The block that has just arrived.
+ */
+static void RecordArrival(const Block &block)
+{
+	ReadAheadAvioReader::ReadLatency().Record(
+	                std::chrono::duration_cast<LatencyHistogram::Unit>(
+	                                Clock::now() - block.requested));
+}
+
+/**
+ * A way of reading blocks.
+ * Its methods are only called from the thread reading the file.
+ */
+class ReadAheadAvioReader::Backend {
+public:
+	/**
+	 * Destructs the Backend.
+	 * Subclasses must wait for any reads in flight before returning.
+	 */
+	virtual ~Backend() {};
+
+	/**
+	 * Starts reading a block.
+	 * On entry, the block's index is set and it is not pending.
+	 * @param block The block.
+	 */
+	virtual void Submit(Block &block) = 0;
+
+	/**
+	 * Checks whether a block's read is still in flight.
+	 * @param block The block.
+	 * @return True if the read is still in flight; false otherwise.
+	 */
+	virtual bool IsPending(Block &block) = 0;
+
+	/**
+	 * Waits for up to READAHEAD_POLL_PERIOD for a block's read to finish.
+	 * @param block The block.
+	 * @return True if the read is still in flight; false otherwise.
+	 */
+	virtual bool WaitFor(Block &block) = 0;
+};
+
+/**
+ * Reads a whole block with pread, retrying short and interrupted reads.
+ * @param fd The file descriptor.
+ * @param block The block.
+ * @return The number of bytes read (short only at the end of the file), or
+ *   -errno on failure.
+ */
+static int ReadBlock(int fd, Block &block)
+{
+	std::uint8_t *data = block.data.get();
+	off_t offset = static_cast<off_t>(block.index * READAHEAD_BLOCK_SIZE);
+	std::size_t done = 0;
+
+	while (done < READAHEAD_BLOCK_SIZE) {
+		ssize_t n = pread(fd, data + done, READAHEAD_BLOCK_SIZE - done,
+		                  offset + static_cast<off_t>(done));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -errno;
+		}
+		if (n == 0) {
+			break;
+		}
+		done += static_cast<std::size_t>(n);
+	}
+
+	return static_cast<int>(done);
+}
+
+/**
+ * A pool of threads shared by every PoolBackend.
+ */
+class IoThreadPool {
+public:
+	/**
+	 * Starts the pool's threads.
+	 */
+	IoThreadPool() : stopping(false)
+	{
+		for (std::size_t i = 0; i < READAHEAD_THREADS; i++) {
+			this->threads.emplace_back(&IoThreadPool::Work, this);
+		}
+	}
+
+	/**
+	 * Stops the pool's threads, once they have finished their jobs.
+	 */
+	~IoThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+
+		for (auto &t : this->threads) {
+			t.join();
+		}
+	}
+
+	/**
+	 * Queues a job.
+	 * @param job The job.
+	 */
+	void Push(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->jobs.push_back(std::move(job));
+		}
+		this->wake.notify_one();
+	}
+
+	/**
+	 * Gets the pool shared by all PoolBackends, starting it if need be.
+	 * @return The shared pool.
+	 */
+	static IoThreadPool &Shared()
+	{
+		static IoThreadPool pool;
+		return pool;
+	}
+
+private:
+	std::mutex mutex;                       ///< Protects the below.
+	std::condition_variable wake;           ///< Signals new jobs.
+	std::deque<std::function<void()>> jobs; ///< Jobs not yet started.
+	bool stopping;                          ///< Set to stop the threads.
+	std::vector<std::thread> threads;       ///< The threads.
+
+	/**
+	 * The body of each thread.
+	 */
+	void Work()
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+
+		while (true) {
+			this->wake.wait(lock, [this] {
+				return this->stopping || !this->jobs.empty();
+			});
+			if (this->jobs.empty()) {
+				return;
+			}
+
+			auto job = std::move(this->jobs.front());
+			this->jobs.pop_front();
+
+			lock.unlock();
+			job();
+			lock.lock();
+		}
+	}
+};
+
+/**
+ * A Backend that reads blocks with pread on the shared IoThreadPool.
+ */
+class PoolBackend : public ReadAheadAvioReader::Backend {
+public:
+	/**
+	 * Constructs a PoolBackend.
+	 * @param fd The file descriptor to read from.
+	 */
+	PoolBackend(int fd) : fd(fd), outstanding(0)
+	{
+	}
+
+	~PoolBackend()
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->done.wait(lock,
+		                [this] { return this->outstanding == 0; });
+	}
+
+	void Submit(Block &block) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			block.pending = true;
+			this->outstanding++;
+		}
+
+		IoThreadPool::Shared().Push([this, &block] {
+			int result = ReadBlock(this->fd, block);
+			RecordArrival(block);
+
+			std::lock_guard<std::mutex> lock(this->mutex);
+			block.result = result;
+			block.pending = false;
+			this->outstanding--;
+			this->done.notify_all();
+		});
+	}
+
+	bool IsPending(Block &block) override
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return block.pending;
+	}
+
+	bool WaitFor(Block &block) override
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->done.wait_for(lock, READAHEAD_POLL_PERIOD,
+		                    [&block] { return !block.pending; });
+		return block.pending;
+	}
+
+private:
+	int fd;                        ///< The file descriptor.
+	std::mutex mutex;              ///< Protects the blocks' states.
+	std::condition_variable done;  ///< Signals finished reads.
+	std::size_t outstanding;       ///< The number of reads in flight.
+};
+
+#ifdef USE_IO_URING
+
+/**
+ * A Backend that reads blocks with io_uring.
+ * Completions are only reaped on the reading thread, so no locking is
+ * needed.
+ */
+class UringBackend : public ReadAheadAvioReader::Backend {
+public:
+	/**
+	 * Sets up an io_uring instance.
+	 * @param fd The file descriptor to read from.
+	 * @param depth The maximum number of reads in flight.
+	 * @return A new UringBackend, owned by the caller, or nullptr if the
+	 *   kernel won't give us an io_uring.
+	 */
+	static UringBackend *Open(int fd, unsigned int depth)
+	{
+		auto backend = new UringBackend(fd);
+		if (io_uring_queue_init(depth, &backend->ring, 0) < 0) {
+			delete backend;
+			return nullptr;
+		}
+		backend->initialised = true;
+		return backend;
+	}
+
+	~UringBackend()
+	{
+		if (!this->initialised) {
+			return;
+		}
+
+		while (0 < this->outstanding) {
+			Reap(true);
+		}
+		io_uring_queue_exit(&this->ring);
+	}
+
+	void Submit(Block &block) override
+	{
+		io_uring_sqe *sqe = io_uring_get_sqe(&this->ring);
+		while (sqe == nullptr) {
+			// The queue is full of finished reads; make room.
+			Reap(true);
+			sqe = io_uring_get_sqe(&this->ring);
+		}
+
+		io_uring_prep_read(sqe, this->fd, block.data.get(),
+		                   READAHEAD_BLOCK_SIZE,
+		                   block.index * READAHEAD_BLOCK_SIZE);
+		io_uring_sqe_set_data(sqe, &block);
+		block.pending = true;
+		this->outstanding++;
+
+		io_uring_submit(&this->ring);
+	}
+
+	bool IsPending(Block &block) override
+	{
+		while (block.pending && Reap(false)) {
+		}
+		return block.pending;
+	}
+
+	bool WaitFor(Block &block) override
+	{
+		if (block.pending) {
+			Reap(true);
+		}
+		return IsPending(block);
+	}
+
+private:
+	int fd;              ///< The file descriptor.
+	io_uring ring;       ///< The io_uring instance.
+	bool initialised;    ///< Whether ring needs tearing down.
+	std::size_t outstanding; ///< The number of reads in flight.
+
+	/**
+	 * Constructs an uninitialised UringBackend.
+	 * @param fd The file descriptor to read from.
+	 */
+	UringBackend(int fd) : fd(fd), initialised(false), outstanding(0)
+	{
+	}
+
+	/**
+	 * Handles one completed read.
+	 * @param wait Whether to wait, for up to READAHEAD_POLL_PERIOD, if no
+	 *   read has completed yet.
+	 * @return True if a read was handled; false otherwise.
+	 */
+	bool Reap(bool wait)
+	{
+		io_uring_cqe *cqe = nullptr;
+		int err;
+
+		if (wait) {
+			auto ns = std::chrono::duration_cast<
+			                std::chrono::nanoseconds>(
+			                READAHEAD_POLL_PERIOD).count();
+			__kernel_timespec ts;
+			ts.tv_sec = ns / 1000000000;
+			ts.tv_nsec = ns % 1000000000;
+			err = io_uring_wait_cqe_timeout(&this->ring, &cqe, &ts);
+		} else {
+			err = io_uring_peek_cqe(&this->ring, &cqe);
+		}
+		if (err < 0 || cqe == nullptr) {
+			return false;
+		}
+
+		auto block = static_cast<Block *>(io_uring_cqe_get_data(cqe));
+		block->result = cqe->res;
+		block->pending = false;
+		this->outstanding--;
+		io_uring_cqe_seen(&this->ring, cqe);
+
+		RecordArrival(*block);
+		return true;
+	}
+};
+
+#endif // USE_IO_URING
+
+ReadAheadAvioReader *ReadAheadAvioReader::Open(const std::string &path,
+                                               std::size_t blocks,
+                                               const std::atomic<bool> *cancel)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return nullptr;
+	}
+
+	// We do our own read-ahead, so the kernel needn't.
+	posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+	return new ReadAheadAvioReader(
+	                fd, static_cast<std::uint64_t>(st.st_size),
+	                std::max(blocks, std::size_t(1)), cancel);
+}
+
+ReadAheadAvioReader::ReadAheadAvioReader(int fd, std::uint64_t size,
+                                         std::size_t blocks,
+                                         const std::atomic<bool> *cancel)
+        : fd(fd), size(size), position(0), blocks(blocks), cancel(cancel)
+{
+	for (auto &b : this->blocks) {
+		b.index = 0;
+		b.issued = false;
+		b.pending = false;
+		b.result = 0;
+		b.data = decltype(b.data)(
+		                new std::uint8_t[READAHEAD_BLOCK_SIZE]);
+	}
+
+#ifdef USE_IO_URING
+	this->backend = decltype(this->backend)(UringBackend::Open(
+	                fd, static_cast<unsigned int>(blocks)));
+#endif
+	if (this->backend == nullptr) {
+		this->backend = decltype(this->backend)(new PoolBackend(fd));
+	}
+}
+
+ReadAheadAvioReader::~ReadAheadAvioReader()
+{
+	// The backend waits for reads into our blocks, so must go first.
+	this->backend = nullptr;
+	close(this->fd);
+}
+
+void ReadAheadAvioReader::Fill(std::uint64_t first)
+{
+	std::uint64_t count = (this->size + READAHEAD_BLOCK_SIZE - 1) /
+	                      READAHEAD_BLOCK_SIZE;
+	std::uint64_t last = std::min(count, first + this->blocks.size());
+
+	for (std::uint64_t i = first; i < last; i++) {
+		Block &b = this->blocks[i % this->blocks.size()];
+
+		// A slot still reading an old block (say, from before a
+		// seek) is left until that read finishes.
+		bool current = b.issued && b.index == i;
+		if (current || (b.issued && this->backend->IsPending(b))) {
+			continue;
+		}
+
+		b.index = i;
+		b.issued = true;
+		b.requested = Clock::now();
+		this->backend->Submit(b);
+	}
+}
+
+bool ReadAheadAvioReader::Wait(Block &block)
+{
+	if (!this->backend->IsPending(block)) {
+		return true;
+	}
+
+	auto start = Clock::now();
+	while (this->backend->WaitFor(block)) {
+		if (this->cancel != nullptr &&
+		    this->cancel->load(std::memory_order_relaxed)) {
+			return false;
+		}
+	}
+
+	StallLatency().Record(std::chrono::duration_cast<
+	                LatencyHistogram::Unit>(Clock::now() - start));
+	return true;
+}
+
+Block *ReadAheadAvioReader::Fetch(std::uint64_t index)
+{
+	Block &b = this->blocks[index % this->blocks.size()];
+
+	// If the slot is busy with another block, let that finish first.
+	while (!(b.issued && b.index == index)) {
+		if (!Wait(b)) {
+			return nullptr;
+		}
+		b.issued = false;
+		Fill(index);
+	}
+
+	if (!Wait(b)) {
+		return nullptr;
+	}
+	return &b;
+}
+
+int ReadAheadAvioReader::Read(std::uint8_t *buf, int size)
+{
+	if (this->size <= this->position) {
+		return AVERROR_EOF;
+	}
+
+	std::uint64_t index = this->position / READAHEAD_BLOCK_SIZE;
+	std::uint64_t offset = this->position % READAHEAD_BLOCK_SIZE;
+	Fill(index);
+
+	for (unsigned int tries = 0;; tries++) {
+		Block *b = Fetch(index);
+		if (b == nullptr) {
+			return AVERROR_EXIT;
+		}
+
+		if (b->result < 0) {
+			// Let the next read try again.
+			int error = b->result;
+			b->issued = false;
+			return AVERROR(-error);
+		}
+
+		auto available = static_cast<std::uint64_t>(b->result);
+		if (offset < available) {
+			auto count = std::min(static_cast<std::uint64_t>(size),
+			                      available - offset);
+			std::copy_n(b->data.get() + offset, count, buf);
+			this->position += count;
+			return static_cast<int>(count);
+		}
+
+		// A short read ending at or before our offset: either the rest
+		// of the block needs reading again, or the file has shrunk
+		// under us.  Reread a few times, then take the file to end
+		// where the block does.
+		auto end = index * READAHEAD_BLOCK_SIZE + available;
+		if (this->size <= end ||
+		    READAHEAD_SHORT_READ_TRIES <= tries + 1) {
+			this->size = std::min(this->size, end);
+			return AVERROR_EOF;
+		}
+		b->issued = false;
+		Fill(index);
+	}
+}
+
+std::int64_t ReadAheadAvioReader::Seek(std::int64_t offset, int whence)
+{
+	auto size = static_cast<std::int64_t>(this->size);
+	std::int64_t base;
+
+	switch (whence) {
+	case AVSEEK_SIZE:
+		return size;
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = static_cast<std::int64_t>(this->position);
+		break;
+	case SEEK_END:
+		base = size;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	std::int64_t target = base + offset;
+	if (target < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	// The window follows the position on the next read.
+	this->position = static_cast<std::uint64_t>(target);
+	return target;
+}
@@ -0,0 +1,131 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the ReadAheadAvioReader class.
+ * @see audio/avio_readahead.cpp
+ */
+
+#ifndef PS_AVIO_READAHEAD_HPP
+#define PS_AVIO_READAHEAD_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../latency_histogram.hpp"
+
+#include "avio_reader.hpp"
+
+/**
+ * An AvioReader that keeps a window of reads in flight ahead of the decoder.
+ *
+ * The file is read in blocks of READAHEAD_BLOCK_SIZE bytes.  Whenever the
+ * decoder reads, every block in the window starting at its position that
+ * isn't already loaded or loading is requested, so slow storage is usually
+ * read long before the decoder gets there.  Reads are done with io_uring
+ * when built with USE_IO_URING and the kernel allows it, or otherwise by a
+ * small shared pool of threads calling pread.
+ *
+ * The time each block takes to arrive, and the time the decoder spends
+ * waiting for blocks that haven't arrived, are recorded in process-wide
+ * histograms.
+ */
+class ReadAheadAvioReader : public AvioReader {
+public:
+	/**
+	 * Opens a file for reading ahead.
+	 * @param path The path to the file.
+	 * @param blocks The number of blocks to keep in flight.
+	 * @param cancel If not nullptr, a flag which, when set, makes any
+	 *   wait for a block give up.
+	 * @return A new ReadAheadAvioReader, owned by the caller, or nullptr if
+	 *   the path isn't a regular file that can be opened.
+	 */
+	static ReadAheadAvioReader *Open(const std::string &path,
+	                                 std::size_t blocks,
+	                                 const std::atomic<bool> *cancel);
+
+	/**
+	 * Destructs a ReadAheadAvioReader, waiting for its reads to finish.
+	 */
+	~ReadAheadAvioReader();
+
+	/**
+	 * The histogram of times taken to read each block.
+	 * @return The histogram, shared by all ReadAheadAvioReaders.
+	 */
+	static LatencyHistogram &ReadLatency();
+
+	/**
+	 * The histogram of times the decoder waited for a block.
+	 * Only waits are recorded; reads served from the window are not.
+	 * @return The histogram, shared by all ReadAheadAvioReaders.
+	 */
+	static LatencyHistogram &StallLatency();
+
+	/// One block of the file, and the state of its read.
+	struct Block {
+		std::uint64_t index; ///< The block's index in the file.
+		bool issued;         ///< Whether index has been requested.
+		bool pending;        ///< Whether the read is in flight.
+		int result;          ///< Bytes read, or -errno on failure.
+		std::unique_ptr<std::uint8_t[]> data; ///< The block's bytes.
+
+		/// When the read was requested.
+		std::chrono::steady_clock::time_point requested;
+	};
+
+	/// Interface for the ways of reading blocks.
+	class Backend;
+
+protected:
+	int Read(std::uint8_t *buf, int size) override;
+	std::int64_t Seek(std::int64_t offset, int whence) override;
+
+private:
+	int fd;                     ///< The file descriptor.
+	std::uint64_t size;         ///< The size of the file, in bytes.
+	std::uint64_t position;     ///< The current read position, in bytes.
+	std::vector<Block> blocks;  ///< The window, indexed modulo its size.
+	std::unique_ptr<Backend> backend; ///< Reads the blocks.
+	const std::atomic<bool> *cancel;  ///< The cancel flag, if any.
+
+	/**
+	 * Constructs a ReadAheadAvioReader on an open file.
+	 * @param fd The file descriptor, which the reader takes ownership of.
+	 * @param size The size of the file, in bytes.
+	 * @param blocks The number of blocks to keep in flight.
+	 * @param cancel The cancel flag, or nullptr.
+	 */
+	ReadAheadAvioReader(int fd, std::uint64_t size, std::size_t blocks,
+	                    const std::atomic<bool> *cancel);
+
+	/**
+	 * Requests every block in the window starting at a given block that
+	 * isn't already requested.
+	 * @param first The index of the first block in the window.
+	 */
+	void Fill(std::uint64_t first);
+
+	/**
+	 * Gets a block, waiting for it to arrive if need be.
+	 * @param index The index of the block.
+	 * @return The block, or nullptr if the wait was cancelled.
+	 */
+	Block *Fetch(std::uint64_t index);
+
+	/**
+	 * Waits for a block's read to finish, recording the wait.
+	 * @param block The block.
+	 * @return False if the wait was cancelled; true otherwise.
+	 */
+	bool Wait(Block &block);
+};
+
+#endif // PS_AVIO_READAHEAD_HPP
@@ -0,0 +1,113 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the AvioReader class.
+ * @see audio/avio_reader.hpp
+ */
+
+#include <cstdint>
+#include <new>
+#include <string>
+
+extern "C" {
+#ifdef WIN32
+#define inline __inline
+#endif
+#include <libavformat/avio.h>
+#include <libavutil/mem.h>
+#ifdef WIN32
+#undef inline
+#endif
+}
+
+#include "../constants.h"
+
+#include "audio_decoder.hpp"
+#include "avio_mapped.hpp"
+#include "avio_readahead.hpp"
+#include "avio_reader.hpp"
+
+AvioReader::AvioReader()
+{
+}
+
+AvioReader::~AvioReader()
+{
+}
+
+AVIOContext *AvioReader::Context()
+{
+	if (this->context != nullptr) {
+		return this->context.get();
+	}
+
+	auto buffer = static_cast<unsigned char *>(
+	                av_malloc(CUSTOM_IO_BUFFER_SIZE));
+	if (buffer == nullptr) {
+		throw std::bad_alloc();
+	}
+
+	AVIOContext *ctx = avio_alloc_context(
+	                buffer, static_cast<int>(CUSTOM_IO_BUFFER_SIZE), 0,
+	                this, &AvioReader::ReadPacket, nullptr,
+	                &AvioReader::SeekPacket);
+	if (ctx == nullptr) {
+		av_free(buffer);
+		throw std::bad_alloc();
+	}
+
+	// By the time this runs, ffmpeg may have replaced the buffer with one
+	// of its own, so free whatever the context holds.
+	auto free_context = [](AVIOContext *ctx) {
+		av_freep(&ctx->buffer);
+		av_freep(&ctx);
+	};
+	this->context = decltype(this->context)(ctx, free_context);
+	return ctx;
+}
+
+#ifdef WIN32
+
+AvioReader *AvioReader::ForPath(const std::string &, const DecoderOptions &,
+                                const std::atomic<bool> *)
+{
+	// Our readers are POSIX-only, so ffmpeg opens every path itself.
+	return nullptr;
+}
+
+#else
+
+AvioReader *AvioReader::ForPath(const std::string &path,
+                                const DecoderOptions &options,
+                                const std::atomic<bool> *cancel)
+{
+	// Leave URLs (and anything else with a protocol) to ffmpeg.
+	if (path.find("://") != std::string::npos) {
+		return nullptr;
+	}
+
+	// Mapping is cheapest, but a page fault on slow storage stalls the
+	// decoder; reading ahead hides that.  Files on network filesystems
+	// aren't mapped, and fall through to ffmpeg's own reads.
+	if (0 < options.readahead_blocks) {
+		return ReadAheadAvioReader::Open(path, options.readahead_blocks,
+		                                 cancel);
+	}
+	return MappedAvioReader::Open(path);
+}
+
+#endif // WIN32
+
+int AvioReader::ReadPacket(void *opaque, std::uint8_t *buf, int size)
+{
+	return static_cast<AvioReader *>(opaque)->Read(buf, size);
+}
+
+std::int64_t AvioReader::SeekPacket(void *opaque, std::int64_t offset,
+                                    int whence)
+{
+	return static_cast<AvioReader *>(opaque)->Seek(offset,
+	                                               whence & ~AVSEEK_FORCE);
+}
@@ -0,0 +1,98 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the AvioReader class.
+ * @see audio/avio_reader.cpp
+ */
+
+#ifndef PS_AVIO_READER_HPP
+#define PS_AVIO_READER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+struct DecoderOptions;
+
+/**
+ * A source of file bytes for ffmpeg, replacing its own 'file' protocol.
+ *
+ * Subclasses implement Read and Seek; AvioReader wraps them in an
+ * AVIOContext that can be handed to an AVFormatContext as its custom I/O.
+ * The AvioReader must outlive the AVFormatContext using it.
+ */
+class AvioReader {
+public:
+	/**
+	 * Destructs an AvioReader, freeing its AVIOContext.
+	 */
+	virtual ~AvioReader();
+
+	AvioReader(const AvioReader &) = delete;
+	AvioReader &operator=(const AvioReader &) = delete;
+
+	/**
+	 * Gets the AVIOContext reading from this AvioReader.
+	 * @return The AVIOContext, which remains owned by the AvioReader.
+	 */
+	AVIOContext *Context();
+
+	/**
+	 * Makes the best AvioReader available for a path.
+	 * @param path The path to the file.
+	 * @param options The decoder options, which choose the reader.
+	 * @param cancel If not nullptr, a flag which, when set, makes any
+	 *   blocking waits in the reader give up.
+	 * @return A new AvioReader, owned by the caller, or nullptr if ffmpeg
+	 *   should open the path itself (if it is a URL, say, a file on a
+	 *   network filesystem that can't safely be mapped, or on Windows,
+	 *   where none of our readers are built).
+	 */
+	static AvioReader *ForPath(const std::string &path,
+	                           const DecoderOptions &options,
+	                           const std::atomic<bool> *cancel);
+
+protected:
+	/**
+	 * Constructs an AvioReader.
+	 */
+	AvioReader();
+
+	/**
+	 * Reads bytes from the current position.
+	 * @param buf The buffer to read into.
+	 * @param size The maximum number of bytes to read.
+	 * @return The number of bytes read, AVERROR_EOF at the end of the
+	 *   file, or another negative AVERROR code on failure.
+	 */
+	virtual int Read(std::uint8_t *buf, int size) = 0;
+
+	/**
+	 * Moves the current position, as per fseek.
+	 * @param offset The offset to seek by.
+	 * @param whence SEEK_SET, SEEK_CUR, SEEK_END, or AVSEEK_SIZE to query
+	 *   the file size without seeking; AVSEEK_FORCE is already masked off.
+	 * @return The new position (or the size, for AVSEEK_SIZE), or a
+	 *   negative AVERROR code on failure.
+	 */
+	virtual std::int64_t Seek(std::int64_t offset, int whence) = 0;
+
+private:
+	/// The AVIOContext wrapping this reader, created on first use.
+	std::unique_ptr<AVIOContext, std::function<void(AVIOContext *)>>
+	                context;
+
+	static int ReadPacket(void *opaque, std::uint8_t *buf, int size);
+	static std::int64_t SeekPacket(void *opaque, std::int64_t offset,
+	                               int whence);
+};
+
+#endif // PS_AVIO_READER_HPP
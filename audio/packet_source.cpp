@@ -0,0 +1,524 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the PacketSource class and its implementations.
+ * @see audio/packet_source.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+
+extern "C" {
+#ifdef WIN32
+#define inline __inline
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#ifdef WIN32
+#undef inline
+#endif
+}
+
+#include "../errors.hpp"
+#include "../stage_timer.hpp"
+
+#include "packet_source.hpp"
+
+/**
+ * Reads the next packet from a demuxer, timing it as the demux stage.
+ * @param context The demuxer.
+ * @param packet The packet to fill.
+ * @return As av_read_frame.
+ */
+static int ReadFrame(AVFormatContext *context, AVPacket *packet)
+{
+	StageTimer timer(Stage::DEMUX);
+	int result = av_read_frame(context, packet);
+	if (0 <= result) {
+		timer.AddBytes(static_cast<std::uint64_t>(packet->size));
+	}
+	return result;
+}
+
+//
+// DemuxSource
+//
+
+DemuxSource::DemuxSource(AVFormatContext *context, int stream_id)
+        : context(context), stream_id(stream_id)
+{
+}
+
+bool DemuxSource::Next(AVPacket *packet)
+{
+	while (ReadFrame(this->context, packet) >= 0) {
+		if (packet->stream_index == this->stream_id) {
+			return true;
+		}
+		av_packet_unref(packet);
+	}
+	return false;
+}
+
+bool DemuxSource::Seek(std::int64_t timestamp)
+{
+	return av_seek_frame(this->context, this->stream_id, timestamp,
+	                     AVSEEK_FLAG_ANY) == 0;
+}
+
+//
+// PacketStore
+//
+
+/**
+ * Frees a stored packet.
+ * @param packet The packet.
+ */
+static void FreePacket(AVPacket *packet)
+{
+	av_packet_free(&packet);
+}
+
+PacketStore::PacketStore(AVFormatContext *context, int stream_id)
+        : context(context),
+          stream_id(stream_id),
+          cursor(0),
+          bytes(0),
+          complete(false),
+          overflowed(false),
+          stopping(false)
+{
+	av_init_packet(&this->overflow);
+	this->overflow.data = nullptr;
+	this->overflow.size = 0;
+
+	this->filler = std::thread(&PacketStore::Fill, this);
+}
+
+PacketStore::~PacketStore()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->filler.join();
+	av_packet_unref(&this->overflow);
+}
+
+void PacketStore::Fill()
+{
+	AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = nullptr;
+	packet.size = 0;
+
+	bool more = true;
+	while (more && ReadFrame(this->context, &packet) >= 0) {
+		bool stored = packet.stream_index != this->stream_id ||
+		              Store(&packet);
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!stored) {
+			// Out of memory: hand the rest of the stream, starting
+			// with this packet, to the demuxer.
+			Warn("packet store full; reading the rest from file");
+			av_packet_move_ref(&this->overflow, &packet);
+			this->overflowed = true;
+		}
+		av_packet_unref(&packet);
+		more = stored && !this->stopping;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->complete = true;
+		auto count = this->packets.size();
+		Debug("stored", count, "packets,", this->bytes, "bytes");
+	}
+	this->grown.notify_all();
+}
+
+bool PacketStore::Store(AVPacket *packet)
+{
+	// Take our own reference, which stays valid after the demuxer moves
+	// on (copying the data if the demuxer didn't reference-count it).
+	PacketPtr stored(av_packet_alloc(), FreePacket);
+	if (stored == nullptr || av_packet_ref(stored.get(), packet) < 0) {
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+
+		// Make room first, so the pushes below can't fail halfway.
+		try
+		{
+			this->packets.reserve(this->packets.size() + 1);
+			this->timestamps.reserve(this->timestamps.size() + 1);
+		}
+		catch (std::bad_alloc &)
+		{
+			return false;
+		}
+
+		// Seeking needs a timestamp on every packet, so fill in any
+		// gaps from the previous packet.
+		std::int64_t ts = packet->pts;
+		if (ts == AV_NOPTS_VALUE) {
+			ts = packet->dts;
+		}
+		if (ts == AV_NOPTS_VALUE && this->timestamps.empty()) {
+			ts = 0;
+		} else if (ts == AV_NOPTS_VALUE) {
+			ts = this->timestamps.back() +
+			     this->packets.back()->duration;
+		}
+
+		this->bytes += static_cast<std::size_t>(packet->size);
+		this->timestamps.push_back(ts);
+		this->packets.push_back(std::move(stored));
+	}
+	this->grown.notify_all();
+	return true;
+}
+
+bool PacketStore::Next(AVPacket *packet)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->grown.wait(lock, [this] {
+		return this->complete || this->cursor < this->packets.size();
+	});
+
+	if (this->cursor < this->packets.size()) {
+		if (av_packet_ref(packet, this->packets[this->cursor].get()) <
+		    0) {
+			throw std::bad_alloc();
+		}
+		this->cursor++;
+		return true;
+	}
+
+	if (!this->overflowed) {
+		return false;
+	}
+	if (this->overflow.data != nullptr) {
+		av_packet_move_ref(packet, &this->overflow);
+		return true;
+	}
+
+	// The filler has finished with the demuxer, so it is ours.
+	lock.unlock();
+	return DemuxSource(this->context, this->stream_id).Next(packet);
+}
+
+bool PacketStore::Seek(std::int64_t timestamp)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+
+	// Wait until the packet holding the timestamp is stored.
+	this->grown.wait(lock, [this, timestamp] {
+		return this->complete || (!this->timestamps.empty() &&
+		                          timestamp < this->timestamps.back());
+	});
+
+	// With only part of the stream in memory, the demuxer couldn't carry
+	// on from the end of it after a seek, so drop it, freeing its memory,
+	// and read from the demuxer from now on.
+	if (this->overflowed) {
+		this->packets.clear();
+		this->timestamps.clear();
+		this->cursor = 0;
+		this->bytes = 0;
+		av_packet_unref(&this->overflow);
+
+		lock.unlock();
+		return DemuxSource(this->context, this->stream_id)
+		                .Seek(timestamp);
+	}
+
+	// Start from the last packet starting at or before the timestamp.
+	auto &ts = this->timestamps;
+	auto after = std::upper_bound(ts.begin(), ts.end(), timestamp);
+	this->cursor = (after == ts.begin()) ? 0 : (after - ts.begin()) - 1;
+	return true;
+}
+
+std::size_t PacketStore::Bytes()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->bytes;
+}
+
+//
+// QueueDepth
+//
+
+QueueDepth::QueueDepth() : count(0), total(0), max(0)
+{
+}
+
+void QueueDepth::Record(std::size_t depth)
+{
+	this->count.fetch_add(1, std::memory_order_relaxed);
+	this->total.fetch_add(depth, std::memory_order_relaxed);
+
+	std::size_t old = this->max.load(std::memory_order_relaxed);
+	while (old < depth &&
+	       !this->max.compare_exchange_weak(old, depth,
+	                                        std::memory_order_relaxed)) {
+	}
+}
+
+std::uint64_t QueueDepth::Count() const
+{
+	return this->count.load(std::memory_order_relaxed);
+}
+
+double QueueDepth::Mean() const
+{
+	auto n = Count();
+	if (n == 0) {
+		return 0.0;
+	}
+	return static_cast<double>(this->total.load(std::memory_order_relaxed)) /
+	       static_cast<double>(n);
+}
+
+std::size_t QueueDepth::Max() const
+{
+	return this->max.load(std::memory_order_relaxed);
+}
+
+//
+// DemuxStage
+//
+
+/// The clock used to time waits.
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Records the time since a wait started.
+ * @param histogram The histogram to record to.
+ * @param start When the wait started.
+ */
+static void RecordWait(LatencyHistogram &histogram, Clock::time_point start)
+{
+	histogram.Record(std::chrono::duration_cast<LatencyHistogram::Unit>(
+	                Clock::now() - start));
+}
+
+DemuxStage::DemuxStage(AVFormatContext *context, int stream_id,
+                       std::size_t capacity)
+        : context(context),
+          stream_id(stream_id),
+          queue(capacity),
+          epoch(0),
+          seeking(false),
+          seek_target(0),
+          seek_ok(true),
+          seeks_done(0),
+          ended(false),
+          stopping(false),
+          decoder_waiting(false),
+          demuxer_waiting(false)
+{
+	this->demuxer = std::thread(&DemuxStage::Demux, this);
+}
+
+DemuxStage::~DemuxStage()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->changed.notify_all();
+	this->demuxer.join();
+
+	Entry entry;
+	while (this->queue.TryPop(entry)) {
+		Free(entry);
+	}
+}
+
+QueueDepth &DemuxStage::DemuxDepth()
+{
+	static QueueDepth depth;
+	return depth;
+}
+
+QueueDepth &DemuxStage::DecodeDepth()
+{
+	static QueueDepth depth;
+	return depth;
+}
+
+LatencyHistogram &DemuxStage::DemuxWait()
+{
+	static LatencyHistogram histogram;
+	return histogram;
+}
+
+LatencyHistogram &DemuxStage::DecodeWait()
+{
+	static LatencyHistogram histogram;
+	return histogram;
+}
+
+bool DemuxStage::Next(AVPacket *packet)
+{
+	Entry entry;
+	while (Pop(entry)) {
+		// Packets demuxed before the last seek are no longer wanted.
+		bool current = entry.epoch == this->epoch;
+		if (current) {
+			av_packet_move_ref(packet, entry.packet);
+		}
+		Free(entry);
+
+		if (current) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool DemuxStage::Seek(std::int64_t timestamp)
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->seeking = true;
+	this->seek_target = timestamp;
+	this->changed.notify_all();
+
+	auto wanted = ++this->epoch;
+	this->changed.wait(lock,
+	                   [this, wanted] { return this->seeks_done == wanted; });
+	return this->seek_ok;
+}
+
+void DemuxStage::Demux()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (!this->stopping) {
+		if (this->seeking) {
+			DoSeek();
+			continue;
+		}
+		if (this->ended) {
+			this->changed.wait(lock, [this] {
+				return this->seeking || this->stopping;
+			});
+			continue;
+		}
+
+		// Read and queue without the lock, so that the decoder can
+		// ask for a seek or stop meanwhile.
+		Entry entry = {av_packet_alloc(), this->seeks_done};
+		lock.unlock();
+
+		bool read = entry.packet != nullptr &&
+		            ReadFrame(this->context, entry.packet) >= 0;
+		bool wanted = read &&
+		              entry.packet->stream_index == this->stream_id;
+		if (!(wanted && Push(entry))) {
+			Free(entry);
+		}
+
+		lock.lock();
+		if (!read) {
+			this->ended = true;
+			this->changed.notify_all();
+		}
+	}
+}
+
+bool DemuxStage::Push(Entry &entry)
+{
+	if (!this->queue.TryPush(entry)) {
+		auto start = Clock::now();
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->demuxer_waiting.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		while (!this->queue.TryPush(entry)) {
+			if (this->seeking || this->stopping) {
+				this->demuxer_waiting.store(false);
+				return false;
+			}
+			this->changed.wait(lock);
+		}
+
+		this->demuxer_waiting.store(false);
+		RecordWait(DemuxWait(), start);
+	}
+
+	DemuxDepth().Record(this->queue.Size());
+	Wake(this->decoder_waiting);
+	return true;
+}
+
+bool DemuxStage::Pop(Entry &entry)
+{
+	DecodeDepth().Record(this->queue.Size());
+
+	if (!this->queue.TryPop(entry)) {
+		auto start = Clock::now();
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->decoder_waiting.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		// The demuxer queues its last packet before setting ended,
+		// so check ended first: if it's set, an empty queue stays so.
+		bool end = this->ended;
+		while (!this->queue.TryPop(entry)) {
+			if (end) {
+				this->decoder_waiting.store(false);
+				return false;
+			}
+			this->changed.wait(lock);
+			end = this->ended;
+		}
+
+		this->decoder_waiting.store(false);
+		RecordWait(DecodeWait(), start);
+	}
+
+	Wake(this->demuxer_waiting);
+	return true;
+}
+
+void DemuxStage::DoSeek()
+{
+	// The decoder is blocked until the seek is done, so holding the lock
+	// through it costs nothing.
+	this->seek_ok = av_seek_frame(this->context, this->stream_id,
+	                              this->seek_target, AVSEEK_FLAG_ANY) == 0;
+	this->seeking = false;
+	this->ended = false;
+	this->seeks_done++;
+	this->changed.notify_all();
+}
+
+void DemuxStage::Wake(const std::atomic<bool> &waiting)
+{
+	// Pairs with the fence after setting the waiting flag: either the
+	// waiter sees our change to the queue, or we see its flag.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiting.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->changed.notify_all();
+	}
+}
+
+void DemuxStage::Free(Entry &entry)
+{
+	av_packet_free(&entry.packet);
+}
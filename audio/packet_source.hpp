@@ -0,0 +1,332 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the PacketSource class and its implementations.
+ * @see audio/packet_source.cpp
+ */
+
+#ifndef PS_PACKET_SOURCE_HPP
+#define PS_PACKET_SOURCE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "../latency_histogram.hpp"
+#include "../ringbuffer/spsc_queue.hpp"
+
+/**
+ * A source of compressed packets from one stream of a file.
+ *
+ * This separates the AudioDecoder from where its packets come from, which
+ * may be the demuxer directly, or a store of already-demuxed packets.
+ */
+class PacketSource {
+public:
+	/**
+	 * Virtual destructor for PacketSource.
+	 */
+	virtual ~PacketSource() {};
+
+	/**
+	 * Gets the next packet.
+	 * @param packet The packet to fill.  It must be blank on entry, and
+	 *   the caller must unreference it when done with it.
+	 * @return False if there are no more packets; true otherwise.
+	 */
+	virtual bool Next(AVPacket *packet) = 0;
+
+	/**
+	 * Moves to the packet holding a given timestamp.
+	 * Timestamps are assumed to increase through the stream.
+	 * @param timestamp The timestamp, in the stream's time base.
+	 * @return False if the seek failed; true otherwise.
+	 */
+	virtual bool Seek(std::int64_t timestamp) = 0;
+};
+
+/**
+ * A PacketSource that reads packets straight from the demuxer.
+ */
+class DemuxSource : public PacketSource {
+public:
+	/**
+	 * Constructs a DemuxSource.
+	 * @param context The demuxer, which must outlive the DemuxSource.
+	 * @param stream_id The index of the stream whose packets are wanted.
+	 */
+	DemuxSource(AVFormatContext *context, int stream_id);
+
+	bool Next(AVPacket *packet) override;
+	bool Seek(std::int64_t timestamp) override;
+
+private:
+	AVFormatContext *context; ///< The demuxer.
+	int stream_id;            ///< The stream whose packets are wanted.
+};
+
+/**
+ * A PacketSource that keeps every packet of a stream in memory.
+ *
+ * A background thread demuxes the whole stream into the store as fast as
+ * it can, from the moment the store is created.  Reads and seeks within
+ * what has been stored are served from memory, and only wait if they get
+ * ahead of the thread.  Compressed packets are much smaller than the PCM
+ * they decode to, so this keeps whole songs in memory cheaply, and makes
+ * the storage they came from irrelevant once they are loaded.
+ *
+ * If memory runs out, the thread stops, and the rest of the stream is read
+ * from the demuxer once the stored packets are used up.  A seek after that
+ * drops the store, and goes to the demuxer too.
+ */
+class PacketStore : public PacketSource {
+public:
+	/**
+	 * Constructs a PacketStore, and starts filling it.
+	 * @param context The demuxer, which must outlive the PacketStore, and
+	 *   must not be used by anything else while it exists.
+	 * @param stream_id The index of the stream whose packets are wanted.
+	 */
+	PacketStore(AVFormatContext *context, int stream_id);
+
+	/**
+	 * Stops filling the PacketStore, and frees its packets.
+	 */
+	~PacketStore();
+
+	PacketStore(const PacketStore &) = delete;
+	PacketStore &operator=(const PacketStore &) = delete;
+
+	bool Next(AVPacket *packet) override;
+	bool Seek(std::int64_t timestamp) override;
+
+	/**
+	 * The number of bytes of packet data stored so far.
+	 * @return The byte count.
+	 */
+	std::size_t Bytes();
+
+private:
+	/// Type of owning pointers to stored packets.
+	using PacketPtr = std::unique_ptr<AVPacket, void (*)(AVPacket *)>;
+
+	AVFormatContext *context; ///< The demuxer.
+	int stream_id;            ///< The stream whose packets are wanted.
+
+	std::mutex mutex;              ///< Protects everything below.
+	std::condition_variable grown; ///< Signals new packets, or the end.
+
+	std::vector<PacketPtr> packets;       ///< The stored packets.
+	std::vector<std::int64_t> timestamps; ///< Each packet's timestamp.
+	std::size_t cursor;  ///< The index of the next packet to read.
+	std::size_t bytes;   ///< The number of bytes of packet data stored.
+	bool complete;       ///< Whether the filling thread has finished.
+	bool overflowed;     ///< Whether it finished for want of memory.
+	AVPacket overflow;   ///< The packet it couldn't store, until read.
+	bool stopping;       ///< Set to stop filling early.
+
+	std::thread filler; ///< The thread filling the store.
+
+	/**
+	 * The body of the filling thread.
+	 */
+	void Fill();
+
+	/**
+	 * Stores a packet.
+	 * @param packet The packet, to which the store takes a reference.
+	 * @return False if there was no memory to store it; true otherwise.
+	 */
+	bool Store(AVPacket *packet);
+};
+
+/**
+ * Statistics of how full a queue is each time it is looked at.
+ *
+ * Recording is lock-free, so any thread may record and read at once.
+ */
+class QueueDepth {
+public:
+	/**
+	 * Constructs an empty QueueDepth.
+	 */
+	QueueDepth();
+
+	/**
+	 * Records one observed depth.
+	 * @param depth The number of items queued.
+	 */
+	void Record(std::size_t depth);
+
+	/**
+	 * The number of depths recorded.
+	 * @return The count.
+	 */
+	std::uint64_t Count() const;
+
+	/**
+	 * The mean of the depths recorded.
+	 * @return The mean, or zero if nothing has been recorded.
+	 */
+	double Mean() const;
+
+	/**
+	 * The largest depth recorded.
+	 * @return The maximum, or zero if nothing has been recorded.
+	 */
+	std::size_t Max() const;
+
+private:
+	std::atomic<std::uint64_t> count; ///< The number of depths recorded.
+	std::atomic<std::uint64_t> total; ///< The sum of the depths recorded.
+	std::atomic<std::size_t> max;     ///< The largest depth recorded.
+};
+
+/**
+ * A PacketSource that demuxes on its own thread, ahead of the decoder.
+ *
+ * The demux thread reads packets into a bounded lock-free queue, which the
+ * decoder empties through Next, so a slow read doesn't hold up decoding of
+ * packets already read, and slow decoding doesn't hold up reading.  Either
+ * side only waits when the queue is empty or full, and both record the
+ * queue depth they see and how long they wait: a decoder that often finds
+ * the queue empty is waiting for I/O, and a demuxer that often finds it full
+ * is waiting for the CPU.
+ *
+ * Seeks are handed to the demux thread, which owns the demuxer; packets
+ * demuxed before a seek are dropped by the decoder.
+ */
+class DemuxStage : public PacketSource {
+public:
+	/**
+	 * Constructs a DemuxStage, and starts demuxing.
+	 * @param context The demuxer, which must outlive the DemuxStage, and
+	 *   must not be used by anything else while it exists.
+	 * @param stream_id The index of the stream whose packets are wanted.
+	 * @param capacity The number of packets to queue, which must be a
+	 *   power of two.
+	 */
+	DemuxStage(AVFormatContext *context, int stream_id,
+	           std::size_t capacity);
+
+	/**
+	 * Stops demuxing, and frees any queued packets.
+	 */
+	~DemuxStage();
+
+	DemuxStage(const DemuxStage &) = delete;
+	DemuxStage &operator=(const DemuxStage &) = delete;
+
+	bool Next(AVPacket *packet) override;
+	bool Seek(std::int64_t timestamp) override;
+
+	/**
+	 * The queue depths seen by the demux threads after queueing a packet.
+	 * @return The statistics, shared by all DemuxStages.
+	 */
+	static QueueDepth &DemuxDepth();
+
+	/**
+	 * The queue depths seen by decoders before taking a packet.
+	 * @return The statistics, shared by all DemuxStages.
+	 */
+	static QueueDepth &DecodeDepth();
+
+	/**
+	 * The times demux threads waited for room in a full queue.
+	 * @return The histogram, shared by all DemuxStages.
+	 */
+	static LatencyHistogram &DemuxWait();
+
+	/**
+	 * The times decoders waited for a packet from an empty queue.
+	 * @return The histogram, shared by all DemuxStages.
+	 */
+	static LatencyHistogram &DecodeWait();
+
+private:
+	/// A queued packet, and the seek it was demuxed after.
+	struct Entry {
+		AVPacket *packet;    ///< The packet, owned by the entry.
+		std::uint64_t epoch; ///< The number of seeks before it.
+	};
+
+	AVFormatContext *context; ///< The demuxer.
+	int stream_id;            ///< The stream whose packets are wanted.
+
+	SpscQueue<Entry> queue; ///< The packets demuxed but not yet taken.
+
+	/// The number of seeks the decoder has asked for; decoder-only.
+	std::uint64_t epoch;
+
+	std::mutex mutex;                ///< Protects everything below.
+	std::condition_variable changed; ///< Signals any change below.
+
+	bool seeking;             ///< Whether a seek is waiting to be done.
+	std::int64_t seek_target; ///< The timestamp to seek to.
+	bool seek_ok;             ///< Whether the last seek succeeded.
+	std::uint64_t seeks_done; ///< The number of seeks done.
+	bool ended;               ///< Whether the demuxer reached the end.
+	bool stopping;            ///< Set to stop the demux thread.
+
+	// These are only set while holding mutex, but are read without it, so
+	// that neither side locks anything unless the other may be waiting.
+	std::atomic<bool> decoder_waiting; ///< Whether Next may be waiting.
+	std::atomic<bool> demuxer_waiting; ///< Whether Push may be waiting.
+
+	std::thread demuxer; ///< The thread demuxing into the queue.
+
+	/**
+	 * The body of the demux thread.
+	 */
+	void Demux();
+
+	/**
+	 * Queues a packet, waiting for room if needed.
+	 * Only the demux thread may call this, without holding mutex.
+	 * @param entry The entry to queue.
+	 * @return False if a seek or stop interrupted the wait, in which case
+	 *   the entry is not queued; true otherwise.
+	 */
+	bool Push(Entry &entry);
+
+	/**
+	 * Takes the next queued packet, waiting for one if needed.
+	 * Only the decoder may call this, without holding mutex.
+	 * @param entry The entry to move the packet into.
+	 * @return False if the demuxer has reached the end and the queue is
+	 *   empty; true otherwise.
+	 */
+	bool Pop(Entry &entry);
+
+	/**
+	 * Does a requested seek.
+	 * Only the demux thread may call this, holding mutex.
+	 */
+	void DoSeek();
+
+	/**
+	 * Wakes the other side of the queue, if it may be waiting.
+	 * @param waiting The other side's waiting flag.
+	 */
+	void Wake(const std::atomic<bool> &waiting);
+
+	/**
+	 * Frees a queue entry's packet.
+	 * @param entry The entry.
+	 */
+	static void Free(Entry &entry);
+};
+
+#endif // PS_PACKET_SOURCE_HPP
@@ -7,83 +7,318 @@
  * @see cmd.hpp
  */
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <string>
 
-#include <boost/tokenizer.hpp>
-
 #include "cmd.hpp"
 #include "errors.hpp"
 #include "io.hpp"
 #include "messages.h"
 
-/**
- * Constructs a CommandHandler.
- * @param commands The map of commands to their handlers to use for this
- *   CommandHandler: this map will be copied.
- */
-CommandHandler::CommandHandler(const CommandHandler::CommandSet &commands)
+/// The escape character used in command lines.
+static const char ESCAPE = '\\';
+
+/// The separator character used in command lines.
+static const char SEPARATOR = ' ';
+
+/// The quote character used in command lines.
+static const char QUOTE = '\"';
+
+/// The character separating commands sent on the same line.
+static const char COMMAND_SEPARATOR = ';';
+
+/// The character starting a command tag.
+static const char TAG_PREFIX = '@';
+
+CommandHandler::CommandHandler()
+        : commands(), current(nullptr), reply(nullptr), deferred(false)
+{
+	this->input.reserve(RESPONSE_BUFFER_SIZE);
+	this->line.reserve(RESPONSE_BUFFER_SIZE);
+}
+
+std::uint32_t CommandHandler::PackWord(Word word)
+{
+	if (word.empty() || 4 < word.size()) {
+		return 0;
+	}
+
+	std::uint32_t key = 0;
+	for (char c : word) {
+		key = (key << 8) | static_cast<unsigned char>(c);
+	}
+	return key;
+}
+
+CommandHandler::Command &CommandHandler::Find(std::uint32_t key)
+{
+	static_assert((COMMAND_TABLE_SIZE & (COMMAND_TABLE_SIZE - 1)) == 0,
+	              "COMMAND_TABLE_SIZE must be a power of two");
+
+	// Fibonacci hashing: the top bits of the product are well mixed.
+	std::uint32_t i = (key * 2654435761u) >> 24;
+	for (std::uint32_t n = 0; n < COMMAND_TABLE_SIZE; n++, i++) {
+		Command &c = this->commands[i % COMMAND_TABLE_SIZE];
+		if (c.key == key || c.key == 0) {
+			return c;
+		}
+	}
+
+	throw InternalError(MSG_CMD_TABLE_FULL);
+}
+
+CommandHandler::Command &CommandHandler::Entry(const std::string &word)
 {
-	this->commands = std::unique_ptr<CommandSet>(new CommandSet(commands));
+	std::uint32_t key = PackWord(word);
+	assert(key != 0);
+
+	Command &c = Find(key);
+	c.key = key;
+	return c;
+}
+
+CommandHandler *CommandHandler::Add(const std::string &word, NullAction f)
+{
+	Entry(word).nullary = f;
+	return this;
 }
 
 CommandHandler *CommandHandler::Add(const std::string &word,
-                                    std::function<bool()> f)
+                                    SingleRequiredWordAction f)
 {
-	this->commands->emplace(word, [f](const WordList &) { return f(); });
+	Entry(word).unary = f;
 	return this;
 }
 
 CommandHandler *CommandHandler::Add(const std::string &word,
-                                    std::function<bool(const std::string &)> f)
+                                    DoubleRequiredWordAction f)
 {
-	this->commands->emplace(word, [f](const WordList &words) {
-		bool valid = false;
-		if (words.size() == 2 && !words[1].empty()) {
-			valid = f(words[1]);
-		}
-		return valid;
-	});
+	Entry(word).binary = f;
 	return this;
 }
 
+const CommandHandler::Command *CommandHandler::Lookup(
+                const CommandHandler::WordList &words)
+{
+	if (words.empty()) {
+		return nullptr;
+	}
+
+	std::uint32_t key = PackWord(words[0]);
+	if (key == 0) {
+		return nullptr;
+	}
+
+	const Command &c = Find(key);
+	if (c.key == 0) {
+		return nullptr;
+	}
+
+	bool valid = false;
+	if (words.size() == 1) {
+		valid = c.nullary != nullptr;
+	} else if (words.size() == 2) {
+		valid = !words[1].empty() && c.unary != nullptr;
+	} else if (words.size() == 3) {
+		valid = !words[1].empty() && !words[2].empty() &&
+		        c.binary != nullptr;
+	}
+	return valid ? &c : nullptr;
+}
+
+bool CommandHandler::Run(const Command &command,
+                         const CommandHandler::WordList &words)
+{
+	if (words.size() == 1) {
+		return command.nullary();
+	}
+
+	this->argument.assign(words[1].data(), words[1].size());
+	if (words.size() == 2) {
+		return command.unary(this->argument);
+	}
+
+	this->argument2.assign(words[2].data(), words[2].size());
+	return command.binary(this->argument, this->argument2);
+}
+
 /**
- * Runs a command.
- * @param words The words that form the command: the first word is taken to be
- *   the command name.
- * @return true if the command was valid; false otherwise.
+ * Finds the end of one command in a command line.
+ * Semicolons inside quotes, or escaped, do not end the command.
+ * @param start The start of the command.
+ * @param end The end of the command line.
+ * @param last Set to one past the last character of the command that is not
+ *   an unescaped, unquoted space.
+ * @return The position of the semicolon ending the command, or @a end.
  */
-bool CommandHandler::Run(const CommandHandler::WordList &words)
+static const char *CommandEnd(const char *start, const char *end,
+                              const char *&last)
 {
-	bool valid = false;
+	bool in_quote = false;
+	last = start;
 
-	if (!words.empty()) {
-		auto commandIter = this->commands->find(words[0]);
-		if (commandIter != this->commands->end()) {
-			valid = commandIter->second(words);
+	for (const char *r = start; r != end; r++) {
+		if (*r == ESCAPE) {
+			// Malformed escapes are caught when splitting into words.
+			if (r + 1 != end) {
+				r++;
+			}
+		} else if (*r == COMMAND_SEPARATOR && !in_quote) {
+			return r;
+		} else if (*r == SEPARATOR && !in_quote) {
+			continue;
+		} else if (*r == QUOTE) {
+			in_quote = !in_quote;
 		}
+		last = r + 1;
 	}
-
-	return valid;
+	return end;
 }
 
 /**
- * Parses a string as a command line and runs the result.
- * @param line The string that represents the command line.
- * @return true if the command was valid; false otherwise.
+ * Skips the first word, and any spaces after it, in a raw command.
+ * @param command The raw text of the command.
+ * @return The text of the command after its first word.
  */
-bool CommandHandler::RunLine(const std::string &line)
+static boost::string_ref SkipWord(boost::string_ref command)
+{
+	bool in_quote = false;
+	size_t i = 0;
+
+	for (; i < command.size(); i++) {
+		if (command[i] == ESCAPE) {
+			i++;
+		} else if (command[i] == SEPARATOR && !in_quote) {
+			break;
+		} else if (command[i] == QUOTE) {
+			in_quote = !in_quote;
+		}
+	}
+	while (i < command.size() && command[i] == SEPARATOR) {
+		i++;
+	}
+
+	return command.substr(std::min(i, command.size()));
+}
+
+size_t CommandHandler::Parse(boost::string_ref line)
+{
+	this->line.assign(line.data(), line.size());
+
+	char *base = &this->line[0];
+	const char *end = base + this->line.size();
+	size_t count = 0;
+
+	for (const char *r = base; r != end;) {
+		while (r != end && *r == SEPARATOR) {
+			r++;
+		}
+
+		const char *last;
+		const char *next = CommandEnd(r, end, last);
+
+		// Empty commands (as in "stop;;" or "stop;") are ignored.
+		if (r != last) {
+			if (count == this->steps.size()) {
+				return 0;
+			}
+
+			WordList words;
+			char *first = base + (r - base);
+			if (!SpanToWords(first, last, words)) {
+				return 0;
+			}
+
+			Step &step = this->steps[count++];
+			step.text = line.substr(r - base, last - r);
+			step.tag = Word();
+			step.words = WordList();
+			step.command = nullptr;
+
+			size_t i = 0;
+			if (!words.empty() && words[0].starts_with(TAG_PREFIX)) {
+				step.tag = words[0];
+				step.text = SkipWord(step.text);
+				i++;
+			}
+			for (; i < words.size(); i++) {
+				step.words.push_back(words[i]);
+			}
+		}
+
+		r = (next == end) ? end : next + 1;
+	}
+
+	return count;
+}
+
+void CommandHandler::Reply(Response code, const Step &step,
+                           boost::string_ref message)
+{
+	if (step.tag.empty()) {
+		this->reply->Respond(code, message);
+	} else {
+		this->reply->Respond(code, step.tag, message);
+	}
+}
+
+CommandHandler::Completion CommandHandler::Defer()
+{
+	assert(this->current != nullptr);
+	this->deferred = true;
+
+	return Completion(this->reply->WeakReference(),
+	                  this->current->tag.to_string(),
+	                  this->current->text.to_string());
+}
+
+std::weak_ptr<ResponseSink> CommandHandler::Requester() const
+{
+	assert(this->current != nullptr);
+	return this->reply->WeakReference();
+}
+
+CommandHandler::Completion::Completion(std::weak_ptr<ResponseSink> reply,
+                                       const std::string &tag,
+                                       const std::string &command)
+        : reply(reply), tag(tag), command(command)
+{
+}
+
+void CommandHandler::Completion::Succeed() const
 {
-	return Run(LineToWords(line));
+	std::shared_ptr<ResponseSink> sink = this->reply.lock();
+	if (sink == nullptr) {
+		return;
+	}
+
+	if (this->tag.empty()) {
+		sink->Respond(Response::OKAY, this->command);
+	} else {
+		sink->Respond(Response::OKAY, this->tag, this->command);
+	}
+}
+
+void CommandHandler::Completion::Fail(const std::string &message) const
+{
+	std::shared_ptr<ResponseSink> sink = this->reply.lock();
+	if (sink == nullptr) {
+		return;
+	}
+
+	if (this->tag.empty()) {
+		sink->Respond(Response::FAIL, message);
+	} else {
+		sink->Respond(Response::FAIL, this->tag, message);
+	}
 }
 
 /*
  * Checks to see if there is a command waiting on stdin and, if there is,
  * sends it to the command handler.
- *
- * 'usr' is a pointer to any user data that should be passed to executed
- * commands; 'cmds' is a pointer to an END_CMDS-terminated array of command
- * definitions (see cmd.h for details).
  */
 void CommandHandler::Check()
 {
@@ -91,16 +326,12 @@ void CommandHandler::Check()
 		Handle();
 	}
 }
-/* Processes the command currently waiting on the given stream.
- * If the command is set to be handled by PROPAGATE, it will be sent through
- * prop; it is an error if prop is NULL and PROPAGATE is reached.
- */
+
+/* Processes the command currently waiting on stdin. */
 void CommandHandler::Handle()
 {
-	std::string input;
-
-	std::getline(std::cin, input);
-	Debug("got command: ", input);
+	std::getline(std::cin, this->input);
+	Debug("got command: ", this->input);
 
 	/* Silently fail if the command is actually end of file */
 	if (std::cin.eof()) {
@@ -108,29 +339,101 @@ void CommandHandler::Handle()
 		throw Error("TODO: Handle this better");
 	}
 
-	bool valid = RunLine(input);
-	if (valid) {
-		Respond(Response::OKAY, input);
-	} else {
-		Respond(Response::WHAT, MSG_CMD_INVALID);
+	HandleLine(this->input, BroadcastSink());
+}
+
+void CommandHandler::HandleLine(boost::string_ref line, ResponseSink &reply)
+{
+	this->reply = &reply;
+
+	size_t count = Parse(line);
+	if (count == 0) {
+		reply.Respond(Response::WHAT, MSG_CMD_INVALID);
+		return;
+	}
+
+	// Check the whole line before running any of it, so that a typo in
+	// the last command can't leave the first half-done.
+	bool valid = true;
+	for (size_t i = 0; i < count; i++) {
+		Step &step = this->steps[i];
+		step.command = Lookup(step.words);
+		valid = valid && step.command != nullptr;
+	}
+
+	bool failed = !valid;
+	for (size_t i = 0; i < count; i++) {
+		const Step &step = this->steps[i];
+
+		if (failed) {
+			bool bad = step.command == nullptr;
+			Reply(Response::WHAT, step,
+			      bad ? MSG_CMD_INVALID : MSG_CMD_SKIPPED);
+			continue;
+		}
+
+		this->current = &step;
+		this->deferred = false;
+		bool ok = Run(*step.command, step.words);
+		this->current = nullptr;
+
+		if (this->deferred && ok) {
+			// The action will reply, through its Completion.
+			continue;
+		}
+
+		if (ok) {
+			Reply(Response::OKAY, step, step.text);
+		} else {
+			Reply(Response::WHAT, step, MSG_CMD_INVALID);
+			failed = true;
+		}
 	}
 }
 
-/**
- * Parses a command line into a list of words.
- * @param line The line to split into words.
- * @return The list of words in the command line.
- */
-CommandHandler::WordList CommandHandler::LineToWords(const std::string &line)
+bool CommandHandler::LineToWords(std::string &line, WordList &words)
 {
-	WordList words;
+	// As with boost::escaped_list_separator, an empty line has no words,
+	// but every separator starts a new (possibly empty) word.
+	if (line.empty()) {
+		return true;
+	}
 
-	using Separator = boost::escaped_list_separator<char>;
-	using Tokeniser = boost::tokenizer<Separator>;
-	Separator separator('\\', ' ', '\"');
-	Tokeniser tok(line, separator);
+	char *start = &line[0];
+	return SpanToWords(start, start + line.size(), words);
+}
 
-	words.assign(tok.begin(), tok.end());
+bool CommandHandler::SpanToWords(char *start, const char *end,
+                                 WordList &words)
+{
+	const char *r = start;
+	char *w = start;
+	char *word = w;
+	bool in_quote = false;
+
+	for (; r != end; r++) {
+		if (*r == ESCAPE) {
+			if (++r == end) {
+				return false;
+			}
+			if (*r == 'n') {
+				*w++ = '\n';
+			} else if (*r == QUOTE || *r == SEPARATOR || *r == ESCAPE) {
+				*w++ = *r;
+			} else {
+				return false;
+			}
+		} else if (*r == SEPARATOR && !in_quote) {
+			if (!words.push_back(Word(word, w - word))) {
+				return false;
+			}
+			word = w;
+		} else if (*r == QUOTE) {
+			in_quote = !in_quote;
+		} else {
+			*w++ = *r;
+		}
+	}
 
-	return words;
+	return words.push_back(Word(word, w - word));
 }
@@ -10,10 +10,17 @@
 #ifndef PS_CMD_HPP
 #define PS_CMD_HPP
 
-#include <memory>
+#include <array>
+#include <cassert>
+#include <cstdint>
 #include <functional>
-#include <map>
-#include <vector>
+#include <memory>
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "constants.h"
+#include "io.hpp"
 
 #ifdef IGNORE
 #undef IGNORE
@@ -21,17 +28,116 @@
 
 /**
  * The Playslave++ command handler.
+ *
+ * Command lines are split into words in place, without allocating, using
+ * the same quoting and escaping rules as boost::escaped_list_separator: words
+ * are separated by spaces, double quotes group words, and backslash escapes
+ * a backslash, quote, space or 'n' (newline).
+ *
+ * Command words are at most four characters long, and are packed into a
+ * 32-bit integer, which is looked up in a small open-addressed table.
+ *
+ * A command may be preceded by a tag word starting with '@', which is echoed
+ * as the first argument of every reply to that command.  Several commands
+ * may be sent on one line, separated by unquoted semicolons: they are all
+ * checked before any are run, and are then run in order in the same loop
+ * cycle, skipping the rest if one fails.  A command may defer its reply
+ * (see Defer) and complete later, out of order.
  */
 class CommandHandler {
 public:
+	/// The type of one command word: a view into the command line buffer.
+	using Word = boost::string_ref;
+
 	/// The type of lists of command words.
-	using WordList = std::vector<std::string>;
+	class WordList {
+	public:
+		/**
+		 * Constructs an empty WordList.
+		 */
+		WordList() : count(0) {};
 
-	/// The type of functions called on receipt of commands.
-	using Payload = std::function<bool(WordList)>;
+		/**
+		 * The number of words in the list.
+		 * @return The word count.
+		 */
+		size_t size() const
+		{
+			return this->count;
+		}
 
-	/// The type of a set of commands.
-	using CommandSet = std::map<std::string, Payload>;
+		/**
+		 * Whether the list has no words.
+		 * @return True if the list is empty; false otherwise.
+		 */
+		bool empty() const
+		{
+			return this->count == 0;
+		}
+
+		/**
+		 * Gets a word from the list.
+		 * @param i The index of the word, which must be less than
+		 *   size().
+		 * @return The word.
+		 */
+		const Word &operator[](size_t i) const
+		{
+			return this->words[i];
+		}
+
+		/**
+		 * Appends a word to the list.
+		 * @param word The word.
+		 * @return False if the list was full; true otherwise.
+		 */
+		bool push_back(Word word)
+		{
+			if (this->count == this->words.size()) {
+				return false;
+			}
+			this->words[this->count++] = word;
+			return true;
+		}
+
+	private:
+		std::array<Word, COMMAND_MAX_WORDS> words; ///< The words.
+		size_t count; ///< The number of words in use.
+	};
+
+	/**
+	 * A deferred reply to a command that completes after it returns.
+	 *
+	 * The reply goes to whoever sent the command, if they are still
+	 * around, and carries the command's tag, if it had one.
+	 */
+	class Completion {
+	public:
+		/**
+		 * Constructs a Completion.
+		 * @param reply The sink to which the reply will be sent.
+		 * @param tag The command's tag, or an empty string.
+		 * @param command The text of the command.
+		 */
+		Completion(std::weak_ptr<ResponseSink> reply,
+		           const std::string &tag, const std::string &command);
+
+		/**
+		 * Replies that the command succeeded.
+		 */
+		void Succeed() const;
+
+		/**
+		 * Replies that the command failed.
+		 * @param message The human-readable reason for the failure.
+		 */
+		void Fail(const std::string &message) const;
+
+	private:
+		std::weak_ptr<ResponseSink> reply; ///< Where to send the reply.
+		std::string tag;     ///< The command's tag, if any.
+		std::string command; ///< The text of the command.
+	};
 
 	/// The type of a command action that takes no command words.
 	using NullAction = std::function<bool()>;
@@ -40,22 +146,28 @@ public:
 	using SingleRequiredWordAction =
 	                std::function<bool(const std::string &)>;
 
-	/**
-	 * Constructs a CommandHandler with no arguments.
-	 */
-	CommandHandler() : CommandHandler(CommandSet{}) {};
+	/// The type of a command action that takes exactly two command words.
+	using DoubleRequiredWordAction = std::function<bool(
+	                const std::string &, const std::string &)>;
 
 	/**
-	 * Constructs a CommandHandler with an existing command set.
-	 * @param commands The command set, which will be copied.
+	 * Constructs a CommandHandler with no commands.
 	 */
-	CommandHandler(const CommandSet &commands);
+	CommandHandler();
 
 	/**
 	 * Checks for, and handles, commands waiting on this CommandHandler.
 	 */
 	void Check();
 
+	/**
+	 * Handles one command line, sending the replies to a given sink.
+	 * @param line The command line.
+	 * @param reply The sink to which the replies to each command in the
+	 *   line are sent.
+	 */
+	void HandleLine(boost::string_ref line, ResponseSink &reply);
+
 	/**
 	 * Adds a nullary command.
 	 * @param word The command word to associate with @a f.
@@ -63,7 +175,7 @@ public:
 	 *   word @a word is read.
 	 * @return A pointer to this CommandHandler, for method chaining.
 	 */
-	CommandHandler *Add(const std::string &word, std::function<bool()> f);
+	CommandHandler *Add(const std::string &word, NullAction f);
 
 	/**
 	 * Adds a unary command.
@@ -72,16 +184,166 @@ public:
 	 *   word @a word is read.
 	 * @return A pointer to this CommandHandler, for method chaining.
 	 */
-	CommandHandler *Add(const std::string &word,
-	                    std::function<bool(const std::string &)> f);
+	CommandHandler *Add(const std::string &word, SingleRequiredWordAction f);
+
+	/**
+	 * Adds a binary command.
+	 * @param word The command word to associate with @a f.
+	 * @param f The command, taking two arguments, to execute when the
+	 *   command word @a word is read.
+	 * @return A pointer to this CommandHandler, for method chaining.
+	 */
+	CommandHandler *Add(const std::string &word, DoubleRequiredWordAction f);
+
+	/**
+	 * Defers the reply to the command currently being run.
+	 * This must only be called from within a command action.  If the
+	 * action then returns true, the handler will not reply to the command;
+	 * instead, the action must eventually call Succeed or Fail on the
+	 * returned Completion.  If it returns false, the handler replies as
+	 * usual, and the Completion should be dropped.
+	 * @return The Completion for the current command.
+	 */
+	Completion Defer();
+
+	/**
+	 * Gets a weak reference to whoever sent the command currently being
+	 * run.
+	 * This must only be called from within a command action; it is for
+	 * commands that subscribe the sender to later responses.
+	 * @return A weak pointer to the sender's sink.
+	 */
+	std::weak_ptr<ResponseSink> Requester() const;
+
+	/**
+	 * Sends a response to whoever sent the command currently being run,
+	 * with its tag, if any.
+	 * This must only be called from within a command action; it is for
+	 * commands that answer queries with more than an OKAY.
+	 * @tparam Args Parameter pack of arguments.
+	 * @param code The response code.
+	 * @param args The arguments to the response.
+	 */
+	template <typename... Args>
+	void Respond(Response code, const Args &... args)
+	{
+		assert(this->current != nullptr);
+
+		if (this->current->tag.empty()) {
+			this->reply->Respond(code, args...);
+		} else {
+			this->reply->Respond(code, this->current->tag, args...);
+		}
+	}
+
+	/**
+	 * Parses a command line into a list of words, in place.
+	 * Escapes and quotes are removed by shifting characters down the line
+	 * buffer, so the words are views into @a line.
+	 * @param line The line to split into words; this is modified.
+	 * @param words The list to which the words are appended.
+	 * @return False if the line was malformed (a bad escape, or too many
+	 *   words); true otherwise.
+	 */
+	static bool LineToWords(std::string &line, WordList &words);
+
+	/**
+	 * Parses part of a command line into a list of words, in place.
+	 * @param start The start of the part to split into words; this is
+	 *   modified.
+	 * @param end The end of the part to split into words.
+	 * @param words The list to which the words are appended.
+	 * @return False if the line was malformed (a bad escape, or too many
+	 *   words); true otherwise.
+	 * @see LineToWords
+	 */
+	static bool SpanToWords(char *start, const char *end, WordList &words);
 
 private:
-	std::unique_ptr<CommandSet> commands;
+	/// An entry in the command table.
+	struct Command {
+		std::uint32_t key; ///< The packed command word; 0 if unused.
+		NullAction nullary; ///< The action for no arguments, if any.
+		SingleRequiredWordAction unary; ///< The action for one argument.
+		DoubleRequiredWordAction binary; ///< The action for two.
+	};
+
+	/// The command table, open-addressed on the packed command word.
+	std::array<Command, COMMAND_TABLE_SIZE> commands;
+
+	/// One command in a command line.
+	struct Step {
+		Word text;         ///< The command's text in the original line.
+		Word tag;          ///< The command's tag, if any.
+		WordList words;    ///< The command's words, without the tag.
+		const Command *command; ///< The command, or nullptr if invalid.
+	};
+
+	std::string input;    ///< Buffer for lines read from stdin.
+	std::string line;     ///< Buffer in which lines are split into words.
+	std::string argument; ///< Buffer for arguments passed to actions.
+	std::string argument2; ///< Buffer for second arguments.
+
+	/// The commands in the line being handled.
+	std::array<Step, COMMAND_MAX_BATCH> steps;
+
+	const Step *current;  ///< The command being run, if any.
+	ResponseSink *reply;  ///< Where replies for the current line go.
+	bool deferred;        ///< Whether the current command was deferred.
+
+	/**
+	 * Packs a command word of up to four characters into an integer.
+	 * @param word The command word.
+	 * @return The packed word, or 0 if the word is empty or too long.
+	 */
+	static std::uint32_t PackWord(Word word);
+
+	/**
+	 * Finds the table entry for a packed command word.
+	 * @param key The packed command word.
+	 * @return The entry for @a key, or the empty entry where it would go.
+	 */
+	Command &Find(std::uint32_t key);
+
+	/**
+	 * Finds or creates the table entry for a command word.
+	 * @param word The command word.
+	 * @return The entry.
+	 */
+	Command &Entry(const std::string &word);
+
+	/**
+	 * Finds the command to run for a list of words, checking that it
+	 * accepts the number of words given.
+	 * @param words The words, the first of which is the command word.
+	 * @return The command, or nullptr if the words are not a valid
+	 *   command.
+	 */
+	const Command *Lookup(const WordList &words);
 
-	WordList LineToWords(const std::string &line);
+	/**
+	 * Runs a command.
+	 * @param command The command, as found by Lookup.
+	 * @param words The words, the first of which is the command word.
+	 * @return True if the command succeeded; false otherwise.
+	 */
+	bool Run(const Command &command, const WordList &words);
+
+	/**
+	 * Splits a command line into commands, and each command into words.
+	 * @param line The command line.
+	 * @return The number of commands, or 0 if the line is malformed.
+	 */
+	size_t Parse(boost::string_ref line);
+
+	/**
+	 * Sends a reply to the command being handled.
+	 * @param code The response code.
+	 * @param step The command.
+	 * @param message The body of the reply.
+	 */
+	void Reply(Response code, const Step &step, boost::string_ref message);
 
-	bool Run(const WordList &words);
-	bool RunLine(const std::string &line);
 	void Handle();
 };
 
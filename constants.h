@@ -32,12 +32,144 @@ extern "C" {
 /// The period between position announcements from the Player object.
 const std::chrono::microseconds POSITION_PERIOD(500000);
 
+/// The shortest period a client may ask for position announcements at.
+const std::chrono::microseconds TICK_MIN_PERIOD(1000);
+
+/// The period over which gain changes are ramped in.
+const std::chrono::microseconds GAIN_RAMP_PERIOD(10000);
+
+/// The maximum number of channels the level meter will meter.
+#define METER_MAX_CHANNELS 8
+
+/// The fixed-point scale of the level meter's running sums of squares.
+/// At 2^40, a full-scale channel can play for about five minutes between
+/// reports before its sum wraps, and a -120dBFS one still registers.
+const double METER_SUM_SCALE = 1099511627776.0;
+
+/// The level, in dBFS, reported for silence by the level meter.
+const double METER_FLOOR_DB = -120.0;
+
+/// The peak-to-peak swing, in dBFS, within which output counts as dead air.
+const double DEAD_AIR_BAND_DB = -60.0;
+
+/// How long output must be dead air before an alarm is raised, by default.
+const std::chrono::seconds DEAD_AIR_PERIOD(10);
+
+/// The period between re-mapping a scheduled play's wall-clock target onto
+/// the stream clock, to follow any slewing of the wall clock.
+const std::chrono::milliseconds CUE_REMAP_PERIOD(100);
+
+/// The number of clock readings taken when mapping the wall clock onto the
+/// stream clock; the tightest is used.
+const unsigned int CUE_MAP_TRIES = 5;
+
+/// The shortest period between xrun announcements.
+const std::chrono::seconds XRUN_PERIOD(1);
+
+/// The maximum number of stage runs one stage trace captures.
+const size_t STAGE_TRACE_EVENTS = (size_t)(128 * 1024);
+
+/// How long the log drain sleeps when it finds nothing to write.
+const std::chrono::milliseconds LOG_DRAIN_PERIOD(10);
+
 /// The period between main loop cycles.
 const std::chrono::nanoseconds LOOP_PERIOD(1000);
 
+/// The maximum number of words in a command line.
+#define COMMAND_MAX_WORDS 8
+
+/// The maximum number of commands in one command line.
+#define COMMAND_MAX_BATCH 16
+
+/// The number of entries in the command table; must be a power of two.
+#define COMMAND_TABLE_SIZE 64
+
+/// The initial capacity of response formatting and output buffers.
+const size_t RESPONSE_BUFFER_SIZE = (size_t)4096;
+
+/// The size of a client's output buffer past which its commands are held.
+const size_t CLIENT_OUTPUT_HIGH_WATER = (size_t)(64 * 1024);
+
+/// The size of a client's output buffer past which it is disconnected.
+const size_t CLIENT_OUTPUT_MAX = (size_t)(1024 * 1024);
+
+/// The size of a client's partial input line past which it is disconnected.
+const size_t CLIENT_INPUT_MAX = (size_t)(64 * 1024);
+
+/// The maximum number of socket events handled per server poll.
+#define SERVER_MAX_EVENTS 64
+
+/// The number of bytes read from a client socket at a time.
+#define SERVER_READ_SIZE 4096
+
+/// The most bytes read from one client per server poll, so a client that
+/// floods us can't hold up the rest of the main loop.
+#define SERVER_READ_MAX (16 * SERVER_READ_SIZE)
+
 /// The size of the internal decoding buffer.
 const size_t BUFFER_SIZE = (size_t)FF_MIN_BUFFER_SIZE;
 
+/// The size of the buffer between ffmpeg and our own file readers.
+const size_t CUSTOM_IO_BUFFER_SIZE = (size_t)(32 * 1024);
+
+/// How far ahead of the read position memory-mapped files are paged in.
+const size_t MMAP_ADVISE_WINDOW = (size_t)(1024 * 1024);
+
+/// The size of each block read by the read-ahead file reader.
+const size_t READAHEAD_BLOCK_SIZE = (size_t)(128 * 1024);
+
+/// The number of threads reading blocks when io_uring isn't available.
+const size_t READAHEAD_THREADS = (size_t)4;
+
+/// How many times the read-ahead file reader rereads a block that came up
+/// short before taking the file to have been truncated.
+const unsigned int READAHEAD_SHORT_READ_TRIES = 3;
+
+/// How often a wait for a read-ahead block checks for cancellation.
+const std::chrono::milliseconds READAHEAD_POLL_PERIOD(10);
+
+/// The number of packets demuxed ahead of the decoder, by default.
+/// This must be a power of two.
+const size_t DEMUX_QUEUE_PACKETS = (size_t)64;
+
+/// The shortest file whose codec may decode on several threads.  Shorter
+/// files (carts, jingles) need to start quickly more than they need
+/// throughput, and frame threading delays the first frame.
+const std::chrono::seconds CODEC_THREADS_MIN_LENGTH(30);
+
+/// The number of library scanning threads per core, by default.
+const unsigned int SCAN_THREADS_PER_CORE = 2;
+
+/// How many files the library scanner probes between progress messages.
+const size_t SCAN_PROGRESS_INTERVAL = (size_t)1000;
+
+/// The level, in LUFS or dBTP, reported for silence by loudness analysis.
+const double LOUDNESS_FLOOR_DB = -70.0;
+
+/// The number of taps in each phase of the true-peak interpolation filter.
+const size_t TRUE_PEAK_TAPS = (size_t)12;
+
+/// The integrated loudness, in LUFS, that tracks are normalised to.
+const double LOUDNESS_TARGET_LUFS = -23.0;
+
+/// The true peak, in dBTP, that normalisation never pushes a track above.
+const double TRUE_PEAK_CEILING_DBTP = -1.0;
+
+/// The largest gain, in dB, that normalisation applies to quiet tracks.
+const double LOUDNESS_MAX_GAIN_DB = 12.0;
+
+/// The level, in dBFS, below which every channel must be for silence.
+const double SILENCE_THRESHOLD_DB = -60.0;
+
+/// The shortest leading or trailing silence that is trimmed.
+const std::chrono::milliseconds SILENCE_MIN_LENGTH(200);
+
+/// The number of samples the silence detector scans at once.
+const size_t SILENCE_BLOCK_SAMPLES = (size_t)512;
+
+/// The number of samples summarised by each finest waveform overview point.
+const size_t WAVE_BUCKET_SAMPLES = (size_t)256;
+
 /// n, where 2^n is the capacity of the AudioOutput ring buffer.
 /// @see RINGBUF_SIZE
 const size_t RINGBUF_POWER = (size_t)16;
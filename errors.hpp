@@ -11,7 +11,8 @@
 #define PS_ERRORS_HPP
 
 #include <string>
-#include <iostream>
+
+#include "logger.hpp"
 
 /**
  * A Playslave exception.
@@ -81,44 +82,4 @@ public:
 	FileError(const std::string &message) : Error(message) {};
 };
 
-//
-// Debugging
-//
-
-/**
- * Base case for DebugArgs, when there are no arguments.
- */
-inline void DebugArgs()
-{
-}
-
-/**
- * Outputs a debug message, with a variadic number of arguments (at least one).
- * This is defined inductively, with DebugArgs() being the base case.
- * @tparam Arg1 The type of the leftmost argument.
- * @tparam Args Parameter pack of remaining arguments.
- * @param arg1 The leftmost argument.
- * @param args The remaining arguments.
- */
-template <typename Arg1, typename... Args>
-inline void DebugArgs(Arg1 &arg1, Args &... args)
-{
-	std::cerr << " " << arg1;
-	DebugArgs(args...);
-}
-
-/**
- * Outputs a debug message, with a variadic number of arguments.
- * @tparam Args Parameter pack of arguments.
- * @param args The arguments.
- * @see DebugArgs
- */
-template <typename... Args>
-inline void Debug(Args &... args)
-{
-	std::cerr << "DEBUG:";
-	DebugArgs(args...);
-	std::cerr << std::endl;
-}
-
 #endif // PS_ERRORS_HPP
@@ -7,8 +7,6 @@
  * @see io.hpp
  */
 
-#include <iostream>
-#include <map>
 #include <string>
 
 #include <cstdarg>
@@ -22,23 +20,119 @@
 #include <sys/select.h> /* select */
 #endif
 
+#include "constants.h"
 #include "io.hpp"
 
 /* Data for the responses. */
-const std::map<Response, std::string> RESPONSES = {{Response::OKAY, "OKAY"},
-                                                   {Response::WHAT, "WHAT"},
-                                                   {Response::FAIL, "FAIL"},
-                                                   {Response::OOPS, "OOPS"},
-                                                   {Response::NOPE, "NOPE"},
-                                                   {Response::OHAI, "OHAI"},
-                                                   {Response::TTFN, "TTFN"},
-                                                   {Response::STAT, "STAT"},
-                                                   {Response::TIME, "TIME"},
-                                                   {Response::DBUG, "DBUG"},
-                                                   {Response::QPOS, "QPOS"},
-                                                   {Response::QENT, "QENT"},
-                                                   {Response::QMOD, "QMOD"},
-                                                   {Response::QNUM, "QNUM"}};
+const char RESPONSES[][RESPONSE_CODE_LENGTH + 1] = {
+                "OKAY", "WHAT", "FAIL", "OOPS", "NOPE", "OHAI", "TTFN",
+                "STAT", "TIME", "LEVL", "HIST", "PIPE", "INFO", "ITAG",
+                "LOUD", "WAVE", "WAVP", "WEND", "ENDG", "DEAD", "XRUN",
+                "PERF", "STGE", "CUED", "DBUG", "QENT", "QMOD", "QPOS",
+                "QNUM"};
+
+static_assert(sizeof(RESPONSES) / sizeof(RESPONSES[0]) ==
+                              static_cast<size_t>(Response::COUNT),
+              "RESPONSES must have one entry per Response");
+
+ResponseEncoder::ResponseEncoder()
+{
+	this->buffer.reserve(RESPONSE_BUFFER_SIZE);
+}
+
+void ResponseEncoder::Begin(Response code)
+{
+	this->buffer.assign(RESPONSES[static_cast<size_t>(code)],
+	                    RESPONSE_CODE_LENGTH);
+}
+
+void ResponseEncoder::Add(const std::string &s)
+{
+	this->buffer += ' ';
+	this->buffer += s;
+}
+
+void ResponseEncoder::Add(const char *s)
+{
+	this->buffer += ' ';
+	this->buffer += s;
+}
+
+void ResponseEncoder::Add(boost::string_ref s)
+{
+	this->buffer += ' ';
+	this->buffer.append(s.data(), s.size());
+}
+
+void ResponseEncoder::AddUnsigned(std::uint64_t n, bool negative)
+{
+	// Enough for 2^64 - 1, plus a minus sign.
+	char digits[21];
+	char *p = digits + sizeof(digits);
+
+	do {
+		*--p = static_cast<char>('0' + n % 10);
+		n /= 10;
+	} while (n != 0);
+	if (negative) {
+		*--p = '-';
+	}
+
+	this->buffer += ' ';
+	this->buffer.append(p, static_cast<size_t>(digits + sizeof(digits) - p));
+}
+
+void ResponseEncoder::End()
+{
+	this->buffer += '\n';
+}
+
+const char *ResponseEncoder::Data() const
+{
+	return this->buffer.data();
+}
+
+size_t ResponseEncoder::Size() const
+{
+	return this->buffer.size();
+}
+
+StdoutSink::StdoutSink()
+{
+	this->pending.reserve(RESPONSE_BUFFER_SIZE);
+}
+
+void StdoutSink::Emit(const char *line, size_t length)
+{
+	this->pending.append(line, length);
+}
+
+void StdoutSink::Flush()
+{
+	if (this->pending.empty()) {
+		return;
+	}
+
+	std::fwrite(this->pending.data(), 1, this->pending.size(), stdout);
+	std::fflush(stdout);
+	this->pending.clear();
+}
+
+/// The default broadcast sink.
+static StdoutSink stdout_sink;
+
+/// The current broadcast sink.
+static ResponseSink *broadcast_sink = &stdout_sink;
+
+ResponseSink &BroadcastSink()
+{
+	return *broadcast_sink;
+}
+
+void SetBroadcastSink(ResponseSink *sink)
+{
+	broadcast_sink = (sink == nullptr) ? &stdout_sink : sink;
+}
 
 /* Returns true if input is waiting on standard in. */
 int input_waiting(void)
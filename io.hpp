@@ -10,9 +10,14 @@
 #ifndef PS_IO_HPP
 #define PS_IO_HPP
 
-#include <map>
-#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <type_traits>
+
+#include <boost/utility/string_ref.hpp>
 
 /**
  * Four-character response codes.
@@ -31,64 +36,274 @@ enum class Response {
 	TTFN, /* Server shutting down */
 	STAT, /* Server changing state */
 	TIME, /* Server sending current song time */
+	LEVL, /* Server sending current output levels */
+	HIST, /* Server sending a latency histogram summary */
+	PIPE, /* Server sending demux queue depth statistics */
+	INFO, /* Server sending a file's library index entry */
+	ITAG, /* Server sending one tag of a file's library index entry */
+	LOUD, /* Server sending a file's loudness analysis */
+	WAVE, /* Server sending a point of a file's waveform overview */
+	WAVP, /* Server streaming a point of a waveform being computed */
+	WEND, /* Server finishing streaming a waveform */
+	ENDG, /* Server announcing the song has reached its trailing silence */
+	DEAD, /* Server announcing the output has gone dead air */
+	XRUN, /* Server sending the output's underrun statistics */
+	PERF, /* Server sending play callback timing statistics */
+	STGE, /* Server sending the time spent in a pipeline stage */
+	CUED, /* Server reporting how far off its target a scheduled play was */
 	DBUG, /* Debug information */
 	/* Queue-specific responses */
 	QENT, /* Requested information about a Queue ENTry */
 	QMOD, /* A command caused a Queue MODification */
 	QPOS, /* The current Queue POSition has changed */
-	QNUM  /* Reminder of current number of queue items */
+	QNUM, /* Reminder of current number of queue items */
+	COUNT /* Not a response: the number of response codes */
 };
 
+/// The length of every response code string.
+const size_t RESPONSE_CODE_LENGTH = 4;
+
 /**
- * A map from Response codes to their string equivalents.
+ * A table of the string equivalents of Response codes, indexed by code.
  * @see Response
  */
-extern const std::map<Response, std::string> RESPONSES;
+extern const char RESPONSES[][RESPONSE_CODE_LENGTH + 1];
 
 /**
- * Base case for the RespondArgs template, for when there are no arguments.
+ * Formats response lines into a reusable buffer.
+ *
+ * The buffer keeps its capacity between lines, so once it has grown to fit
+ * the longest line, formatting a response allocates nothing.  Integers and
+ * strings, which make up nearly every response, are copied or converted
+ * directly; anything else falls back to a std::ostringstream.
  */
-inline void RespondArgs()
+class ResponseEncoder {
+public:
+	/**
+	 * Constructs a ResponseEncoder.
+	 */
+	ResponseEncoder();
+
+	/**
+	 * Starts a new line with the given response code.
+	 * @param code The response code.
+	 */
+	void Begin(Response code);
+
+	/**
+	 * Appends an argument to the line.
+	 * @param s The argument.
+	 */
+	void Add(const std::string &s);
+
+	/**
+	 * Appends an argument to the line.
+	 * @param s The argument, as a NUL-terminated string.
+	 */
+	void Add(const char *s);
+
+	/**
+	 * Appends an argument to the line.
+	 * @param s The argument, as a view of a string.
+	 */
+	void Add(boost::string_ref s);
+
+	/**
+	 * Appends an integer argument to the line.
+	 * @tparam T The integer type.
+	 * @param n The argument.
+	 */
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value>::type Add(T n)
+	{
+		if (n < 0) {
+			AddUnsigned(0 - static_cast<std::uint64_t>(n), true);
+		} else {
+			AddUnsigned(static_cast<std::uint64_t>(n), false);
+		}
+	}
+
+	/**
+	 * Appends an argument of any other streamable type to the line.
+	 * @tparam T The argument type.
+	 * @param v The argument.
+	 */
+	template <typename T>
+	typename std::enable_if<!std::is_integral<T>::value>::type Add(
+	                const T &v)
+	{
+		std::ostringstream os;
+		os << v;
+		Add(os.str());
+	}
+
+	/**
+	 * Finishes the line.
+	 */
+	void End();
+
+	/**
+	 * The formatted line, including its newline.
+	 * @return A pointer to the start of the line.
+	 */
+	const char *Data() const;
+
+	/**
+	 * The length of the formatted line.
+	 * @return The length, in bytes, including the newline.
+	 */
+	size_t Size() const;
+
+private:
+	std::string buffer; ///< The line being formatted.
+
+	/**
+	 * Appends an integer, in decimal, to the line.
+	 * @param n The magnitude of the integer.
+	 * @param negative Whether the integer is negative.
+	 */
+	void AddUnsigned(std::uint64_t n, bool negative);
+};
+
+/**
+ * Base case for the EncodeArgs template, for when there are no arguments.
+ * @param e The encoder to which the response body is being written.
+ */
+inline void EncodeArgs(ResponseEncoder &)
 {
 }
 
 /**
- * Outputs a response body, with a variadic number of arguments.
- * This is defined inductively, with RespondArgs() being the base case.
+ * Encodes a response body, with a variadic number of arguments.
+ * This is defined inductively, with EncodeArgs(e) being the base case.
  * @tparam Arg1 The type of the leftmost argument.
  * @tparam Args Parameter pack of remaining arguments.
+ * @param e The encoder to which the response body is being written.
  * @param arg1 The leftmost argument.
  * @param args The remaining arguments.
  */
 template <typename Arg1, typename... Args>
-inline void RespondArgs(const Arg1 &arg1, const Args &... args)
+inline void EncodeArgs(ResponseEncoder &e, const Arg1 &arg1,
+                       const Args &... args)
 {
-	std::cout << " " << arg1;
-	RespondArgs(args...);
+	e.Add(arg1);
+	EncodeArgs(e, args...);
 }
 
 /**
- * Base case for the Respond template, for when there are no arguments.
- * @param code The response code to emit.
+ * Abstract class for things that responses can be sent to.
+ *
+ * A ResponseSink might be standard output, one client connection, or every
+ * client connection at once.  Sinks are expected to buffer what they are
+ * sent until they are flushed.
  */
-inline void Respond(Response code)
-{
-	std::cout << RESPONSES.at(code) << std::endl;
-}
+class ResponseSink {
+public:
+	/**
+	 * Constructs a ResponseSink.
+	 */
+	ResponseSink() : self(this, [](ResponseSink *) {})
+	{
+	}
+
+	ResponseSink(const ResponseSink &) = delete;
+	ResponseSink &operator=(const ResponseSink &) = delete;
+
+	/**
+	 * Virtual destructor for ResponseSink.
+	 */
+	virtual ~ResponseSink() {};
+
+	/**
+	 * Gets a weak reference to this sink, which expires when the sink is
+	 * destroyed.
+	 * This is for replies that are sent some time after the request, by
+	 * which point the client may have gone away.
+	 * @return A weak pointer to this sink.
+	 */
+	std::weak_ptr<ResponseSink> WeakReference() const
+	{
+		return this->self;
+	}
+
+	/**
+	 * Sends a response, with a variadic number of arguments.
+	 * @tparam Args Parameter pack of arguments.
+	 * @param code The response code to emit.
+	 * @param args The arguments, if any.
+	 */
+	template <typename... Args>
+	void Respond(Response code, const Args &... args)
+	{
+		this->encoder.Begin(code);
+		EncodeArgs(this->encoder, args...);
+		this->encoder.End();
+		Emit(this->encoder.Data(), this->encoder.Size());
+	}
+
+	/**
+	 * Sends a complete, newline-terminated response line.
+	 * @param line The start of the line.
+	 * @param length The length of the line, in bytes.
+	 */
+	virtual void Emit(const char *line, size_t length) = 0;
+
+	/**
+	 * Sends anything buffered by this sink to its destination.
+	 */
+	virtual void Flush() {};
+
+private:
+	ResponseEncoder encoder; ///< The encoder used to format responses.
+
+	/// Non-owning pointer to this sink, from which weak references are
+	/// made.
+	std::shared_ptr<ResponseSink> self;
+};
+
+/**
+ * A ResponseSink that writes to standard output.
+ */
+class StdoutSink : public ResponseSink {
+public:
+	/**
+	 * Constructs a StdoutSink.
+	 */
+	StdoutSink();
+
+	void Emit(const char *line, size_t length) override;
+	void Flush() override;
+
+private:
+	std::string pending; ///< Output not yet written.
+};
+
+/**
+ * Gets the sink to which unsolicited responses are sent.
+ * By default, this is a StdoutSink.
+ * @return The broadcast sink.
+ */
+ResponseSink &BroadcastSink();
+
+/**
+ * Changes the sink to which unsolicited responses are sent.
+ * @param sink The new broadcast sink, or nullptr to restore the default.
+ *   The caller retains ownership.
+ */
+void SetBroadcastSink(ResponseSink *sink);
 
 /**
- * Outputs a response, with a variadic number of arguments.
- * This is defined on RespondArgs.
+ * Outputs a response to the broadcast sink, with a variadic number of
+ * arguments.
  * @tparam Args Parameter pack of arguments.
  * @param code The response code to emit.
  * @param args The arguments, if any.
+ * @see BroadcastSink
  */
 template <typename... Args>
-inline void Respond(Response code, Args &... args)
+inline void Respond(Response code, const Args &... args)
 {
-	std::cout << RESPONSES.at(code);
-	RespondArgs(args...);
-	std::cout << std::endl;
+	BroadcastSink().Respond(code, args...);
 }
 
 /**
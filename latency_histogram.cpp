@@ -0,0 +1,128 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the LatencyHistogram class.
+ * @see latency_histogram.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "latency_histogram.hpp"
+
+/// The number of sub-buckets per power of two.
+static const std::uint64_t SUB_BUCKETS = 1u << HISTOGRAM_SUB_BITS;
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+std::size_t LatencyHistogram::BucketFor(std::uint64_t value)
+{
+	// Small values get a bucket each.
+	if (value < SUB_BUCKETS) {
+		return static_cast<std::size_t>(value);
+	}
+
+	// Otherwise, find the power of two, then the linear step within it.
+	unsigned int exponent = 63;
+	while ((value >> exponent) == 0) {
+		exponent--;
+	}
+
+	unsigned int shift = exponent - HISTOGRAM_SUB_BITS;
+	std::uint64_t sub = (value >> shift) - SUB_BUCKETS;
+	return static_cast<std::size_t>(((shift + 1) << HISTOGRAM_SUB_BITS) +
+	                                sub);
+}
+
+std::uint64_t LatencyHistogram::UpperBound(std::size_t bucket)
+{
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+
+	unsigned int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+	std::uint64_t sub = bucket & (SUB_BUCKETS - 1);
+	std::uint64_t lower = (SUB_BUCKETS + sub) << shift;
+	return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::Record(Unit duration)
+{
+	auto value = static_cast<std::uint64_t>(
+	                duration.count() < 0 ? 0 : duration.count());
+
+	this->buckets[BucketFor(value)].fetch_add(1,
+	                                           std::memory_order_relaxed);
+	this->count.fetch_add(1, std::memory_order_relaxed);
+
+	std::uint64_t seen = this->max.load(std::memory_order_relaxed);
+	while (seen < value &&
+	       !this->max.compare_exchange_weak(seen, value,
+	                                        std::memory_order_relaxed)) {
+	}
+}
+
+std::uint64_t LatencyHistogram::Count() const
+{
+	return this->count.load(std::memory_order_relaxed);
+}
+
+LatencyHistogram::Unit LatencyHistogram::Max() const
+{
+	return Unit(this->max.load(std::memory_order_relaxed));
+}
+
+LatencyHistogram::Unit LatencyHistogram::Percentile(double fraction) const
+{
+	std::uint64_t total = 0;
+	for (auto &b : this->buckets) {
+		total += b.load(std::memory_order_relaxed);
+	}
+	if (total == 0) {
+		return Unit(0);
+	}
+
+	auto rank = static_cast<std::uint64_t>(std::ceil(fraction * total));
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	std::uint64_t seen = 0;
+	for (std::size_t i = 0; i < this->buckets.size(); i++) {
+		seen += this->buckets[i].load(std::memory_order_relaxed);
+		if (rank <= seen) {
+			// Don't report past the largest value actually seen.
+			return std::min(Unit(UpperBound(i)), Max());
+		}
+	}
+	return Max();
+}
+
+std::uint64_t LatencyHistogram::CountAbove(Unit duration) const
+{
+	auto value = static_cast<std::uint64_t>(
+	                duration.count() < 0 ? 0 : duration.count());
+
+	std::uint64_t total = 0;
+	for (std::size_t i = BucketFor(value); i < this->buckets.size(); i++) {
+		total += this->buckets[i].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void LatencyHistogram::Reset()
+{
+	for (auto &b : this->buckets) {
+		b.store(0, std::memory_order_relaxed);
+	}
+	this->count.store(0, std::memory_order_relaxed);
+	this->max.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,110 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the LatencyHistogram class.
+ * @see latency_histogram.cpp
+ */
+
+#ifndef PS_LATENCY_HISTOGRAM_HPP
+#define PS_LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/// The number of linear sub-buckets per power of two, as a power of two.
+#define HISTOGRAM_SUB_BITS 3
+
+/// The number of buckets in a LatencyHistogram.
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/**
+ * A histogram of durations, with log-linear buckets.
+ *
+ * Each power of two is split into 2^HISTOGRAM_SUB_BITS equal buckets, so
+ * any recorded duration is known to within 12.5%, from nanoseconds up to
+ * centuries, in a fixed few kilobytes.
+ *
+ * Recording is lock-free and never allocates, so it is safe from the play
+ * callback and from any number of threads at once.  Reading the histogram
+ * while it is being recorded to gives a slightly inconsistent, but still
+ * useful, picture.
+ */
+class LatencyHistogram {
+public:
+	/// The unit in which durations are recorded.
+	using Unit = std::chrono::nanoseconds;
+
+	/**
+	 * Constructs an empty LatencyHistogram.
+	 */
+	LatencyHistogram();
+
+	/**
+	 * Records one duration.
+	 * @param duration The duration.
+	 */
+	void Record(Unit duration);
+
+	/**
+	 * The number of durations recorded.
+	 * @return The count.
+	 */
+	std::uint64_t Count() const;
+
+	/**
+	 * The longest duration recorded.
+	 * @return The maximum, or zero if nothing has been recorded.
+	 */
+	Unit Max() const;
+
+	/**
+	 * Estimates a percentile of the recorded durations.
+	 * @param fraction The percentile, as a fraction between 0 and 1.
+	 * @return The upper bound of the bucket holding the percentile, or
+	 *   zero if nothing has been recorded.
+	 */
+	Unit Percentile(double fraction) const;
+
+	/**
+	 * Counts the recorded durations longer than a given duration.
+	 * Durations sharing its bucket are counted too, so this may include
+	 * some up to 12.5% shorter.
+	 * @param duration The duration.
+	 * @return The count.
+	 */
+	std::uint64_t CountAbove(Unit duration) const;
+
+	/**
+	 * Forgets all recorded durations.
+	 * Durations recorded concurrently with a reset may be lost.
+	 */
+	void Reset();
+
+private:
+	/// The number of durations in each bucket.
+	std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS> buckets;
+
+	std::atomic<std::uint64_t> count; ///< The total number of durations.
+	std::atomic<std::uint64_t> max;   ///< The longest duration.
+
+	/**
+	 * Finds the bucket a value falls into.
+	 * @param value The value, in Units.
+	 * @return The index of the bucket.
+	 */
+	static std::size_t BucketFor(std::uint64_t value);
+
+	/**
+	 * Finds the largest value falling into a bucket.
+	 * @param bucket The index of the bucket.
+	 * @return The upper bound, in Units.
+	 */
+	static std::uint64_t UpperBound(std::size_t bucket);
+};
+
+#endif // PS_LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,374 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the LibraryIndex class and related functions.
+ * @see library/library_index.hpp
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../errors.hpp"
+#include "../messages.h"
+
+#include "library_index.hpp"
+
+/// The magic number starting every index file.
+static const char INDEX_MAGIC[4] = {'P', 'S', 'L', 'I'};
+
+/// The index format version; bump this when the layout changes.
+static const std::uint32_t INDEX_VERSION = 1;
+
+/// The index file header.
+struct IndexHeader {
+	char magic[4];              ///< INDEX_MAGIC.
+	std::uint32_t version;      ///< INDEX_VERSION.
+	std::uint32_t record_count; ///< The number of IndexRecords.
+	std::uint32_t tag_count;    ///< The number of IndexTags.
+	std::uint64_t strings_size; ///< The size of the string pool.
+};
+
+/// One file in the index.  Strings are offsets into the string pool.
+struct IndexRecord {
+	std::int64_t duration;     ///< The length, in microseconds.
+	std::int64_t bit_rate;     ///< The bit rate, or 0 if unknown.
+	std::uint32_t path;        ///< The path.
+	std::uint32_t format;      ///< The container format's name.
+	std::uint32_t codec;       ///< The audio codec's name.
+	std::uint32_t sample_rate; ///< The sample rate, in Hz.
+	std::uint32_t first_tag;   ///< The index of the first IndexTag.
+	std::uint16_t tag_count;   ///< The number of IndexTags.
+	std::uint16_t channels;    ///< The channel count.
+};
+
+/// One tag of a file.  Strings are offsets into the string pool.
+struct IndexTag {
+	std::uint32_t key;   ///< The tag's key.
+	std::uint32_t value; ///< The tag's value.
+};
+
+//
+// Writing
+//
+
+/**
+ * A pool of NUL-terminated strings, each stored once.
+ * Format names, codec names and tag keys repeat across most of a library,
+ * so sharing them keeps the index small.
+ */
+class StringPool {
+public:
+	/**
+	 * Adds a string to the pool, if it isn't already there.
+	 * @param s The string.
+	 * @return The string's offset in the pool.
+	 */
+	std::uint32_t Add(const std::string &s)
+	{
+		auto found = this->offsets.find(s);
+		if (found != this->offsets.end()) {
+			return found->second;
+		}
+
+		if (UINT32_MAX - this->data.size() <= s.size()) {
+			throw FileError(MSG_INDEX_TOO_BIG);
+		}
+		auto offset = static_cast<std::uint32_t>(this->data.size());
+		this->data.append(s.c_str(), s.size() + 1);
+		this->offsets.emplace(s, offset);
+		return offset;
+	}
+
+	/**
+	 * The pool's contents.
+	 * @return The strings, each followed by a NUL.
+	 */
+	const std::string &Data() const
+	{
+		return this->data;
+	}
+
+private:
+	std::string data; ///< The strings, each followed by a NUL.
+	std::unordered_map<std::string, std::uint32_t> offsets; ///< By value.
+};
+
+/**
+ * Writes an array of plain structures to a stream.
+ * @param out The stream.
+ * @param items The structures.
+ */
+template <typename T>
+static void WriteAll(std::ofstream &out, const std::vector<T> &items)
+{
+	out.write(reinterpret_cast<const char *>(items.data()),
+	          static_cast<std::streamsize>(items.size() * sizeof(T)));
+}
+
+void WriteLibraryIndex(const std::string &path,
+                       std::vector<LibraryEntry> &entries)
+{
+	std::sort(entries.begin(), entries.end(),
+	          [](const LibraryEntry &a, const LibraryEntry &b) {
+		return a.path < b.path;
+	});
+
+	StringPool strings;
+	std::vector<IndexRecord> records;
+	std::vector<IndexTag> tags;
+	records.reserve(entries.size());
+
+	for (const auto &entry : entries) {
+		const FileInfo &info = entry.info;
+
+		IndexRecord r;
+		std::memset(&r, 0, sizeof(r));
+		r.duration = info.duration.count();
+		r.bit_rate = info.bit_rate;
+		r.path = strings.Add(entry.path);
+		r.format = strings.Add(info.format);
+		r.codec = strings.Add(info.codec);
+		r.sample_rate = info.sample_rate;
+		r.first_tag = static_cast<std::uint32_t>(tags.size());
+		r.tag_count = static_cast<std::uint16_t>(
+		                std::min<std::size_t>(info.tags.size(),
+		                                      UINT16_MAX));
+		r.channels = info.channels;
+
+		for (std::size_t i = 0; i < r.tag_count; i++) {
+			IndexTag t;
+			t.key = strings.Add(info.tags[i].first);
+			t.value = strings.Add(info.tags[i].second);
+			tags.push_back(t);
+		}
+		records.push_back(r);
+	}
+
+	if (UINT32_MAX < records.size() || UINT32_MAX < tags.size()) {
+		throw FileError(MSG_INDEX_TOO_BIG);
+	}
+
+	IndexHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+	h.version = INDEX_VERSION;
+	h.record_count = static_cast<std::uint32_t>(records.size());
+	h.tag_count = static_cast<std::uint32_t>(tags.size());
+	h.strings_size = strings.Data().size();
+
+	// Write beside the old index, then swap it in.
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+		WriteAll(out, records);
+		WriteAll(out, tags);
+		out.write(strings.Data().data(),
+		          static_cast<std::streamsize>(strings.Data().size()));
+		out.close();
+		if (out.fail()) {
+			std::remove(temp.c_str());
+			throw FileError(MSG_INDEX_WRITE_FAIL);
+		}
+	}
+	if (std::rename(temp.c_str(), path.c_str()) != 0) {
+		std::remove(temp.c_str());
+		throw FileError(MSG_INDEX_WRITE_FAIL);
+	}
+}
+
+//
+// Reading
+//
+
+#ifdef WIN32
+
+// Windows has no mmap, so the index is read into memory instead.
+LibraryIndex::LibraryIndex(const std::string &path)
+        : data(nullptr),
+          size(0),
+          header(nullptr),
+          records(nullptr),
+          tags(nullptr),
+          strings(nullptr)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	std::streamoff length = in ? static_cast<std::streamoff>(in.tellg())
+	                           : 0;
+	if (length <= 0) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+
+	std::unique_ptr<char[]> buffer(
+	                new char[static_cast<std::size_t>(length)]);
+	in.seekg(0);
+	if (!in.read(buffer.get(), length)) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+	this->data = buffer.get();
+	this->size = static_cast<std::size_t>(length);
+
+	// If this throws, the buffer frees itself.
+	Validate();
+	buffer.release();
+
+	Debug("library index has", this->header->record_count, "files");
+}
+
+LibraryIndex::~LibraryIndex()
+{
+	delete[] this->data;
+}
+
+#else
+
+LibraryIndex::LibraryIndex(const std::string &path)
+        : data(nullptr),
+          size(0),
+          header(nullptr),
+          records(nullptr),
+          tags(nullptr),
+          strings(nullptr)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 < st.st_size) {
+		map = mmap(nullptr, static_cast<std::size_t>(st.st_size),
+		           PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+	this->data = static_cast<const char *>(map);
+	this->size = static_cast<std::size_t>(st.st_size);
+
+	try
+	{
+		Validate();
+	}
+	catch (...)
+	{
+		munmap(const_cast<char *>(this->data), this->size);
+		throw;
+	}
+
+	Debug("library index has", this->header->record_count, "files");
+}
+
+LibraryIndex::~LibraryIndex()
+{
+	munmap(const_cast<char *>(this->data), this->size);
+}
+
+#endif // WIN32
+
+void LibraryIndex::Validate()
+{
+	if (this->size < sizeof(IndexHeader)) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+	this->header = reinterpret_cast<const IndexHeader *>(this->data);
+
+	const IndexHeader &h = *this->header;
+	if (std::memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.version != INDEX_VERSION) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+
+	// These can't overflow: the counts are 32 bits, the sizes small.
+	std::uint64_t records_size =
+	                std::uint64_t(h.record_count) * sizeof(IndexRecord);
+	std::uint64_t tags_size = std::uint64_t(h.tag_count) * sizeof(IndexTag);
+	std::uint64_t fixed_size = sizeof(IndexHeader) + records_size + tags_size;
+	// An empty library has an empty string pool, so nothing to end in a
+	// NUL.
+	if (this->size < fixed_size ||
+	    this->size - fixed_size != h.strings_size ||
+	    (0 < h.strings_size && this->data[this->size - 1] != '\0')) {
+		throw FileError(MSG_INDEX_BAD);
+	}
+
+	const char *p = this->data + sizeof(IndexHeader);
+	this->records = reinterpret_cast<const IndexRecord *>(p);
+	this->tags = reinterpret_cast<const IndexTag *>(p + records_size);
+	this->strings = p + records_size + tags_size;
+
+	// With the pool ending in a NUL, any offset inside it is a valid
+	// string, so checking offsets now makes every later lookup safe.
+	auto ok = [&h](std::uint32_t offset) {
+		return offset < h.strings_size;
+	};
+	for (std::uint32_t i = 0; i < h.record_count; i++) {
+		const IndexRecord &r = this->records[i];
+		if (!ok(r.path) || !ok(r.format) || !ok(r.codec) ||
+		    h.tag_count < r.first_tag ||
+		    h.tag_count - r.first_tag < r.tag_count) {
+			throw FileError(MSG_INDEX_BAD);
+		}
+	}
+	for (std::uint32_t i = 0; i < h.tag_count; i++) {
+		if (!ok(this->tags[i].key) || !ok(this->tags[i].value)) {
+			throw FileError(MSG_INDEX_BAD);
+		}
+	}
+}
+
+std::size_t LibraryIndex::Size() const
+{
+	return this->header->record_count;
+}
+
+const char *LibraryIndex::String(std::uint32_t offset) const
+{
+	return this->strings + offset;
+}
+
+bool LibraryIndex::Find(const std::string &path, FileInfo &info) const
+{
+	const IndexRecord *begin = this->records;
+	const IndexRecord *end = begin + this->header->record_count;
+	auto before = [this](const IndexRecord &r, const std::string &p) {
+		return std::strcmp(String(r.path), p.c_str()) < 0;
+	};
+	const IndexRecord *r = std::lower_bound(begin, end, path, before);
+	if (r == end || path != String(r->path)) {
+		return false;
+	}
+
+	info.duration = std::chrono::microseconds(r->duration);
+	info.format = String(r->format);
+	info.codec = String(r->codec);
+	info.sample_rate = r->sample_rate;
+	info.channels = r->channels;
+	info.bit_rate = r->bit_rate;
+
+	info.tags.clear();
+	for (std::uint32_t i = 0; i < r->tag_count; i++) {
+		const IndexTag &t = this->tags[r->first_tag + i];
+		info.tags.emplace_back(String(t.key), String(t.value));
+	}
+	return true;
+}
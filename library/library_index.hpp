@@ -0,0 +1,112 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the LibraryIndex class and related functions.
+ * @see library/library_index.cpp
+ */
+
+#ifndef PS_LIBRARY_INDEX_HPP
+#define PS_LIBRARY_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../audio/audio_decoder.hpp"
+
+struct IndexHeader;
+struct IndexRecord;
+struct IndexTag;
+
+/**
+ * A file in a media library, and what probing it found.
+ */
+struct LibraryEntry {
+	std::string path; ///< The path to the file.
+	FileInfo info;    ///< What probing the file found.
+};
+
+/**
+ * Writes a library index file.
+ *
+ * The index is written to a temporary file which then replaces the old one,
+ * so players that have the old index mapped keep a consistent view of it.
+ *
+ * @param path The path of the index file.
+ * @param entries The entries, which are sorted by path in place.
+ * @throws FileError if the index can't be written.
+ * @see LibraryIndex
+ */
+void WriteLibraryIndex(const std::string &path,
+                       std::vector<LibraryEntry> &entries);
+
+/**
+ * A read-only, memory-mapped library index.
+ *
+ * The file holds a header, then fixed-size records sorted by path, then
+ * the records' tags, then a pool of NUL-terminated strings that the
+ * records and tags point into.  Mapping it costs next to nothing however
+ * big the library is; looking a file up is a binary search that only pages
+ * in what it touches.  (Windows has no mmap, so there the file is read
+ * into memory whole.)
+ */
+class LibraryIndex {
+public:
+	/**
+	 * Maps a library index file.
+	 * @param path The path of the index file.
+	 * @throws FileError if the file can't be mapped, or isn't a valid
+	 *   index.
+	 */
+	LibraryIndex(const std::string &path);
+
+	/**
+	 * Unmaps the library index.
+	 */
+	~LibraryIndex();
+
+	LibraryIndex(const LibraryIndex &) = delete;
+	LibraryIndex &operator=(const LibraryIndex &) = delete;
+
+	/**
+	 * The number of files in the index.
+	 * @return The file count.
+	 */
+	std::size_t Size() const;
+
+	/**
+	 * Looks up a file.
+	 * @param path The path of the file, exactly as it was scanned.
+	 * @param info The FileInfo to fill in if the file is found.
+	 * @return True if the file was found; false otherwise.
+	 */
+	bool Find(const std::string &path, FileInfo &info) const;
+
+private:
+	const char *data;  ///< The start of the mapping.
+	std::size_t size;  ///< The size of the mapping, in bytes.
+
+	const IndexHeader *header;  ///< The index header.
+	const IndexRecord *records; ///< The records, sorted by path.
+	const IndexTag *tags;       ///< The records' tags.
+	const char *strings;        ///< The string pool.
+
+	/**
+	 * Checks that the mapped file is a well-formed index, and finds its
+	 * sections.
+	 * @throws FileError if it isn't.
+	 */
+	void Validate();
+
+	/**
+	 * Gets a string from the pool.
+	 * @param offset The string's offset in the pool.
+	 * @return The string, which lives as long as the index.
+	 */
+	const char *String(std::uint32_t offset) const;
+};
+
+#endif // PS_LIBRARY_INDEX_HPP
@@ -0,0 +1,165 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the LibraryScanner class.
+ * @see library/library_scanner.hpp
+ */
+
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "../audio/audio_decoder.hpp"
+#include "../constants.h"
+#include "../errors.hpp"
+
+#include "library_scanner.hpp"
+
+LibraryScanner::LibraryScanner(const DecoderOptions &options,
+                               std::size_t threads)
+        : options(options), pool(threads), probed(0), failures(0)
+{
+}
+
+std::vector<LibraryEntry> LibraryScanner::Scan(const std::string &root)
+{
+	this->probed = 0;
+	this->failures = 0;
+
+	this->pool.Push([this, root] { ScanDirectory(root); });
+	this->pool.Wait();
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return std::move(this->entries);
+}
+
+std::size_t LibraryScanner::Failures() const
+{
+	return this->failures;
+}
+
+#ifdef WIN32
+
+void LibraryScanner::ScanDirectory(const std::string &path)
+{
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((path + "\\*").c_str(), &found);
+	if (find == INVALID_HANDLE_VALUE) {
+		Debug("can't list", path);
+		this->failures++;
+		return;
+	}
+
+	do {
+		if (found.cFileName[0] == '.') {
+			continue;
+		}
+		std::string child = path + "\\" + found.cFileName;
+
+		// As on POSIX, linked directories (junctions and the like)
+		// aren't followed, in case they loop.
+		DWORD attributes = found.dwFileAttributes;
+		bool is_link = (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+		bool is_dir = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+		if (is_dir && !is_link) {
+			this->pool.Push([this, child] { ScanDirectory(child); });
+		} else if (!is_dir) {
+			this->pool.Push([this, child] { ScanFile(child); });
+		}
+	} while (FindNextFileA(find, &found));
+
+	FindClose(find);
+}
+
+#else
+
+void LibraryScanner::ScanDirectory(const std::string &path)
+{
+	DIR *dir = opendir(path.c_str());
+	if (dir == nullptr) {
+		Debug("can't list", path);
+		this->failures++;
+		return;
+	}
+
+	// readdir is thread-safe as long as each thread has its own DIR.
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		std::string child = path + "/" + entry->d_name;
+
+		// d_type saves a stat per file, where the filesystem has it.
+		bool is_dir = entry->d_type == DT_DIR;
+		bool is_file = entry->d_type == DT_REG;
+		if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+			struct stat st;
+			if (lstat(child.c_str(), &st) == 0) {
+				is_dir = S_ISDIR(st.st_mode);
+				is_file = S_ISREG(st.st_mode);
+			}
+			if (!is_file && entry->d_type == DT_LNK &&
+			    stat(child.c_str(), &st) == 0) {
+				is_file = S_ISREG(st.st_mode);
+			}
+		}
+
+		if (is_dir) {
+			this->pool.Push([this, child] { ScanDirectory(child); });
+		} else if (is_file) {
+			this->pool.Push([this, child] { ScanFile(child); });
+		}
+	}
+
+	closedir(dir);
+}
+
+#endif // WIN32
+
+void LibraryScanner::ScanFile(const std::string &path)
+{
+	try
+	{
+		LibraryEntry entry;
+		entry.path = path;
+		entry.info = AudioDecoder::Probe(path, this->options);
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->entries.push_back(std::move(entry));
+	}
+	catch (Error &)
+	{
+		// Most likely just not an audio file.
+		this->failures++;
+	}
+	catch (std::exception &error)
+	{
+		auto what = error.what();
+		Debug("can't probe", path, what);
+		this->failures++;
+	}
+	catch (...)
+	{
+		Debug("can't probe", path);
+		this->failures++;
+	}
+
+	auto n = ++this->probed;
+	if (n % SCAN_PROGRESS_INTERVAL == 0) {
+		Debug("scanned", n, "files");
+	}
+}
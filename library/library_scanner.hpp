@@ -0,0 +1,80 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the LibraryScanner class.
+ * @see library/library_scanner.cpp
+ */
+
+#ifndef PS_LIBRARY_SCANNER_HPP
+#define PS_LIBRARY_SCANNER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../audio/audio_decoder.hpp"
+
+#include "library_index.hpp"
+#include "work_pool.hpp"
+
+/**
+ * Probes every file under a directory, in parallel.
+ *
+ * Listing a directory and probing a file are each a job on a
+ * WorkStealingPool, so the walk and the probes spread over every thread as
+ * they are discovered.  Files are probed with AudioDecoder::Probe, so the
+ * scan sees files exactly as the player would open them; files that can't
+ * be probed (including anything that isn't audio) are counted and skipped.
+ */
+class LibraryScanner {
+public:
+	/**
+	 * Constructs a LibraryScanner.
+	 * @param options Settings for opening files.
+	 * @param threads The number of threads to probe on.
+	 */
+	LibraryScanner(const DecoderOptions &options, std::size_t threads);
+
+	/**
+	 * Scans a directory and everything under it.
+	 * Hidden files and directories, and symbolic links to directories, are
+	 * skipped.
+	 * @param root The directory to scan.
+	 * @return An entry for every file successfully probed, in no order.
+	 */
+	std::vector<LibraryEntry> Scan(const std::string &root);
+
+	/**
+	 * The number of files that couldn't be probed in the last scan.
+	 * @return The failure count.
+	 */
+	std::size_t Failures() const;
+
+private:
+	DecoderOptions options; ///< Settings for opening files.
+	WorkStealingPool pool;  ///< The threads listing and probing.
+
+	std::mutex mutex;                  ///< Protects entries.
+	std::vector<LibraryEntry> entries; ///< The files probed so far.
+
+	std::atomic<std::size_t> probed;   ///< The files probed so far.
+	std::atomic<std::size_t> failures; ///< The files that failed so far.
+
+	/**
+	 * Lists a directory, queueing jobs for what is in it.
+	 * @param path The path of the directory.
+	 */
+	void ScanDirectory(const std::string &path);
+
+	/**
+	 * Probes a file, and adds it to the entries if it is audio.
+	 * @param path The path of the file.
+	 */
+	void ScanFile(const std::string &path);
+};
+
+#endif // PS_LIBRARY_SCANNER_HPP
@@ -0,0 +1,154 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the WorkStealingPool class.
+ * @see library/work_pool.hpp
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "work_pool.hpp"
+
+/// The pool the current thread works for, if any.
+static thread_local const WorkStealingPool *current_pool = nullptr;
+
+/// The index of the current thread's queue in current_pool.
+static thread_local std::size_t current_queue = 0;
+
+WorkStealingPool::WorkStealingPool(std::size_t threads)
+        : next_queue(0), queued(0), unfinished(0), stopping(false)
+{
+	assert(0 < threads);
+
+	for (std::size_t i = 0; i < threads; i++) {
+		this->queues.emplace_back(new Queue);
+	}
+	for (std::size_t i = 0; i < threads; i++) {
+		this->threads.emplace_back(&WorkStealingPool::Work, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	Wait();
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+
+	for (auto &t : this->threads) {
+		t.join();
+	}
+}
+
+void WorkStealingPool::Push(Job job)
+{
+	std::size_t index;
+	if (current_pool == this) {
+		index = current_queue;
+	} else {
+		index = this->next_queue.fetch_add(1) % this->queues.size();
+	}
+
+	// Counting the job before it can be taken means Take never counts
+	// below zero.  Counting it under the pool lock means a thread about
+	// to sleep either sees it, or is already waiting for the
+	// notification below; one that wakes before the job is queued just
+	// looks again.
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->unfinished++;
+		this->queued++;
+	}
+	{
+		Queue &q = *this->queues[index];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.jobs.push_back(std::move(job));
+	}
+	this->wake.notify_one();
+}
+
+void WorkStealingPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->idle.wait(lock, [this] { return this->unfinished == 0; });
+}
+
+std::size_t WorkStealingPool::Drop()
+{
+	// Only jobs taken off the queues are uncounted, and each was counted
+	// when pushed, so the counts can't go below zero.
+	std::size_t dropped = 0;
+	for (auto &q : this->queues) {
+		std::lock_guard<std::mutex> lock(q->mutex);
+		dropped += q->jobs.size();
+		q->jobs.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->queued -= dropped;
+	this->unfinished -= dropped;
+	if (this->unfinished == 0) {
+		this->idle.notify_all();
+	}
+	return dropped;
+}
+
+void WorkStealingPool::Work(std::size_t index)
+{
+	current_pool = this;
+	current_queue = index;
+
+	while (true) {
+		Job job;
+		if (!Take(index, job)) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->wake.wait(lock, [this] {
+				return this->stopping || 0 < this->queued;
+			});
+			if (this->stopping && this->queued == 0) {
+				return;
+			}
+			continue;
+		}
+
+		job();
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (--this->unfinished == 0) {
+			this->idle.notify_all();
+		}
+	}
+}
+
+bool WorkStealingPool::Take(std::size_t index, Job &job)
+{
+	std::size_t n = this->queues.size();
+	for (std::size_t i = 0; i < n; i++) {
+		Queue &q = *this->queues[(index + i) % n];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (q.jobs.empty()) {
+			continue;
+		}
+
+		// Run our own newest job, or steal someone else's oldest.
+		if (i == 0) {
+			job = std::move(q.jobs.back());
+			q.jobs.pop_back();
+		} else {
+			job = std::move(q.jobs.front());
+			q.jobs.pop_front();
+		}
+		this->queued--;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,113 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the WorkStealingPool class.
+ * @see library/work_pool.cpp
+ */
+
+#ifndef PS_WORK_POOL_HPP
+#define PS_WORK_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A pool of threads, each with its own queue of jobs, that steal from each
+ * other's queues when their own runs dry.
+ *
+ * Jobs pushed from inside a job go on the pushing thread's own queue, and
+ * each thread runs its own newest job first, so a job that fans out (such
+ * as listing a directory) keeps its children on one thread, close together,
+ * until others are idle and steal them.  Thieves take the oldest job,
+ * which is usually the biggest remaining piece of work.  Each queue has its
+ * own lock, so threads only contend when stealing.
+ */
+class WorkStealingPool {
+public:
+	/// Type of jobs.  Jobs must not throw.
+	using Job = std::function<void()>;
+
+	/**
+	 * Starts the pool's threads.
+	 * @param threads The number of threads, at least 1.
+	 */
+	WorkStealingPool(std::size_t threads);
+
+	/**
+	 * Waits for all jobs to finish, then stops the pool's threads.
+	 */
+	~WorkStealingPool();
+
+	WorkStealingPool(const WorkStealingPool &) = delete;
+	WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+	/**
+	 * Queues a job.
+	 * This may be called from any thread, including from inside a job.
+	 * @param job The job.
+	 */
+	void Push(Job job);
+
+	/**
+	 * Waits until every job pushed so far, and every job they push, has
+	 * finished.
+	 */
+	void Wait();
+
+	/**
+	 * Throws away every job not yet started.
+	 * Jobs already running carry on.  This is meant for shutting down,
+	 * when nothing else is pushing jobs.
+	 * @return The number of jobs thrown away.
+	 */
+	std::size_t Drop();
+
+private:
+	/// One thread's queue of jobs.
+	struct Queue {
+		std::mutex mutex;     ///< Protects jobs.
+		std::deque<Job> jobs; ///< Jobs not yet started, oldest first.
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues; ///< One per thread.
+
+	/// Where the next job pushed from outside the pool goes.
+	std::atomic<std::size_t> next_queue;
+
+	/// The number of jobs queued but not yet started.
+	std::atomic<std::size_t> queued;
+
+	std::mutex mutex;                  ///< Protects the below.
+	std::condition_variable wake;      ///< Signals new jobs, or stopping.
+	std::condition_variable idle;      ///< Signals all jobs finishing.
+	std::size_t unfinished;            ///< Jobs pushed but not finished.
+	bool stopping;                     ///< Set to stop the threads.
+
+	std::vector<std::thread> threads; ///< The threads.
+
+	/**
+	 * The body of each thread.
+	 * @param index The index of the thread's own queue.
+	 */
+	void Work(std::size_t index);
+
+	/**
+	 * Takes a job, from a thread's own queue if it can, or else by
+	 * stealing from another's.
+	 * @param index The index of the thread's own queue.
+	 * @param job The variable to move the job into.
+	 * @return True if a job was taken; false if every queue was empty.
+	 */
+	bool Take(std::size_t index, Job &job);
+};
+
+#endif // PS_WORK_POOL_HPP
@@ -0,0 +1,268 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the logging functions and the LogDrain class.
+ * @see logger.hpp
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "constants.h"
+#include "logger.hpp"
+
+/// The prefixes of messages of each level.
+static const char *LEVEL_PREFIXES[] = {"DEBUG:", "INFO:", "WARN:"};
+
+/**
+ * One slot of the log queue.
+ */
+struct LogSlot {
+	/// The slot's turn: equal to the position of the next record to be
+	/// written into it, or one past that position once it is written.
+	std::atomic<std::size_t> sequence;
+
+	std::size_t length;       ///< The length of the record's text.
+	char text[LOG_TEXT_SIZE]; ///< The record's text.
+};
+
+/**
+ * A bounded, lock-free queue of log records, between any number of logging
+ * threads and one draining thread.
+ *
+ * Each slot carries a sequence number saying whose turn it is, so logging
+ * threads claim positions with a compare-and-swap, and never wait for each
+ * other except to retry it.
+ */
+struct LogQueue {
+	LogSlot slots[LOG_QUEUE_RECORDS]; ///< The record storage.
+
+	std::atomic<std::size_t> head; ///< The next position to drain.
+	std::atomic<std::size_t> tail; ///< The next position to claim.
+
+	/// The number of records dropped because the queue was full.
+	std::atomic<std::uint64_t> dropped;
+
+	/// Whether a LogDrain is running.
+	std::atomic<bool> draining;
+
+	/// The number of threads between checking draining and queueing.
+	std::atomic<std::size_t> pushing;
+
+	/**
+	 * Constructs an empty LogQueue.
+	 */
+	LogQueue()
+	        : head(0), tail(0), dropped(0), draining(false), pushing(0)
+	{
+		for (std::size_t i = 0; i < LOG_QUEUE_RECORDS; i++) {
+			this->slots[i].sequence.store(i);
+		}
+	}
+};
+
+static_assert((LOG_QUEUE_RECORDS & (LOG_QUEUE_RECORDS - 1)) == 0,
+              "LOG_QUEUE_RECORDS must be a power of two");
+
+/**
+ * Gets the log queue.
+ * @return The queue.
+ */
+static LogQueue &Queue()
+{
+	static LogQueue queue;
+	return queue;
+}
+
+/**
+ * Writes a record out to stderr.
+ * @param text The record's text.
+ * @param length The length of the text.
+ */
+static void WriteRecord(const char *text, std::size_t length)
+{
+	std::fwrite(text, 1, length, stderr);
+	std::fputc('\n', stderr);
+}
+
+/**
+ * Queues a record, or drops it if the queue is full.
+ * @param text The record's text.
+ * @param length The length of the text.
+ */
+static void Push(const char *text, std::size_t length)
+{
+	auto &q = Queue();
+	std::size_t pos = q.tail.load(std::memory_order_relaxed);
+	LogSlot *slot;
+	while (true) {
+		slot = &q.slots[pos & (LOG_QUEUE_RECORDS - 1)];
+		auto seq = slot->sequence.load(std::memory_order_acquire);
+		auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+		if (diff == 0) {
+			if (q.tail.compare_exchange_weak(
+			                    pos, pos + 1,
+			                    std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// The drainer hasn't freed this slot yet: full.
+			q.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = q.tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	std::memcpy(slot->text, text, length);
+	slot->length = length;
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+/**
+ * Writes out every record queued so far.
+ * Only the draining thread, or the last LogDrain once it has stopped it,
+ * may call this.
+ * @return Whether there were any records.
+ */
+static bool Drain()
+{
+	auto &q = Queue();
+	bool any = false;
+
+	std::size_t pos = q.head.load(std::memory_order_relaxed);
+	while (true) {
+		LogSlot &slot = q.slots[pos & (LOG_QUEUE_RECORDS - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+			break;
+		}
+
+		WriteRecord(slot.text, slot.length);
+		slot.sequence.store(pos + LOG_QUEUE_RECORDS,
+		                    std::memory_order_release);
+		q.head.store(++pos, std::memory_order_relaxed);
+		any = true;
+	}
+
+	auto dropped = q.dropped.exchange(0, std::memory_order_relaxed);
+	if (0 < dropped) {
+		std::fprintf(stderr, "WARN: %" PRIu64 " log messages dropped\n",
+		             dropped);
+	}
+
+	if (any) {
+		std::fflush(stderr);
+	}
+	return any;
+}
+
+//
+// LogLine
+//
+
+LogLine::LogLine(int level) : length(0)
+{
+	const char *prefix = LEVEL_PREFIXES[std::min(level, LOG_LEVEL_WARN)];
+	Append(prefix, std::strlen(prefix));
+}
+
+void LogLine::Append(const char *s, std::size_t n)
+{
+	n = std::min(n, LOG_TEXT_SIZE - this->length);
+	std::memcpy(this->text + this->length, s, n);
+	this->length += n;
+}
+
+void LogLine::Add(const char *s)
+{
+	Append(" ", 1);
+	Append(s, std::strlen(s));
+}
+
+void LogLine::Add(const std::string &s)
+{
+	Append(" ", 1);
+	Append(s.data(), s.size());
+}
+
+void LogLine::Add(long long i)
+{
+	char buf[32];
+	int n = std::snprintf(buf, sizeof(buf), " %lld", i);
+	Append(buf, static_cast<std::size_t>(n));
+}
+
+void LogLine::Add(unsigned long long i)
+{
+	char buf[32];
+	int n = std::snprintf(buf, sizeof(buf), " %llu", i);
+	Append(buf, static_cast<std::size_t>(n));
+}
+
+void LogLine::Add(double d)
+{
+	char buf[32];
+	int n = std::snprintf(buf, sizeof(buf), " %g", d);
+	Append(buf, std::min(static_cast<std::size_t>(n), sizeof(buf) - 1));
+}
+
+void LogLine::Send()
+{
+	// Counting ourselves in before looking at draining means ~LogDrain
+	// either sees us and waits for the push, or we see it stopping and
+	// write the record ourselves.  Both sides need sequential consistency
+	// for that.
+	auto &q = Queue();
+	q.pushing.fetch_add(1);
+	bool queue = q.draining.load();
+	if (queue) {
+		Push(this->text, this->length);
+	}
+	q.pushing.fetch_sub(1, std::memory_order_release);
+
+	if (!queue) {
+		WriteRecord(this->text, this->length);
+	}
+}
+
+//
+// LogDrain
+//
+
+LogDrain::LogDrain()
+{
+	Queue().draining.store(true, std::memory_order_release);
+	this->drainer = std::thread(&LogDrain::Run, this);
+}
+
+LogDrain::~LogDrain()
+{
+	auto &q = Queue();
+	q.draining.store(false);
+	this->drainer.join();
+
+	// A thread that saw draining just before we cleared it may still be
+	// queueing; wait for it, so its record makes the last Drain.
+	while (0 < q.pushing.load(std::memory_order_acquire)) {
+		std::this_thread::yield();
+	}
+
+	// Anything queued since the drainer last looked is still waiting.
+	Drain();
+}
+
+void LogDrain::Run()
+{
+	while (Queue().draining.load(std::memory_order_acquire)) {
+		if (!Drain()) {
+			std::this_thread::sleep_for(LOG_DRAIN_PERIOD);
+		}
+	}
+}
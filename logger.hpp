@@ -0,0 +1,246 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the logging functions and the LogDrain class.
+ * @see logger.cpp
+ */
+
+#ifndef PS_LOGGER_HPP
+#define PS_LOGGER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+/// Log level of messages useful only when debugging.
+#define LOG_LEVEL_DEBUG 0
+/// Log level of messages about normal operation.
+#define LOG_LEVEL_INFO 1
+/// Log level of messages about something going wrong.
+#define LOG_LEVEL_WARN 2
+/// Log level above every message, turning logging off.
+#define LOG_LEVEL_NONE 3
+
+/// The least level of message compiled in; anything below it is removed at
+/// compile time.  Set this with LOG_LEVEL=n when building.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/// The size of the text of one log record, including its prefix.  Longer
+/// messages are cut short.
+#define LOG_TEXT_SIZE 240
+
+/// The number of log records queued for the LogDrain at most; must be a
+/// power of two.
+#define LOG_QUEUE_RECORDS 1024
+
+/**
+ * A log message being formatted, in a fixed-size buffer.
+ *
+ * Formatting never allocates, so messages can be logged from the play
+ * callback.  Anything past LOG_TEXT_SIZE is dropped.
+ */
+class LogLine {
+public:
+	/**
+	 * Constructs a LogLine.
+	 * @param level The level of the message, eg LOG_LEVEL_DEBUG.
+	 */
+	LogLine(int level);
+
+	/**
+	 * Appends a space, then a string.
+	 * @param s The string.
+	 */
+	void Add(const char *s);
+
+	/**
+	 * Appends a space, then a string.
+	 * @param s The string.
+	 */
+	void Add(const std::string &s);
+
+	/**
+	 * Appends a space, then a signed integer.
+	 * @param i The integer.
+	 */
+	void Add(long long i);
+
+	/**
+	 * Appends a space, then an unsigned integer.
+	 * @param i The integer.
+	 */
+	void Add(unsigned long long i);
+
+	/**
+	 * Appends a space, then a floating-point number.
+	 * @param d The number.
+	 */
+	void Add(double d);
+
+	/**
+	 * Appends a space, then an integer of any type.
+	 * @param i The integer.
+	 */
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value>::type Add(T i)
+	{
+		if (std::is_signed<T>::value) {
+			Add(static_cast<long long>(i));
+		} else {
+			Add(static_cast<unsigned long long>(i));
+		}
+	}
+
+	/**
+	 * Sends the message to the log.
+	 * If a LogDrain is running, this only queues the message, and never
+	 * blocks or allocates; otherwise, it writes it out straight away.
+	 */
+	void Send();
+
+private:
+	std::size_t length;       ///< The length of the text so far.
+	char text[LOG_TEXT_SIZE]; ///< The text.
+
+	/**
+	 * Appends raw characters, as many as will fit.
+	 * @param s The characters.
+	 * @param n The number of characters.
+	 */
+	void Append(const char *s, std::size_t n);
+};
+
+/**
+ * Base case for LogArgs, when there are no arguments.
+ */
+inline void LogArgs(LogLine &)
+{
+}
+
+/**
+ * Adds the arguments of a log message to it, one by one.
+ * This is defined inductively, with LogArgs(LogLine &) being the base case.
+ * @tparam Arg1 The type of the leftmost argument.
+ * @tparam Args Parameter pack of remaining arguments.
+ * @param line The message.
+ * @param arg1 The leftmost argument.
+ * @param args The remaining arguments.
+ */
+template <typename Arg1, typename... Args>
+inline void LogArgs(LogLine &line, Arg1 &arg1, Args &... args)
+{
+	line.Add(arg1);
+	LogArgs(line, args...);
+}
+
+/**
+ * Logs a message at a level that is compiled in.
+ * @tparam Level The level of the message.
+ * @tparam Args Parameter pack of arguments.
+ * @param args The arguments.
+ */
+template <int Level, typename... Args>
+inline void LogAt(std::true_type, Args &... args)
+{
+	LogLine line(Level);
+	LogArgs(line, args...);
+	line.Send();
+}
+
+/**
+ * Logs a message at a level that is compiled out, which does nothing.
+ */
+template <int Level, typename... Args>
+inline void LogAt(std::false_type, Args &...)
+{
+}
+
+/**
+ * Logs a message, if its level is compiled in.
+ * @tparam Level The level of the message.
+ * @tparam Args Parameter pack of arguments.
+ * @param args The arguments, which are logged separated by spaces.
+ */
+template <int Level, typename... Args>
+inline void Log(Args &... args)
+{
+	LogAt<Level>(std::integral_constant<bool, (LOG_LEVEL <= Level)>(),
+	             args...);
+}
+
+/**
+ * Logs a debug message, with a variadic number of arguments.
+ * @tparam Args Parameter pack of arguments.
+ * @param args The arguments.
+ * @see Log
+ */
+template <typename... Args>
+inline void Debug(Args &... args)
+{
+	Log<LOG_LEVEL_DEBUG>(args...);
+}
+
+/**
+ * Logs an informational message, with a variadic number of arguments.
+ * @tparam Args Parameter pack of arguments.
+ * @param args The arguments.
+ * @see Log
+ */
+template <typename... Args>
+inline void Info(Args &... args)
+{
+	Log<LOG_LEVEL_INFO>(args...);
+}
+
+/**
+ * Logs a warning message, with a variadic number of arguments.
+ * @tparam Args Parameter pack of arguments.
+ * @param args The arguments.
+ * @see Log
+ */
+template <typename... Args>
+inline void Warn(Args &... args)
+{
+	Log<LOG_LEVEL_WARN>(args...);
+}
+
+/**
+ * A background thread writing queued log messages out to stderr.
+ *
+ * While a LogDrain exists, log messages go into a bounded lock-free queue,
+ * which the drain empties every LOG_DRAIN_PERIOD; messages that find the
+ * queue full are counted and dropped.  Without one, they are written out
+ * straight away, by whichever thread logs them.  Only one LogDrain may exist
+ * at once.
+ */
+class LogDrain {
+public:
+	/**
+	 * Starts draining log messages.
+	 */
+	LogDrain();
+
+	/**
+	 * Writes out any queued log messages, and stops draining.
+	 */
+	~LogDrain();
+
+	LogDrain(const LogDrain &) = delete;
+	LogDrain &operator=(const LogDrain &) = delete;
+
+private:
+	std::thread drainer; ///< The thread draining the queue.
+
+	/**
+	 * The body of the draining thread.
+	 */
+	void Run();
+};
+
+#endif // PS_LOGGER_HPP
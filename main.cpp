@@ -7,9 +7,14 @@
  * @see main.hpp
  */
 
+#include <algorithm>
 #include <thread>
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 
 #include "cmd.hpp"
 #include "constants.h"
@@ -17,6 +22,9 @@
 #include "messages.h"
 #include "player/player.hpp"
 #include "audio/audio_system.hpp"
+#include "audio/avio_readahead.hpp"
+#include "audio/packet_source.hpp"
+#include "library/library_scanner.hpp"
 #include "main.hpp"
 
 /**
@@ -57,6 +65,198 @@ std::string Playslave::DeviceID()
 	return device;
 }
 
+void Playslave::ParseArguments(int argc, char *argv[])
+{
+	for (int i = 0; i < argc; i++) {
+		std::string arg(argv[i]);
+
+		if (arg.compare(0, 2, "--") != 0) {
+			this->arguments.push_back(arg);
+			continue;
+		}
+
+		auto eq = arg.find('=');
+		if (eq != std::string::npos) {
+			this->options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+		} else if (i + 1 < argc) {
+			this->options[arg.substr(2)] = std::string(argv[++i]);
+		} else {
+			this->options[arg.substr(2)] = std::string();
+		}
+	}
+}
+
+DecoderOptions Playslave::ParseDecoderOptions()
+{
+	DecoderOptions decoder;
+
+	auto readahead = this->options.find("readahead");
+	if (readahead != this->options.end()) {
+		std::istringstream is(readahead->second);
+		is >> decoder.readahead_blocks;
+		if (is.fail()) {
+			throw ConfigError(MSG_READAHEAD_BAD);
+		}
+	}
+
+	auto queue = this->options.find("demux-queue");
+	if (queue != this->options.end()) {
+		std::istringstream is(queue->second);
+		is >> decoder.demux_queue;
+		auto n = decoder.demux_queue;
+		if (is.fail() || (n & (n - 1)) != 0) {
+			throw ConfigError(MSG_DEMUX_QUEUE_BAD);
+		}
+	}
+
+	auto cache = this->options.find("packet-cache");
+	if (cache != this->options.end()) {
+		if (cache->second == "on") {
+			decoder.cache_packets = true;
+		} else if (cache->second != "off") {
+			throw ConfigError(MSG_PACKET_CACHE_BAD);
+		}
+	}
+
+	auto threads = this->options.find("codec-threads");
+	if (threads != this->options.end()) {
+		std::istringstream is(threads->second);
+		is >> decoder.codec_threads;
+		if (is.fail() || decoder.codec_threads < 0) {
+			throw ConfigError(MSG_CODEC_THREADS_BAD);
+		}
+	}
+
+	auto thread_type = this->options.find("codec-thread-type");
+	if (thread_type != this->options.end()) {
+		if (thread_type->second == "frame") {
+			decoder.codec_thread_type = FF_THREAD_FRAME;
+		} else if (thread_type->second == "slice") {
+			decoder.codec_thread_type = FF_THREAD_SLICE;
+		} else if (thread_type->second == "any") {
+			decoder.codec_thread_type =
+			                FF_THREAD_FRAME | FF_THREAD_SLICE;
+		} else {
+			throw ConfigError(MSG_CODEC_THREAD_TYPE_BAD);
+		}
+	}
+
+	return decoder;
+}
+
+void Playslave::ApplyOptions()
+{
+	auto status = this->options.find("status");
+	if (status != this->options.end()) {
+		this->status_page = decltype(this->status_page)(
+		                new StatusPage(status->second));
+		this->player->SetStatusPage(this->status_page.get());
+	}
+
+	this->audio.SetDecoderOptions(ParseDecoderOptions());
+
+	auto dead_air = this->options.find("dead-air");
+	if (dead_air != this->options.end()) {
+		try
+		{
+			auto &period = dead_air->second;
+			this->player->SetDeadAirPeriod(
+			                this->time_parser->Parse(period));
+		}
+		catch (std::out_of_range)
+		{
+			throw ConfigError(MSG_DEAD_AIR_BAD);
+		}
+	}
+
+	auto index = this->options.find("index");
+	if (index != this->options.end()) {
+		this->library_index = decltype(this->library_index)(
+		                new LibraryIndex(index->second));
+	}
+
+	StartAnalyser();
+
+	auto cue = this->options.find("auto-cue");
+	if (cue != this->options.end()) {
+		if (cue->second != "on" && cue->second != "off") {
+			throw ConfigError(MSG_AUTO_CUE_BAD);
+		}
+		// Auto-cue works from the analysis, so needs an analyser.
+		if (cue->second == "on" && this->analyser == nullptr) {
+			throw ConfigError(MSG_AUTO_CUE_NO_ANALYSER);
+		}
+		this->player->SetAutoCue(cue->second == "on");
+	}
+
+	auto unix_path = this->options.find("unix");
+	auto tcp_port = this->options.find("tcp");
+	if (unix_path != this->options.end() ||
+	    tcp_port != this->options.end()) {
+		this->server = decltype(this->server)(
+		                new Server(*this->handler));
+		if (unix_path != this->options.end()) {
+			this->server->ListenUnix(unix_path->second);
+		}
+		if (tcp_port != this->options.end()) {
+			this->server->ListenTcp(tcp_port->second);
+		}
+		SetBroadcastSink(this->server.get());
+	}
+}
+
+void Playslave::StartAnalyser()
+{
+	auto dir = this->options.find("analysis-cache");
+	if (dir == this->options.end()) {
+		return;
+	}
+
+	std::size_t threads = Analyser::DefaultThreads();
+	auto opt = this->options.find("analysis-threads");
+	if (opt != this->options.end()) {
+		std::istringstream is(opt->second);
+		is >> threads;
+		if (is.fail() || threads == 0) {
+			throw ConfigError(MSG_ANALYSIS_THREADS_BAD);
+		}
+	}
+
+	this->analysis_cache = decltype(this->analysis_cache)(
+	                new AnalysisCache(dir->second));
+	this->analyser = decltype(this->analyser)(new Analyser(
+	                *this->analysis_cache, ParseDecoderOptions(), threads));
+	this->player->SetAnalyser(this->analyser.get());
+}
+
+/**
+ * Formats a set of xrun statistics.
+ * @param x The statistics.
+ * @return The ring underrun, partial fill, device underflow and device
+ *   overflow counts, the minimum ring fill in samples, and the time in
+ *   microseconds since the last ring underrun, partial fill and device
+ *   underflow (or -1 for never), separated by spaces.
+ */
+static std::string XrunString(const XrunStats &x)
+{
+	auto now = XrunStats::Clock::now();
+	auto ago = [now](XrunStats::Clock::time_point t) -> std::int64_t {
+		if (t == XrunStats::Clock::time_point()) {
+			return -1;
+		}
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+		                       now - t)
+		                .count();
+	};
+
+	std::ostringstream os;
+	os << x.ring_underruns << " " << x.partial_fills << " "
+	   << x.device_underflows << " " << x.device_overflows << " "
+	   << x.min_ring_fill << " " << ago(x.last_ring_underrun) << " "
+	   << ago(x.last_partial_fill) << " " << ago(x.last_device_underflow);
+	return os.str();
+}
+
 void Playslave::RegisterListeners()
 {
 	this->player->SetPositionListenerPeriod(POSITION_PERIOD);
@@ -65,6 +265,38 @@ void Playslave::RegisterListeners()
 		std::uint64_t p = position.count();
 		Respond(Response::TIME, p);
 	});
+	this->player->RegisterLevelListener([](const Levels &levels) {
+		std::ostringstream os;
+		os.precision(1);
+		os << std::fixed;
+
+		auto db = [](float level) {
+			return std::max(20.0 * std::log10(level), METER_FLOOR_DB);
+		};
+		for (std::uint8_t c = 0; c < levels.channels; c++) {
+			if (c != 0) {
+				os << " ";
+			}
+			os << db(levels.peak[c]) << " " << db(levels.rms[c]);
+		}
+
+		std::string s = os.str();
+		Respond(Response::LEVL, s);
+	});
+	this->player->RegisterEndingListener([] { Respond(Response::ENDG); });
+	this->player->RegisterDeadAirListener([](
+	                std::chrono::microseconds length) {
+		std::uint64_t l = length.count();
+		Respond(Response::DEAD, l);
+	});
+	this->player->RegisterXrunListener([](const XrunStats &x) {
+		std::string s = XrunString(x);
+		Respond(Response::XRUN, s);
+	});
+	this->player->RegisterCueListener([](std::chrono::nanoseconds offset) {
+		std::int64_t o = offset.count();
+		Respond(Response::CUED, o);
+	});
 	this->player->RegisterStateListener([](Player::State old_state,
 	                                       Player::State new_state) {
 		Respond(Response::STAT, Player::StateString(old_state),
@@ -72,6 +304,293 @@ void Playslave::RegisterListeners()
 	});
 }
 
+bool Playslave::Tick(const std::string &time_str)
+{
+	auto sink = this->handler->Requester();
+	auto key = sink.lock().get();
+
+	return this->player->SubscribePosition(time_str, key, [sink](
+	                std::chrono::microseconds position) {
+		auto s = sink.lock();
+		if (s == nullptr) {
+			return false;
+		}
+
+		std::uint64_t p = position.count();
+		s->Respond(Response::TIME, p);
+		return true;
+	});
+}
+
+bool Playslave::ReportHistogram(const std::string &name)
+{
+	auto found = this->histograms.find(name);
+	if (found == this->histograms.end()) {
+		return false;
+	}
+
+	const LatencyHistogram &h = *found->second;
+	auto us = [](LatencyHistogram::Unit t) -> std::uint64_t {
+		return std::chrono::duration_cast<std::chrono::microseconds>(t)
+		                .count();
+	};
+
+	this->handler->Respond(Response::HIST, name, h.Count(),
+	                       us(h.Percentile(0.5)), us(h.Percentile(0.9)),
+	                       us(h.Percentile(0.99)), us(h.Max()));
+	return true;
+}
+
+bool Playslave::ReportXruns()
+{
+	XrunStats x;
+	if (!this->player->Xruns(x)) {
+		return false;
+	}
+	this->handler->Respond(Response::XRUN, XrunString(x));
+	return true;
+}
+
+bool Playslave::ReportCallbackPerf(const std::string &fraction_str)
+{
+	double fraction;
+	std::istringstream is(fraction_str);
+	is >> fraction;
+	if (is.fail() || !(0.0 < fraction)) {
+		return false;
+	}
+
+	const LatencyHistogram &time = AudioOutput::CallbackTime();
+	const LatencyHistogram &load = AudioOutput::CallbackLoad();
+	auto us = [](LatencyHistogram::Unit t) -> std::uint64_t {
+		return std::chrono::duration_cast<std::chrono::microseconds>(t)
+		                .count();
+	};
+
+	// Load is recorded in billionths of the deadline.
+	using Unit = LatencyHistogram::Unit;
+	Unit over(static_cast<Unit::rep>(fraction * 1e9));
+	this->handler->Respond(Response::PERF, time.Count(),
+	                       us(time.Percentile(0.5)),
+	                       us(time.Percentile(0.99)), us(time.Max()),
+	                       load.CountAbove(over));
+	return true;
+}
+
+bool Playslave::ReportStages()
+{
+	if (!STAGE_TIMING) {
+		return false;
+	}
+
+	for (std::size_t s = 0; s < STAGE_COUNT; s++) {
+		auto stage = static_cast<Stage>(s);
+		StageTotals t = StageTotalsFor(stage);
+		std::uint64_t us = std::chrono::duration_cast<
+		                           std::chrono::microseconds>(t.time)
+		                           .count();
+		this->handler->Respond(Response::STGE, StageName(stage),
+		                       t.calls, us, t.bytes);
+	}
+	return true;
+}
+
+bool Playslave::StartTrace(const std::string &path,
+                           const std::string &time_str)
+{
+	if (!STAGE_TIMING || this->trace != nullptr) {
+		return false;
+	}
+
+	std::chrono::microseconds length;
+	try
+	{
+		length = this->time_parser->Parse(time_str);
+	}
+	catch (std::out_of_range)
+	{
+		return false;
+	}
+
+	this->trace = decltype(this->trace)(
+	                new StageTrace(STAGE_TRACE_EVENTS));
+	this->trace_path = path;
+	this->trace_end = std::chrono::steady_clock::now() + length;
+	this->trace_reply = decltype(this->trace_reply)(
+	                new CommandHandler::Completion(this->handler->Defer()));
+	return true;
+}
+
+void Playslave::UpdateTrace()
+{
+	if (this->trace == nullptr ||
+	    std::chrono::steady_clock::now() < this->trace_end) {
+		return;
+	}
+
+	this->trace->Stop();
+	auto dropped = this->trace->Dropped();
+	Debug("stage trace done,", dropped, "runs dropped");
+
+	try
+	{
+		this->trace->Write(this->trace_path);
+		this->trace_reply->Succeed();
+	}
+	catch (Error &error)
+	{
+		this->trace_reply->Fail(error.Message());
+	}
+
+	this->trace = nullptr;
+	this->trace_reply = nullptr;
+}
+
+bool Playslave::ReportFileInfo(const std::string &path)
+{
+	FileInfo info;
+	if (this->library_index == nullptr ||
+	    !this->library_index->Find(path, info)) {
+		return false;
+	}
+
+	std::uint64_t duration = info.duration.count();
+	this->handler->Respond(Response::INFO, duration, info.sample_rate,
+	                       info.channels, info.format, info.codec,
+	                       info.bit_rate);
+	for (const auto &tag : info.tags) {
+		this->handler->Respond(Response::ITAG, tag.first, tag.second);
+	}
+	return true;
+}
+
+bool Playslave::QueueAnalysis(const std::string &path)
+{
+	if (this->analyser == nullptr) {
+		return false;
+	}
+	this->analyser->Queue(path);
+	return true;
+}
+
+bool Playslave::ReportLoudness(const std::string &path)
+{
+	Analysis analysis;
+	if (this->analyser == nullptr ||
+	    !this->analyser->Lookup(path, analysis)) {
+		return false;
+	}
+
+	std::uint64_t start = analysis.audio_start.count();
+	std::uint64_t end = analysis.audio_end.count();
+	this->handler->Respond(Response::LOUD, analysis.loudness,
+	                       analysis.true_peak, start, end);
+	return true;
+}
+
+/**
+ * Formats one point of a waveform overview.
+ * @param point The point's WavePoints, one per channel.
+ * @param channels The number of channels.
+ * @return The minimum, maximum and RMS of each channel in turn, separated
+ *   by spaces.
+ */
+static std::string WavePointString(const WavePoint *point,
+                                   std::uint8_t channels)
+{
+	std::ostringstream os;
+	for (std::uint8_t c = 0; c < channels; c++) {
+		if (c != 0) {
+			os << " ";
+		}
+		os << point[c].min << " " << point[c].max << " " << point[c].rms;
+	}
+	return os.str();
+}
+
+bool Playslave::ReportWaveform(const std::string &path,
+                               const std::string &level_str)
+{
+	std::size_t level;
+	std::istringstream is(level_str);
+	is >> level;
+	if (is.fail() || this->analysis_cache == nullptr) {
+		return false;
+	}
+
+	auto waveform = this->analysis_cache->LoadWaveform(path);
+	if (waveform == nullptr) {
+		auto watch = this->analyser->Watch(path, level);
+		this->wave_watchers[watch] = this->handler->Requester();
+		return true;
+	}
+	if (waveform->Levels() <= level) {
+		return false;
+	}
+
+	const WavePoint *points = waveform->Level(level);
+	std::size_t count = waveform->Points(level);
+	std::uint8_t channels = waveform->Channels();
+	for (std::size_t i = 0; i < count; i++) {
+		this->handler->Respond(
+		                Response::WAVE, level, i,
+		                WavePointString(points + i * channels,
+		                                channels));
+	}
+	return true;
+}
+
+void Playslave::ReportWaveProgress()
+{
+	if (this->analyser == nullptr) {
+		return;
+	}
+
+	this->wave_progress.clear();
+	this->analyser->TakeProgress(this->wave_progress);
+	for (const auto &p : this->wave_progress) {
+		auto watcher = this->wave_watchers.find(p.watch);
+		if (watcher == this->wave_watchers.end()) {
+			continue;
+		}
+
+		// Clients that have gone away stop getting points.
+		auto sink = watcher->second.lock();
+		if (p.done) {
+			this->wave_watchers.erase(watcher);
+		}
+		if (sink == nullptr) {
+			continue;
+		}
+
+		// A failed analysis ends with no points, and no channels.
+		std::size_t count = 0;
+		if (p.channels != 0) {
+			count = p.points.size() / p.channels;
+		}
+		for (std::size_t i = 0; i < count; i++) {
+			sink->Respond(Response::WAVP, p.path, p.level,
+			              p.first + i,
+			              WavePointString(&p.points[i * p.channels],
+			                              p.channels));
+		}
+		if (p.done) {
+			sink->Respond(Response::WEND, p.path, p.level);
+		}
+	}
+}
+
+bool Playslave::ReportQueueDepths()
+{
+	auto report = [this](const std::string &stage, const QueueDepth &d) {
+		this->handler->Respond(Response::PIPE, stage, d.Count(),
+		                       d.Mean(), d.Max());
+	};
+	report("demux", DemuxStage::DemuxDepth());
+	report("decode", DemuxStage::DecodeDepth());
+	return true;
+}
+
 /**
  * Performs the playslave main loop.
  * This involves listening for commands and asking the player to do some work.
@@ -87,18 +606,31 @@ void Playslave::MainLoop()
 		 * intensive and thus impairs the command checking latency.
 		 * Do this if it doesn't make the code too complex.
 		 */
-		this->handler->Check();
+		if (this->server != nullptr) {
+			this->server->Poll(0);
+		} else {
+			this->handler->Check();
+		}
 		this->player->Update();
+		ReportWaveProgress();
+		UpdateTrace();
 
-		std::this_thread::sleep_for(LOOP_PERIOD);
+		// Write out everything this cycle produced in one go.
+		BroadcastSink().Flush();
+
+		// Wake early if a position announcement is due before the
+		// next cycle would start.
+		using Clock = PlayerPosition::Clock;
+		auto cycle = std::chrono::time_point_cast<Clock::duration>(
+		                Clock::now() + LOOP_PERIOD);
+		std::this_thread::sleep_until(
+		                std::min(cycle, this->player->NextDeadline()));
 	}
 }
 
 Playslave::Playslave(int argc, char *argv[]) : audio{}
 {
-	for (int i = 0; i < argc; i++) {
-		this->arguments.push_back(std::string(argv[i]));
-	}
+	ParseArguments(argc, argv);
 
 	this->time_parser = decltype(
 	                this->time_parser) {new Player::TP{Player::TP::UnitMap{
@@ -127,13 +659,86 @@ Playslave::Playslave(int argc, char *argv[]) : audio{}
 
 	using std::string;
 
-	h->Add("play", [&]() { return this->player->Play(); });
+	h->Add("play", [this, h]() {
+		if (this->player->CurrentState() != Player::State::LOADING) {
+			return this->player->Play();
+		}
+
+		// A 'load' earlier in this batch is still going: play once it
+		// finishes, and reply then.
+		auto reply = h->Defer();
+		return this->player->AfterLoad([this, reply](bool ok,
+		                                             const string &m) {
+			if (!ok) {
+				reply.Fail(m);
+			} else if (this->player->Play()) {
+				reply.Succeed();
+			} else {
+				reply.Fail(MSG_CMD_INVALID);
+			}
+		});
+	});
+	h->Add("play", [&](const string &at, const string &time) {
+		return at == "at" && this->player->PlayAt(time);
+	});
 	h->Add("stop", [&]() { return this->player->Stop(); });
 	h->Add("ejct", [&]() { return this->player->Eject(); });
 	h->Add("quit", [&]() { return this->player->Quit(); });
 
-	h->Add("load", [&](const string &s) { return this->player->Load(s); });
+	h->Add("load", [this, h](const string &s) {
+		// Reply once the load finishes, rather than now.
+		auto reply = h->Defer();
+		return this->player->Load(s, [reply](bool ok, const string &m) {
+			if (ok) {
+				reply.Succeed();
+			} else {
+				reply.Fail(m);
+			}
+		});
+	});
 	h->Add("seek", [&](const string &s) { return this->player->Seek(s); });
+	h->Add("gain", [&](const string &s) {
+		return this->player->SetGain(s);
+	});
+	h->Add("levl", [&](const string &s) {
+		return this->player->SetLevelPeriod(s);
+	});
+	h->Add("tick", [&](const string &s) { return this->Tick(s); });
+	h->Add("hist", [&](const string &s) {
+		return this->ReportHistogram(s);
+	});
+	h->Add("pipe", [&]() { return this->ReportQueueDepths(); });
+	h->Add("xrun", [&]() { return this->ReportXruns(); });
+	h->Add("perf", [&](const string &s) {
+		return this->ReportCallbackPerf(s);
+	});
+	h->Add("stge", [&]() { return this->ReportStages(); });
+	h->Add("trce", [&](const string &path, const string &time) {
+		return this->StartTrace(path, time);
+	});
+	h->Add("info", [&](const string &s) {
+		return this->ReportFileInfo(s);
+	});
+	h->Add("anlz", [&](const string &s) {
+		return this->QueueAnalysis(s);
+	});
+	h->Add("loud", [&](const string &s) {
+		return this->ReportLoudness(s);
+	});
+	h->Add("wave", [&](const string &path, const string &level) {
+		return this->ReportWaveform(path, level);
+	});
+
+	this->histograms["read"] = &ReadAheadAvioReader::ReadLatency();
+	this->histograms["stall"] = &ReadAheadAvioReader::StallLatency();
+	this->histograms["demux"] = &DemuxStage::DemuxWait();
+	this->histograms["decode"] = &DemuxStage::DecodeWait();
+	this->histograms["frame-single"] = &AudioDecoder::FrameLatency(0);
+	this->histograms["frame-frame"] =
+	                &AudioDecoder::FrameLatency(FF_THREAD_FRAME);
+	this->histograms["frame-slice"] =
+	                &AudioDecoder::FrameLatency(FF_THREAD_SLICE);
+	this->histograms["callback"] = &AudioOutput::CallbackTime();
 
 	this->handler = decltype(this->handler) {h};
 }
@@ -144,21 +749,59 @@ int Playslave::Run()
 
 	try
 	{
+		auto scan = this->options.find("scan");
+		if (scan != this->options.end()) {
+			return Scan(scan->second);
+		}
+
 		// Don't roll this into the constructor: it'll go out of scope!
 		this->audio.SetDeviceID(DeviceID());
 
+		ApplyOptions();
 		RegisterListeners();
 
 		Respond(Response::OHAI, MSG_OHAI);
+		BroadcastSink().Flush();
 		MainLoop();
 		Respond(Response::TTFN, MSG_TTFN);
 	}
 	catch (Error &error)
 	{
 		error.ToResponse();
-		Debug("Unhandled exception caught, going away now.");
+		Warn("Unhandled exception caught, going away now.");
 		exit_code = EXIT_FAILURE;
 	}
 
+	BroadcastSink().Flush();
+
 	return exit_code;
 }
+
+int Playslave::Scan(const std::string &root)
+{
+	auto index = this->options.find("index");
+	if (index == this->options.end()) {
+		throw ConfigError(MSG_SCAN_NO_INDEX);
+	}
+
+	// Probing is as much waiting for storage as it is decoding, so use
+	// more threads than cores.
+	std::size_t threads = std::max(1u, std::thread::hardware_concurrency()) *
+	                      SCAN_THREADS_PER_CORE;
+	auto opt = this->options.find("scan-threads");
+	if (opt != this->options.end()) {
+		std::istringstream is(opt->second);
+		is >> threads;
+		if (is.fail() || threads == 0) {
+			throw ConfigError(MSG_SCAN_THREADS_BAD);
+		}
+	}
+
+	LibraryScanner scanner(ParseDecoderOptions(), threads);
+	auto entries = scanner.Scan(root);
+	WriteLibraryIndex(index->second, entries);
+
+	std::cout << "indexed " << entries.size() << " files, "
+	          << scanner.Failures() << " failed" << std::endl;
+	return EXIT_SUCCESS;
+}
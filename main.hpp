@@ -10,10 +10,22 @@
 #ifndef PS_MAIN_HPP
 #define PS_MAIN_HPP
 
-#include "audio/audio_system.hpp" // AudioSystem
-#include "cmd.hpp"                // CommandHandler
-#include "player/player.hpp"      // Player
-#include "time_parser.hpp"        // TimeParser
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "analysis/analyser.hpp"       // Analyser
+#include "analysis/analysis_cache.hpp" // AnalysisCache
+#include "audio/audio_system.hpp"      // AudioSystem
+#include "cmd.hpp"                     // CommandHandler
+#include "latency_histogram.hpp"       // LatencyHistogram
+#include "library/library_index.hpp"   // LibraryIndex
+#include "logger.hpp"                  // LogDrain
+#include "player/player.hpp"           // Player
+#include "server.hpp"                  // Server
+#include "stage_timer.hpp"             // StageTrace
+#include "status_page.hpp"             // StatusPage
+#include "time_parser.hpp"             // TimeParser
 
 /**
  * The Playslave++ application.
@@ -40,13 +52,82 @@ public:
 	int Run();
 
 private:
-	std::vector<std::string> arguments; ///< The argument vector.
+	/// Writes out log messages; this comes first, so that it outlives
+	/// everything that might log.
+	LogDrain log_drain;
+
+	std::vector<std::string> arguments; ///< The non-option arguments.
+	std::map<std::string, std::string> options; ///< The --options.
 	AudioSystem audio;                  ///< The audio subsystem.
 
+	std::unique_ptr<StatusPage> status_page; ///< The status page, if any.
+	std::unique_ptr<Server> server; ///< The socket server, if any.
+
 	std::unique_ptr<Player> player;          ///< The player subsystem.
 	std::unique_ptr<CommandHandler> handler; ///< The command handler.
 	std::unique_ptr<Player::TP> time_parser; ///< The seek time parser.
 
+	/// The library index, if any.
+	std::unique_ptr<LibraryIndex> library_index;
+
+	/// The loudness analysis cache, if any.
+	std::unique_ptr<AnalysisCache> analysis_cache;
+
+	/// The background loudness analyser, if any.  This uses the cache, so
+	/// must be destroyed before it.
+	std::unique_ptr<Analyser> analyser;
+
+	/// Scratch space for ReportWaveProgress.
+	std::vector<WaveProgress> wave_progress;
+
+	/// The client waiting on each of the Analyser's waveform watches.
+	std::map<std::uint64_t, std::weak_ptr<ResponseSink>> wave_watchers;
+
+	/// The latency histograms that can be queried, by name.
+	std::map<std::string, const LatencyHistogram *> histograms;
+
+	/// The stage trace being captured, if any.
+	std::unique_ptr<StageTrace> trace;
+	std::string trace_path; ///< Where to write the trace.
+	std::chrono::steady_clock::time_point trace_end; ///< When to stop.
+
+	/// The reply to the command that started the trace.
+	std::unique_ptr<CommandHandler::Completion> trace_reply;
+
+	/**
+	 * Splits the program arguments into options and other arguments.
+	 * Options take the form "--name value" or "--name=value"; a trailing
+	 * "--name" has an empty value.
+	 * @param argc The program argument count (from main()).
+	 * @param argv The program argument vector (from main()).
+	 */
+	void ParseArguments(int argc, char *argv[]);
+
+	/**
+	 * Reads the decoder settings from the options.
+	 * @return The DecoderOptions.
+	 */
+	DecoderOptions ParseDecoderOptions();
+
+	/**
+	 * Sets up the optional features requested by the options.
+	 */
+	void ApplyOptions();
+
+	/**
+	 * Starts the background loudness analyser, if --analysis-cache is
+	 * given, and sets up what uses it.
+	 */
+	void StartAnalyser();
+
+	/**
+	 * Scans a media directory into the library index given by --index,
+	 * instead of playing.
+	 * @param root The directory to scan.
+	 * @return The exit code.
+	 */
+	int Scan(const std::string &root);
+
 	/**
 	 * Tries to get the output device ID from stdin.
 	 * If there is no stdin, the program lists the available devices and
@@ -75,6 +156,105 @@ private:
 	 * This is so time and state changes can be sent out on stdout.
 	 */
 	void RegisterListeners();
+
+	/**
+	 * Subscribes the sender of the current command to position
+	 * announcements at a period of its own, until it goes away.
+	 * @param time_str The period, as a time string; zero unsubscribes.
+	 * @return Whether the period is valid.
+	 */
+	bool Tick(const std::string &time_str);
+
+	/**
+	 * Sends a summary of a latency histogram to the sender of the
+	 * current command.
+	 * @param name  The name of the histogram.
+	 * @return      Whether the histogram exists.
+	 */
+	bool ReportHistogram(const std::string &name);
+
+	/**
+	 * Sends the demux queue depth statistics of both pipeline stages to
+	 * the sender of the current command.
+	 * @return Always true.
+	 */
+	bool ReportQueueDepths();
+
+	/**
+	 * Sends the xrun statistics of the loaded song's output to the sender
+	 * of the current command.
+	 * @return Whether a song is loaded.
+	 */
+	bool ReportXruns();
+
+	/**
+	 * Sends the play callback timing statistics to the sender of the
+	 * current command.
+	 * @param fraction_str The fraction of the deadline past which a
+	 *   callback counts as close to missing it, as a string.
+	 * @return Whether the fraction is valid.
+	 */
+	bool ReportCallbackPerf(const std::string &fraction_str);
+
+	/**
+	 * Sends the time spent in each pipeline stage to the sender of the
+	 * current command.
+	 * @return Whether stage timing is compiled in.
+	 */
+	bool ReportStages();
+
+	/**
+	 * Starts capturing a stage trace, to be written when it finishes.
+	 * The reply to the current command is deferred until then.
+	 * @param path The path of the file to write the trace to.
+	 * @param time_str How long to capture for, as a time string.
+	 * @return Whether the capture started.
+	 */
+	bool StartTrace(const std::string &path, const std::string &time_str);
+
+	/**
+	 * Finishes the stage trace being captured, if it is due.
+	 */
+	void UpdateTrace();
+
+	/**
+	 * Sends what the library index knows about a file to the sender of
+	 * the current command.
+	 * @param path The path of the file.
+	 * @return Whether the file is in the index.
+	 */
+	bool ReportFileInfo(const std::string &path);
+
+	/**
+	 * Queues a file for loudness analysis.
+	 * @param path The path of the file.
+	 * @return Whether there is an analyser to queue it on.
+	 */
+	bool QueueAnalysis(const std::string &path);
+
+	/**
+	 * Sends the stored loudness analysis of a file to the sender of the
+	 * current command.
+	 * @param path The path of the file.
+	 * @return Whether the file has an up-to-date analysis.
+	 */
+	bool ReportLoudness(const std::string &path);
+
+	/**
+	 * Sends one level of a file's waveform overview to the sender of the
+	 * current command, or, if the file has no overview yet, starts
+	 * computing one and streaming it to the sender as it goes.
+	 * @param path The path of the file.
+	 * @param level The level, as a string.
+	 * @return Whether the level was sent or the streaming started.
+	 */
+	bool ReportWaveform(const std::string &path, const std::string &level);
+
+	/**
+	 * Sends the waveform points computed since the last cycle to the
+	 * clients waiting on them.
+	 */
+	void ReportWaveProgress();
 };
 
 #endif // PS_MAIN_HPP
@@ -15,6 +15,12 @@
 /// Message shown when the CommandHandler receives an invalid command.
 const std::string MSG_CMD_INVALID = "Bad command or file name";
 
+/// Message shown for a command skipped because another in its line failed.
+const std::string MSG_CMD_SKIPPED = "Skipped due to another command";
+
+/// Message shown when too many commands are registered.
+const std::string MSG_CMD_TABLE_FULL = "Command table full";
+
 /// Message shown when the AudioDecoder fails to decode a file.
 const std::string MSG_DECODE_FAIL = "Decoding failure";
 
@@ -30,6 +36,68 @@ const std::string MSG_DECODE_NOCODEC = "Couldn't acquire codec";
 /// Message shown when a bad sample rate is found.
 const std::string MSG_DECODE_BADRATE = "Unsupported or invalid sample rate";
 
+/// Message shown when the --readahead option isn't a number.
+const std::string MSG_READAHEAD_BAD = "--readahead needs a number of blocks";
+
+/// Message shown when the --demux-queue option isn't a power of two.
+const std::string MSG_DEMUX_QUEUE_BAD =
+                "--demux-queue needs a power of two number of packets, or 0";
+
+/// Message shown when the --packet-cache option isn't on or off.
+const std::string MSG_PACKET_CACHE_BAD = "--packet-cache must be on or off";
+
+/// Message shown when --scan is given without --index.
+const std::string MSG_SCAN_NO_INDEX = "--scan needs --index FILE to write to";
+
+/// Message shown when the --scan-threads option isn't a number.
+const std::string MSG_SCAN_THREADS_BAD = "--scan-threads needs a number";
+
+/// Message shown when the library index can't be read or is corrupt.
+const std::string MSG_INDEX_BAD = "Couldn't read the library index";
+
+/// Message shown when the library index can't be written.
+const std::string MSG_INDEX_WRITE_FAIL = "Couldn't write the library index";
+
+/// Message shown when a library has too many files or tags to index.
+const std::string MSG_INDEX_TOO_BIG = "The library is too big to index";
+
+/// Message shown when the --analysis-threads option isn't a number.
+const std::string MSG_ANALYSIS_THREADS_BAD =
+                "--analysis-threads needs a number";
+
+/// Message shown when an analysis can't be written to the cache.
+const std::string MSG_ANALYSIS_WRITE_FAIL = "Couldn't write an analysis";
+
+/// Message shown when the --auto-cue option isn't on or off.
+const std::string MSG_AUTO_CUE_BAD = "--auto-cue must be on or off";
+
+/// Message shown when --auto-cue is on without --analysis-cache.
+const std::string MSG_AUTO_CUE_NO_ANALYSER =
+                "--auto-cue needs --analysis-cache";
+
+/// Message shown when the --dead-air option isn't a time.
+const std::string MSG_DEAD_AIR_BAD = "--dead-air needs a time, or 0";
+
+/// Message shown when a stage trace can't be written.
+const std::string MSG_TRACE_WRITE_FAIL = "Couldn't write a stage trace";
+
+/// Message shown when a waveform overview can't be read or is corrupt.
+const std::string MSG_WAVEFORM_BAD = "Couldn't read a waveform overview";
+
+/// Message shown when the --codec-threads option isn't a number.
+const std::string MSG_CODEC_THREADS_BAD =
+                "--codec-threads needs a number of threads, or 0 for auto";
+
+/// Message shown when the --codec-thread-type option isn't known.
+const std::string MSG_CODEC_THREAD_TYPE_BAD =
+                "--codec-thread-type must be frame, slice or any";
+
+/// Message shown when a load is cancelled by another command.
+const std::string MSG_LOAD_CANCELLED = "Load cancelled";
+
+/// Message shown when a load fails for a reason Playslave didn't expect.
+const std::string MSG_LOAD_FAIL = "Couldn't load file";
+
 /// Message shown when an attempt to seek fails.
 const std::string MSG_SEEK_FAIL = "Seek failed";
 
@@ -45,6 +113,21 @@ const std::string MSG_OUTPUT_RINGWRITE = "Ring buffer write error";
 /// Message shown when there is an error initialising the ring buffer.
 const std::string MSG_OUTPUT_RINGINIT = "Ring buffer init error";
 
+/// Message shown when the status page can't be created.
+const std::string MSG_STATUS_OPEN = "Couldn't create status page";
+
+/// Message shown when the status page isn't supported on this platform.
+const std::string MSG_STATUS_UNSUPPORTED = "Status page not supported here";
+
+/// Message shown when a server socket can't be created.
+const std::string MSG_SERVER_SOCKET = "Couldn't create socket";
+
+/// Message shown when a server socket can't be bound or listened on.
+const std::string MSG_SERVER_BIND = "Couldn't listen on socket";
+
+/// Message shown when the socket server isn't supported on this platform.
+const std::string MSG_SERVER_UNSUPPORTED = "Socket server not supported here";
+
 /// Message shown when a client connects to Playslave.
 const std::string MSG_OHAI = "URY playslave at your service";
 
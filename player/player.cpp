@@ -9,14 +9,22 @@
  * @see player/player_state.cpp
  */
 
+#include <algorithm>
 #include <stdexcept>
+#include <sstream>
 #include <string>
 #include <cassert>
+#include <cmath>
+#include <ctime>
 
 #include "player.hpp"
+#include "../analysis/analyser.hpp"
 #include "../audio/audio_output.hpp"
 #include "../audio/audio_system.hpp"
+#include "../constants.h"
 #include "../errors.hpp"
+#include "../messages.h"
+#include "../status_page.hpp"
 
 /// List of states in which some audio is loaded.
 const Player::StateList Player::AUDIO_LOADED_STATES = {State::PLAYING,
@@ -27,15 +35,37 @@ Player::Player(const AudioSystem &audio_system, const Player::TP &time_parser)
 {
 	this->current_state = State::EJECTED;
 	this->audio = nullptr;
+	this->gain = 1.0f;
+	this->normalisation = 1.0f;
+	this->analyser = nullptr;
+	this->auto_cue = false;
+	this->audio_end = decltype(this->audio_end)(0);
+	this->ending_sent = false;
+	this->dead_air_period = DEAD_AIR_PERIOD;
+	this->dead_air_alarms = 0;
+	this->xruns_sent = XrunStats();
+	this->status_page = nullptr;
+	this->file_id = 0;
+	this->level_period = decltype(this->level_period)(0);
 }
 
 void Player::Update()
 {
+	if (this->current_state == State::LOADING) {
+		UpdateLoad();
+	}
+	ReapLoaders();
+
 	if (this->current_state == State::PLAYING) {
 		if (this->audio->IsStopped()) {
 			Eject();
 		} else {
 			UpdatePosition();
+			UpdateLevels();
+			UpdateEnding();
+			UpdateDeadAir();
+			UpdateXruns();
+			UpdateCue();
 		}
 	}
 	if (CurrentStateIn(AUDIO_LOADED_STATES)) {
@@ -43,9 +73,270 @@ void Player::Update()
 	}
 }
 
-void Player::OpenFile(const std::string &path)
+void Player::UpdateLoad()
+{
+	assert(this->loader != nullptr);
+	if (!this->loader->IsDone()) {
+		return;
+	}
+
+	// Take the loader and callback first, so that a callback that starts
+	// another load doesn't clobber them.
+	auto loader = std::move(this->loader);
+	auto done = std::move(this->load_callback);
+	this->load_callback = nullptr;
+
+	bool success = true;
+	std::string message;
+
+	try
+	{
+		OpenOutput(loader->Take(), loader->Path());
+		ResetPosition();
+		Debug("Loaded ", loader->Path());
+		SetState(State::STOPPED);
+	}
+	catch (Error &error)
+	{
+		success = false;
+		message = error.Message();
+	}
+	catch (std::exception &error)
+	{
+		success = false;
+		message = error.what();
+	}
+	catch (...)
+	{
+		success = false;
+		message = MSG_LOAD_FAIL;
+	}
+
+	if (!success) {
+		this->audio = nullptr;
+		SetState(State::EJECTED);
+	}
+
+	if (done != nullptr) {
+		done(success, message);
+	}
+}
+
+void Player::CancelLoad()
+{
+	if (this->loader == nullptr) {
+		return;
+	}
+
+	this->loader->Cancel();
+	this->cancelled_loaders.push_back(std::move(this->loader));
+
+	auto done = std::move(this->load_callback);
+	this->load_callback = nullptr;
+	if (done != nullptr) {
+		done(false, MSG_LOAD_CANCELLED);
+	}
+}
+
+void Player::ReapLoaders()
+{
+	auto finished = [](const std::unique_ptr<AudioLoader> &l) {
+		return l->IsDone();
+	};
+
+	auto &ls = this->cancelled_loaders;
+	ls.erase(std::remove_if(ls.begin(), ls.end(), finished), ls.end());
+}
+
+void Player::OpenOutput(AudioOutput *output, const std::string &path)
+{
+	this->audio = decltype(this->audio)(output);
+	ApplyAnalysis(path);
+	this->audio->SetGain(this->gain * this->normalisation);
+	this->audio->SetDeadAirThreshold(this->dead_air_period);
+	this->dead_air_alarms = 0;
+	this->xruns_sent = XrunStats();
+
+	if (this->status_page != nullptr) {
+		this->file_id++;
+		this->audio->SetStatusPage(this->status_page, this->file_id);
+		this->status_page->UpdateFile(
+		                this->file_id, path,
+		                static_cast<std::uint32_t>(
+		                                this->audio->SampleRate()));
+	}
+}
+
+void Player::ApplyAnalysis(const std::string &path)
+{
+	this->normalisation = 1.0f;
+	this->audio_end = decltype(this->audio_end)(0);
+	this->ending_sent = false;
+
+	if (this->analyser == nullptr) {
+		return;
+	}
+
+	Analysis analysis;
+	if (!this->analyser->Lookup(path, analysis)) {
+		this->analyser->Queue(path);
+		return;
+	}
+
+	double db = std::min({LOUDNESS_TARGET_LUFS - analysis.loudness,
+	                      TRUE_PEAK_CEILING_DBTP - analysis.true_peak,
+	                      LOUDNESS_MAX_GAIN_DB});
+	Debug("normalising", path, "by", db, "dB");
+	this->normalisation = static_cast<float>(std::pow(10.0, db / 20.0));
+
+	this->audio_end = analysis.audio_end;
+	if (this->auto_cue && 0 < analysis.audio_start.count()) {
+		// As with Seek, announce the new position straight away.
+		this->audio->SeekToPosition(analysis.audio_start);
+		ResetPosition();
+		UpdatePosition();
+	}
+}
+
+void Player::UpdateEnding()
+{
+	if (this->ending_sent || this->audio_end.count() == 0) {
+		return;
+	}
+
+	auto pos = this->audio->CurrentPosition<PlayerPosition::Unit>();
+	if (this->audio_end <= pos) {
+		this->ending_sent = true;
+		if (this->ending_listener != nullptr) {
+			this->ending_listener();
+		}
+	}
+}
+
+void Player::UpdateDeadAir()
+{
+	// The callback raises the alarms; all that's left here is to notice.
+	auto alarms = this->audio->DeadAirAlarms();
+	if (alarms == this->dead_air_alarms) {
+		return;
+	}
+
+	this->dead_air_alarms = alarms;
+	if (this->dead_air_listener != nullptr) {
+		this->dead_air_listener(this->audio->DeadAirLength());
+	}
+}
+
+void Player::UpdateXruns()
+{
+	if (this->xrun_listener == nullptr) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (now < this->xrun_next) {
+		return;
+	}
+
+	auto x = this->audio->Xruns();
+	auto &o = this->xruns_sent;
+	if (x.ring_underruns == o.ring_underruns &&
+	    x.partial_fills == o.partial_fills &&
+	    x.device_underflows == o.device_underflows &&
+	    x.device_overflows == o.device_overflows) {
+		return;
+	}
+
+	// As with levels, schedule from now, so bursts are merged.
+	this->xruns_sent = x;
+	this->xrun_next = now + XRUN_PERIOD;
+	this->xrun_listener(x);
+}
+
+bool Player::Xruns(XrunStats &stats) const
+{
+	if (!CurrentStateIn(AUDIO_LOADED_STATES)) {
+		return false;
+	}
+	stats = this->audio->Xruns();
+	return true;
+}
+
+void Player::SetStatusPage(StatusPage *page)
+{
+	this->status_page = page;
+}
+
+void Player::SetAnalyser(Analyser *analyser)
+{
+	this->analyser = analyser;
+}
+
+void Player::SetAutoCue(bool auto_cue)
+{
+	this->auto_cue = auto_cue;
+}
+
+void Player::RegisterEndingListener(EndingListener listener)
+{
+	this->ending_listener = listener;
+}
+
+void Player::SetDeadAirPeriod(PlayerPosition::Unit period)
+{
+	this->dead_air_period = period;
+}
+
+void Player::RegisterDeadAirListener(DeadAirListener listener)
+{
+	this->dead_air_listener = listener;
+}
+
+void Player::RegisterXrunListener(XrunListener listener)
+{
+	this->xrun_listener = listener;
+}
+
+void Player::RegisterCueListener(CueListener listener)
+{
+	this->cue_listener = listener;
+}
+
+void Player::UpdateCue()
+{
+	this->audio->UpdateCue();
+
+	std::chrono::nanoseconds offset;
+	if (this->audio->TakeCueOffset(offset) && this->cue_listener) {
+		this->cue_listener(offset);
+	}
+}
+
+float Player::ParseGain(const std::string &gain_str)
 {
-	this->audio = decltype(this->audio)(this->audio_system.Load(path));
+	std::istringstream is(gain_str);
+	double amount;
+	std::string unit;
+
+	is >> amount;
+	if (is.fail()) {
+		throw std::invalid_argument(gain_str);
+	}
+	is >> unit;
+
+	double linear;
+	if (unit.empty()) {
+		linear = amount;
+	} else if (unit == "dB" || unit == "db") {
+		linear = std::pow(10.0, amount / 20.0);
+	} else {
+		throw std::invalid_argument(gain_str);
+	}
+
+	if (!std::isfinite(linear) || linear < 0.0) {
+		throw std::invalid_argument(gain_str);
+	}
+	return static_cast<float>(linear);
 }
 
 //
@@ -54,33 +345,57 @@ void Player::OpenFile(const std::string &path)
 
 bool Player::Eject()
 {
-	return IfCurrentStateIn(AUDIO_LOADED_STATES, [this] {
+	return IfCurrentStateIn({State::LOADING, State::PLAYING,
+	                         State::STOPPED},
+	                        [this] {
+		CancelLoad();
 		this->audio = nullptr;
+		if (this->status_page != nullptr) {
+			this->status_page->UpdateFile(0, "", 0);
+		}
 		SetState(State::EJECTED);
 		return true;
 	});
 }
 
-bool Player::Load(const std::string &path)
+bool Player::Load(const std::string &path, LoadCallback done)
 {
-	bool valid = !path.empty();
+	bool valid = !path.empty() && this->current_state != State::QUITTING;
 	if (valid) {
-		try
-		{
-			OpenFile(path);
-			ResetPosition();
-			Debug("Loaded ", path);
-			SetState(State::STOPPED);
-		}
-		catch (Error &error)
-		{
-			error.ToResponse();
-			Eject();
+		// Drop whatever was loaded, or loading, before: the new load
+		// replaces it.
+		CancelLoad();
+		if (this->audio != nullptr) {
+			this->audio = nullptr;
+			if (this->status_page != nullptr) {
+				this->status_page->UpdateFile(0, "", 0);
+			}
 		}
+
+		this->loader = decltype(this->loader)(
+		                this->audio_system.Load(path));
+		this->load_callback = done;
+		SetState(State::LOADING);
 	}
 	return valid;
 }
 
+bool Player::AfterLoad(LoadCallback next)
+{
+	if (this->loader == nullptr) {
+		return false;
+	}
+
+	auto first = std::move(this->load_callback);
+	this->load_callback = [first, next](bool ok, const std::string &m) {
+		if (first != nullptr) {
+			first(ok, m);
+		}
+		next(ok, m);
+	};
+	return true;
+}
+
 bool Player::Play()
 {
 	return IfCurrentStateIn({State::STOPPED}, [this] {
@@ -91,6 +406,113 @@ bool Player::Play()
 	});
 }
 
+/**
+ * Parses a local time of day, taking it to be its next occurrence: today,
+ * or tomorrow if it has already passed today.
+ * @param time_str  The time, as two-digit HH:MM:SS, optionally followed by
+ *                  a dot and one to nine digits of fraction.
+ * @param when      Set to the time, if it is valid.
+ * @return          Whether the time is valid.
+ */
+static bool ParseTimeOfDay(const std::string &time_str,
+                           std::chrono::system_clock::time_point &when)
+{
+	// Exactly HH:MM:SS, then optionally a dot and up to nine digits;
+	// sscanf would let through signs, spaces and single digits.
+	auto digit = [&time_str](std::size_t i) {
+		return i < time_str.size() && '0' <= time_str[i] &&
+		       time_str[i] <= '9';
+	};
+	auto field = [&time_str](std::size_t i) {
+		return (time_str[i] - '0') * 10 + (time_str[i + 1] - '0');
+	};
+	for (std::size_t i : {0, 1, 3, 4, 6, 7}) {
+		if (!digit(i)) {
+			return false;
+		}
+	}
+	if (time_str[2] != ':' || time_str[5] != ':') {
+		return false;
+	}
+
+	int h = field(0), m = field(3), s = field(6);
+	if (23 < h || 59 < m || 59 < s) {
+		return false;
+	}
+
+	// Up to nanosecond precision, which is more than a sample needs.
+	std::chrono::nanoseconds fraction(0);
+	std::size_t i = 8;
+	if (i < time_str.size() && time_str[i] == '.') {
+		long long scale = 100000000;
+		for (i++; digit(i) && 0 < scale; i++) {
+			fraction += std::chrono::nanoseconds(
+			                (time_str[i] - '0') * scale);
+			scale /= 10;
+		}
+		if (i == 9) {
+			return false;
+		}
+	}
+	if (i != time_str.size()) {
+		return false;
+	}
+
+	auto now = std::chrono::system_clock::now();
+	std::time_t today = std::chrono::system_clock::to_time_t(now);
+	std::tm date;
+#ifdef WIN32
+	if (localtime_s(&date, &today) != 0) {
+		return false;
+	}
+#else
+	if (localtime_r(&today, &date) == nullptr) {
+		return false;
+	}
+#endif
+
+	// mktime works out the date, and daylight saving, for a day past the
+	// end of the month just as well.
+	for (int days = 0; days < 2; days++) {
+		std::tm day = date;
+		day.tm_mday += days;
+		day.tm_hour = h;
+		day.tm_min = m;
+		day.tm_sec = s;
+		day.tm_isdst = -1;
+
+		std::time_t t = std::mktime(&day);
+		if (t == static_cast<std::time_t>(-1)) {
+			return false;
+		}
+
+		when = std::chrono::system_clock::from_time_t(t) +
+		       std::chrono::duration_cast<
+		                       std::chrono::system_clock::duration>(
+		                       fraction);
+		if (now < when) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Player::PlayAt(const std::string &time_str)
+{
+	return IfCurrentStateIn({State::STOPPED}, [this, &time_str] {
+		assert(this->audio != nullptr);
+
+		std::chrono::system_clock::time_point when;
+		if (!ParseTimeOfDay(time_str, when)) {
+			return false;
+		}
+
+		this->audio->StartAt(when);
+		SetState(State::PLAYING);
+		return true;
+	});
+}
+
 bool Player::Quit()
 {
 	Eject();
@@ -118,12 +540,36 @@ bool Player::Seek(const std::string &time_str)
 			this->audio->SeekToPosition(position);
 			this->ResetPosition();
 			this->UpdatePosition();
+
+			// A seek re-arms the ending; seeking past it fires it
+			// again straight away.
+			this->ending_sent = false;
 		}
 
 		return success;
 	});
 }
 
+bool Player::SetGain(const std::string &gain_str)
+{
+	bool success = true;
+
+	try
+	{
+		this->gain = ParseGain(gain_str);
+	}
+	catch (std::invalid_argument)
+	{
+		success = false;
+	}
+
+	if (success && CurrentStateIn(AUDIO_LOADED_STATES)) {
+		this->audio->SetGain(this->gain * this->normalisation);
+	}
+
+	return success;
+}
+
 bool Player::Stop()
 {
 	return IfCurrentStateIn({State::PLAYING}, [this] {
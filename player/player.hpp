@@ -21,13 +21,17 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "../audio/audio_loader.hpp"
 #include "../audio/audio_output.hpp"
 #include "../time_parser.hpp"
 
 #include "player_position.hpp"
 
+class Analyser;
 class AudioSystem;
+class StatusPage;
 
 /**
  * A player contains a loaded audio file and the state of its playback.
@@ -44,6 +48,7 @@ public:
 	enum class State : std::uint8_t {
 		STARTING, ///< The player has just initialised.
 		EJECTED,  ///< The player has no song loaded.
+		LOADING,  ///< The player is loading a song in the background.
 		STOPPED,  ///< The player has a song loaded and not playing.
 		PLAYING,  ///< The player has a song loaded and playing.
 		QUITTING  ///< The player is about to terminate.
@@ -55,6 +60,44 @@ public:
 	 */
 	using StateListener = std::function<void(State, State)>;
 
+	/**
+	 * Type for level listeners.
+	 * @see RegisterLevelListener
+	 */
+	using LevelListener = std::function<void(const Levels &)>;
+
+	/**
+	 * Type for ending listeners.
+	 * @see RegisterEndingListener
+	 */
+	using EndingListener = std::function<void()>;
+
+	/**
+	 * Type for dead air listeners.
+	 * @see RegisterDeadAirListener
+	 */
+	using DeadAirListener = std::function<void(PlayerPosition::Unit)>;
+
+	/**
+	 * Type for xrun listeners.
+	 * @see RegisterXrunListener
+	 */
+	using XrunListener = std::function<void(const XrunStats &)>;
+
+	/**
+	 * Type for cue listeners.
+	 * @see RegisterCueListener
+	 */
+	using CueListener = std::function<void(std::chrono::nanoseconds)>;
+
+	/**
+	 * Type for load completion callbacks.
+	 * The callback is given whether the load succeeded and, if not, a
+	 * human-readable reason why.
+	 * @see Load
+	 */
+	using LoadCallback = std::function<void(bool, const std::string &)>;
+
 	/**
 	 * A list of states.
 	 */
@@ -68,11 +111,49 @@ private:
 
 	std::unique_ptr<AudioOutput> audio;
 
+	std::unique_ptr<AudioLoader> loader; ///< The load in progress, if any.
+	LoadCallback load_callback;          ///< Called when it finishes.
+
+	/// Cancelled loads whose workers haven't yet finished.
+	std::vector<std::unique_ptr<AudioLoader>> cancelled_loaders;
+
 	PlayerPosition position;
 
 	StateListener state_listener;
 	State current_state;
 
+	float gain; ///< The current gain, as a linear multiplier.
+
+	/// The loudness normalisation gain of the loaded song, as a linear
+	/// multiplier; this is applied on top of gain.
+	float normalisation;
+
+	Analyser *analyser; ///< The loudness analyser, or nullptr for none.
+	bool auto_cue;      ///< Whether to skip leading silence on load.
+
+	/// Where the loaded song's trailing silence starts, or zero if unknown.
+	PlayerPosition::Unit audio_end;
+	bool ending_sent; ///< Whether the ending listener has been told.
+	EndingListener ending_listener;
+
+	/// How long output must be dead air before the listener is told.
+	PlayerPosition::Unit dead_air_period;
+	std::uint64_t dead_air_alarms; ///< The output's alarms already told.
+	DeadAirListener dead_air_listener;
+
+	XrunStats xruns_sent; ///< The output's xruns already told.
+	std::chrono::steady_clock::time_point xrun_next; ///< Next xrun send.
+	XrunListener xrun_listener;
+
+	CueListener cue_listener;
+
+	StatusPage *status_page; ///< The status page, or nullptr for none.
+	std::uint64_t file_id;   ///< Incremented on each successful load.
+
+	LevelListener level_listener;
+	PlayerPosition::Unit level_period; ///< Zero if levels are off.
+	std::chrono::steady_clock::time_point level_next; ///< Next level send.
+
 public:
 	/**
 	 * Constructs a Player.
@@ -88,8 +169,16 @@ public:
 	 */
 	bool IsRunning() const;
 
+	/**
+	 * Gets when the player next needs updating to announce its position.
+	 * @return  The time, or PlayerPosition::Clock::time_point::max() if
+	 *          nothing is waiting on the position.
+	 */
+	PlayerPosition::Clock::time_point NextDeadline() const;
+
 	/**
 	 * Ejects the current loaded song, if any.
+	 * This also cancels any load in progress.
 	 * @return  Whether the ejection succeeded.
 	 */
 	bool Eject();
@@ -100,6 +189,18 @@ public:
 	 */
 	bool Play();
 
+	/**
+	 * Plays the current loaded song, if any, from a given time of day.
+	 * The output starts straight away, but stays silent until the first
+	 * sample of the song can be heard at that time.
+	 * @param time_str  A local time of day, as HH:MM:SS with an optional
+	 *                  fraction of a second (eg "12:00:00.000"); if it
+	 *                  has passed today, it is taken to be tomorrow.
+	 * @return  Whether the starting of playback succeeded.
+	 * @see RegisterCueListener
+	 */
+	bool PlayAt(const std::string &time_str);
+
 	/**
 	 * Quits Playslave++.
 	 * @return  Whether the quit succeeded.
@@ -116,11 +217,32 @@ public:
 	bool Stop();
 
 	/**
-	 * Loads a track.
+	 * Starts loading a track.
+	 *
+	 * The track is opened in the background, during which the player is in
+	 * the LOADING state; it moves to STOPPED once the track is ready, or
+	 * EJECTED if it fails to load.  Any song already loaded is ejected,
+	 * and any load already in progress is cancelled.
+	 *
 	 * @param path  The absolute path to a track to load.
-	 * @return      Whether the load succeeded.
+	 * @param done  Called, from Update, when the load finishes or is
+	 *              cancelled.  May be nullptr.
+	 * @return      Whether the load was started.
+	 */
+	bool Load(const std::string &path, LoadCallback done);
+
+	/**
+	 * Queues a callback to run once the load in progress finishes.
+	 *
+	 * This lets a command that needs a loaded track, such as 'play', wait
+	 * on a 'load' sent in the same batch.  The callback runs after the
+	 * load's own callback, with the same outcome.
+	 *
+	 * @param next  Called, from Update, when the load finishes or is
+	 *              cancelled.
+	 * @return      Whether a load was in progress to queue behind.
 	 */
-	bool Load(const std::string &path);
+	bool AfterLoad(LoadCallback next);
 
 	/**
 	 * Seeks to a given position in the current track.
@@ -134,6 +256,28 @@ public:
 	 */
 	bool Seek(const std::string &time_str);
 
+	/**
+	 * Sets the gain applied to the output.
+	 *
+	 * The gain persists across loads, and changes to it are ramped in
+	 * smoothly on the currently playing track.
+	 *
+	 * @param gain_str  A string containing either a linear gain (eg
+	 *                  "0.5"), or a gain in decibels suffixed with "dB"
+	 *                  (eg "-6dB").
+	 * @return          Whether the gain change succeeded.
+	 */
+	bool SetGain(const std::string &gain_str);
+
+	/**
+	 * Sets the period between output level reports.
+	 * @param time_str  A time string, as in Seek, giving the period
+	 *                  between reports.  A period of zero turns level
+	 *                  reports off.
+	 * @return          Whether the period change succeeded.
+	 */
+	bool SetLevelPeriod(const std::string &time_str);
+
 	/**
 	 * A human-readable string representation of the current state.
 	 * @return The current state, as a human-readable string..
@@ -169,6 +313,116 @@ public:
 	 */
 	void SetPositionListenerPeriod(PlayerPosition::Unit period);
 
+	/**
+	 * Subscribes to the position at a period of the subscriber's own,
+	 * replacing any earlier subscription with the same key.
+	 * @param time_str    A time string, as in Seek, giving the period
+	 *                    between positions.  A period of zero
+	 *                    unsubscribes; otherwise, it must be at least
+	 *                    TICK_MIN_PERIOD.
+	 * @param key         The key identifying the subscriber.
+	 * @param subscriber  The subscriber callback.
+	 * @return            Whether the subscription succeeded.
+	 * @see PlayerPosition::Subscribe
+	 */
+	bool SubscribePosition(const std::string &time_str,
+	                       PlayerPosition::Key key,
+	                       PlayerPosition::Subscriber subscriber);
+
+	/**
+	 * Registers a level listener.
+	 *
+	 * While playing, this listener is sent the output levels every level
+	 * period.
+	 * @param listener  The listener callback.
+	 * @see SetLevelPeriod
+	 */
+	void RegisterLevelListener(LevelListener listener);
+
+	/**
+	 * Sets the shared memory status page the Player publishes to.
+	 * @param page  The status page, or nullptr for none.  The Player
+	 *              does not take ownership.
+	 */
+	void SetStatusPage(StatusPage *page);
+
+	/**
+	 * Sets the analyser used to normalise loudness.
+	 *
+	 * Songs with a stored analysis are played at a gain that brings them
+	 * to LOUDNESS_TARGET_LUFS, without pushing their true peak above
+	 * TRUE_PEAK_CEILING_DBTP; songs without one are queued for analysis,
+	 * and played as they are.
+	 * @param analyser  The analyser, or nullptr to turn normalisation
+	 *                  off.  The Player does not take ownership.
+	 */
+	void SetAnalyser(Analyser *analyser);
+
+	/**
+	 * Sets whether songs are cued past their leading silence on load.
+	 * This only works for songs with a stored analysis.
+	 * @param auto_cue  Whether to skip leading silence.
+	 * @see SetAnalyser
+	 */
+	void SetAutoCue(bool auto_cue);
+
+	/**
+	 * Registers an ending listener.
+	 *
+	 * While playing a song with a stored analysis, this listener is told
+	 * when the song reaches its trailing silence (or its end, if it has
+	 * none), so that the next song can be started early.
+	 * @param listener  The listener callback.
+	 * @see SetAnalyser
+	 */
+	void RegisterEndingListener(EndingListener listener);
+
+	/**
+	 * Sets how long the output must be dead air (silent, or stuck at one
+	 * value) before the dead air listener is told.
+	 * This applies from the next song loaded.
+	 * @param period  The period, or zero to turn the watchdog off.
+	 */
+	void SetDeadAirPeriod(PlayerPosition::Unit period);
+
+	/**
+	 * Registers a dead air listener.
+	 *
+	 * While playing, this listener is told, once per dead run, when the
+	 * output has been dead air for the dead air period, and given how long
+	 * it has been dead.
+	 * @param listener  The listener callback.
+	 * @see SetDeadAirPeriod
+	 */
+	void RegisterDeadAirListener(DeadAirListener listener);
+
+	/**
+	 * Registers an xrun listener.
+	 *
+	 * While playing, this listener is sent the output's xrun statistics
+	 * whenever they count a new xrun, but no more than once every
+	 * XRUN_PERIOD.
+	 * @param listener  The listener callback.
+	 */
+	void RegisterXrunListener(XrunListener listener);
+
+	/**
+	 * Registers a cue listener.
+	 *
+	 * Once a song played with PlayAt starts, this listener is sent how
+	 * far after the requested time its first sample is heard (negative
+	 * if before).
+	 * @param listener  The listener callback.
+	 */
+	void RegisterCueListener(CueListener listener);
+
+	/**
+	 * Gets the xrun statistics of the loaded song's output.
+	 * @param stats  The statistics to fill in.
+	 * @return       False if no song is loaded; true otherwise.
+	 */
+	bool Xruns(XrunStats &stats) const;
+
 	/**
 	 * Registers a position listener.
 	 *
@@ -222,6 +476,15 @@ private:
 	std::pair<std::string, std::uint64_t> ParseSeekTime(
 	                const std::string &time_str) const;
 
+	/**
+	 * Parses a gain string into a linear gain.
+	 * @param gain_str  The gain string to parse.
+	 * @return          The gain, as a linear multiplier.
+	 * @throws std::invalid_argument if the string is not a valid gain.
+	 * @see SetGain
+	 */
+	static float ParseGain(const std::string &gain_str);
+
 	/**
 	 * Updates the player position to reflect changes in the audio system.
 	 * Call this whenever the audio position has changed.
@@ -238,11 +501,66 @@ private:
 	void ResetPosition();
 
 	/**
-	 * Opens a file, setting this->audio to the resulting file.
-	 * Generally, you should use Load instead.
-	 * @param path  The absolute path to a track to load.
+	 * Sends the output levels to the level listener, if one is due.
+	 */
+	void UpdateLevels();
+
+	/**
+	 * Finishes the load in progress, if it is ready.
+	 * @see Load
+	 */
+	void UpdateLoad();
+
+	/**
+	 * Sets up a freshly loaded output, and makes it the current one.
+	 * @param output  The output, which the Player takes ownership of.
+	 * @param path    The path from which the output was loaded.
+	 */
+	void OpenOutput(AudioOutput *output, const std::string &path);
+
+	/**
+	 * Applies the stored analysis of the loaded song, if any: its
+	 * loudness normalisation gain, its ending point and, if auto-cue is
+	 * on, its starting point.  If it has no analysis, one is queued.
+	 * @param path  The path of the song.
+	 */
+	void ApplyAnalysis(const std::string &path);
+
+	/**
+	 * Tells the ending listener if the song has reached its trailing
+	 * silence.
+	 */
+	void UpdateEnding();
+
+	/**
+	 * Tells the dead air listener about any new dead air alarms raised by
+	 * the output.
+	 */
+	void UpdateDeadAir();
+
+	/**
+	 * Sends the xrun statistics to the xrun listener, if they have
+	 * counted new xruns and one is due.
+	 */
+	void UpdateXruns();
+
+	/**
+	 * Keeps a scheduled start on time, and tells the cue listener once it
+	 * has happened.
+	 */
+	void UpdateCue();
+
+	/**
+	 * Cancels the load in progress, if any, telling its callback.
+	 * The loader is kept until its worker finishes, so that this
+	 * never blocks.
+	 */
+	void CancelLoad();
+
+	/**
+	 * Destroys any cancelled loaders whose workers have finished.
 	 */
-	void OpenFile(const std::string &path);
+	void ReapLoaders();
 };
 
 #endif // PS_PLAYER_HPP
@@ -0,0 +1,59 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of aspects of the Player class pertaining to output levels.
+ * @see player/player.hpp
+ * @see player/player.cpp
+ */
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include "player.hpp"
+
+void Player::RegisterLevelListener(LevelListener listener)
+{
+	this->level_listener = listener;
+}
+
+bool Player::SetLevelPeriod(const std::string &time_str)
+{
+	bool success = true;
+
+	try
+	{
+		this->level_period = this->time_parser.Parse(time_str);
+		this->level_next = std::chrono::steady_clock::now();
+	}
+	catch (std::out_of_range)
+	{
+		success = false;
+	}
+
+	return success;
+}
+
+void Player::UpdateLevels()
+{
+	if (this->level_period.count() == 0 || this->level_listener == nullptr) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (now < this->level_next) {
+		return;
+	}
+
+	// Schedule from now rather than from the last deadline, so a stalled
+	// main loop doesn't cause a burst of reports.
+	this->level_next = now + this->level_period;
+
+	// Nothing played means no levels, rather than silence.
+	Levels levels;
+	if (this->audio->TakeLevels(levels)) {
+		this->level_listener(levels);
+	}
+}
@@ -7,7 +7,12 @@
  * @see player/player_position.hpp
  */
 
+#include <algorithm>
 #include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include "../constants.h"
 #include "player.hpp"
 
 // Player
@@ -22,10 +27,46 @@ void Player::SetPositionListenerPeriod(PlayerPosition::Unit period)
 	this->position.SetListenerPeriod(period);
 }
 
+bool Player::SubscribePosition(const std::string &time_str,
+                               PlayerPosition::Key key,
+                               PlayerPosition::Subscriber subscriber)
+{
+	PlayerPosition::Unit period;
+	try
+	{
+		period = this->time_parser.Parse(time_str);
+	}
+	catch (std::out_of_range)
+	{
+		return false;
+	}
+
+	if (0 < period.count() && period < TICK_MIN_PERIOD) {
+		return false;
+	}
+
+	this->position.Subscribe(key, period, subscriber);
+	return true;
+}
+
 void Player::UpdatePosition()
 {
-	auto pos = this->audio->CurrentPosition<PlayerPosition::Unit>();
-	this->position.Update(pos);
+	// Only work out the position when someone wants it, as it means
+	// asking the audio device for the time.
+	auto now = PlayerPosition::Clock::now();
+	if (this->position.IsDue(now)) {
+		auto pos = this->audio->CurrentPosition<PlayerPosition::Unit>();
+		this->position.Update(pos, now);
+	}
+}
+
+PlayerPosition::Clock::time_point Player::NextDeadline() const
+{
+	// The position is only worked out while playing.
+	if (this->current_state != State::PLAYING) {
+		return PlayerPosition::Clock::time_point::max();
+	}
+	return this->position.Earliest();
 }
 
 void Player::ResetPosition()
@@ -44,40 +85,92 @@ PlayerPosition::PlayerPosition()
 	Reset();
 }
 
-void PlayerPosition::Update(const PlayerPosition::Unit position)
+void PlayerPosition::RegisterListener(PlayerPosition::Listener listener)
 {
-	this->current = position;
+	this->listeners.push_back(listener);
+	Rearm();
+}
 
-	if (IsReadyToSend()) {
-		Send();
+void PlayerPosition::SetListenerPeriod(PlayerPosition::Unit period)
+{
+	this->period = period;
+}
+
+void PlayerPosition::Subscribe(PlayerPosition::Key key,
+                               PlayerPosition::Unit period,
+                               PlayerPosition::Subscriber subscriber)
+{
+	if (period.count() == 0) {
+		this->subscriptions.erase(key);
+	} else {
+		this->subscriptions[key] = Subscription{subscriber, period,
+		                                        Clock::now()};
 	}
+	Rearm();
 }
 
-void PlayerPosition::Reset()
+bool PlayerPosition::IsDue(Clock::time_point now) const
+{
+	return this->earliest <= now;
+}
+
+PlayerPosition::Clock::time_point PlayerPosition::Earliest() const
 {
-	this->current = decltype(this->current)(0);
-	this->last = decltype(this->last)();
+	return this->earliest;
 }
 
-void PlayerPosition::Send()
+void PlayerPosition::Update(const PlayerPosition::Unit position,
+                            Clock::time_point now)
 {
-	for (auto listener : this->listeners) {
-		listener(this->current);
+	if (!this->listeners.empty() && this->next <= now) {
+		for (auto &listener : this->listeners) {
+			listener(position);
+		}
+		Reschedule(this->next, this->period, now);
 	}
-	this->last = decltype(this->last)(this->current);
+
+	auto &subs = this->subscriptions;
+	for (auto it = subs.begin(); it != subs.end();) {
+		Subscription &s = it->second;
+		if (now < s.next) {
+			++it;
+		} else if (s.subscriber(position)) {
+			Reschedule(s.next, s.period, now);
+			++it;
+		} else {
+			it = subs.erase(it);
+		}
+	}
+
+	Rearm();
 }
 
-bool PlayerPosition::IsReadyToSend()
+void PlayerPosition::Reset()
 {
-	return (!this->last) || ((*this->last) + this->period <= this->current);
+	this->next = Clock::time_point();
+	for (auto &s : this->subscriptions) {
+		s.second.next = Clock::time_point();
+	}
+	Rearm();
 }
 
-void PlayerPosition::RegisterListener(PlayerPosition::Listener listener)
+void PlayerPosition::Reschedule(Clock::time_point &next,
+                                PlayerPosition::Unit period,
+                                Clock::time_point now)
 {
-	this->listeners.push_back(listener);
+	next += period;
+	if (next <= now) {
+		next = now + period;
+	}
 }
 
-void PlayerPosition::SetListenerPeriod(PlayerPosition::Unit period)
+void PlayerPosition::Rearm()
 {
-	this->period = period;
+	this->earliest = Clock::time_point::max();
+	if (!this->listeners.empty()) {
+		this->earliest = this->next;
+	}
+	for (auto &s : this->subscriptions) {
+		this->earliest = std::min(this->earliest, s.second.next);
+	}
 }
@@ -12,11 +12,17 @@
 
 #include <chrono>
 #include <functional>
-#include <set>
-#include <boost/optional.hpp>
+#include <map>
+#include <vector>
 
 /**
  * Tracker and broadcaster for the Player's current position in a song.
+ *
+ * Announcements are scheduled as deadlines on the steady clock, rather than
+ * by how far the position has moved, so they keep time however often the
+ * main loop happens to check.  Registered listeners share one period, and
+ * subscribers each have their own, so one subscriber asking for a fast
+ * playhead doesn't speed things up for everyone else.
  */
 class PlayerPosition {
 public:
@@ -25,27 +31,53 @@ public:
 	 */
 	using Unit = std::chrono::microseconds;
 
+	/**
+	 * The clock on which announcements are scheduled.
+	 */
+	using Clock = std::chrono::steady_clock;
+
 	/**
 	 * Type for position listeners.
 	 * @see RegisterListener
 	 */
 	using Listener = std::function<void(Unit)>;
 
+	/**
+	 * Type for position subscribers.
+	 * A subscriber returns false once it no longer wants positions, for
+	 * example because its client has gone away.
+	 * @see Subscribe
+	 */
+	using Subscriber = std::function<bool(Unit)>;
+
+	/**
+	 * Type of the keys identifying subscribers.
+	 * @see Subscribe
+	 */
+	using Key = const void *;
+
 private:
+	/// One subscriber, and when it next wants the position.
+	struct Subscription {
+		Subscriber subscriber; ///< The subscriber.
+		Unit period;           ///< The period between its positions.
+		Clock::time_point next; ///< When it next wants the position.
+	};
+
 	/// The vector of callbacks to fire when the position updates.
 	std::vector<Listener> listeners;
 
 	/// The period between each firing of the listeners.
 	Unit period;
 
-	/// The current position of the player.
-	Unit current;
+	/// When the listeners next fire.
+	Clock::time_point next;
 
-	/**
-	 * The position of the player at the last firing of the callbacks.
-	 * This may be empty, if the callbacks have never fired.
-	 */
-	boost::optional<Unit> last;
+	/// The subscribers, each with its own period.
+	std::map<Key, Subscription> subscriptions;
+
+	/// The earliest time anything wants the position.
+	Clock::time_point earliest;
 
 public:
 	/**
@@ -65,22 +97,50 @@ public:
 
 	/**
 	 * Sets the period between position signals.
-	 * This is shared across all listeners.
+	 * This is shared across all listeners, but not subscribers.
 	 * @param period  The period to wait between listener callbacks.
 	 * @see RegisterListener
 	 */
 	void SetListenerPeriod(Unit period);
 
 	/**
-	 * Updates the position tracker with the new position.
-	 * This fires the position listeners if necessary.
+	 * Subscribes to the position at a period of the subscriber's own.
+	 * This replaces any existing subscription with the same key.  The
+	 * subscriber is sent the position straight away, and then every
+	 * @a period.
+	 * @param key         The key identifying the subscriber.
+	 * @param period      The period between positions, or zero to
+	 *                    unsubscribe.
+	 * @param subscriber  The subscriber callback.
+	 */
+	void Subscribe(Key key, Unit period, Subscriber subscriber);
+
+	/**
+	 * Checks whether any listener or subscriber wants the position.
+	 * This is cheap, so it can be checked before working out the position.
+	 * @param now  The current time.
+	 * @return     True if Update should be called; false otherwise.
+	 */
+	bool IsDue(Clock::time_point now) const;
+
+	/**
+	 * Gets the earliest time any listener or subscriber wants the
+	 * position.
+	 * @return  The time, or Clock::time_point::max() if nothing does.
+	 */
+	Clock::time_point Earliest() const;
+
+	/**
+	 * Sends the position to every listener and subscriber that wants it.
 	 * @param position  The new position, in @a PositionUnit units.
+	 * @param now       The current time.
 	 * @see Reset
 	 */
-	void Update(Unit position);
+	void Update(Unit position, Clock::time_point now);
 
 	/**
-	 * Resets the position tracker's position data.
+	 * Makes every listener and subscriber due, so the next Update sends
+	 * the position to all of them.
 	 * This does not deregister the listeners.
 	 * Call this whenever the song changes, or before a skip.
 	 * @see Update
@@ -89,18 +149,21 @@ public:
 
 private:
 	/**
-	 * Figures out whether it's time to send a position signal.
-	 * @return  True if enough time has elapsed for a signal to be sent;
-	 *          false otherwise.
+	 * Moves a deadline on by one period.
+	 * The deadline is kept on its original schedule, so announcements
+	 * don't drift; if the main loop has fallen a whole period behind,
+	 * though, it skips ahead rather than sending a burst.
+	 * @param next    The deadline.
+	 * @param period  The period.
+	 * @param now     The current time.
 	 */
-	bool IsReadyToSend();
+	static void Reschedule(Clock::time_point &next, Unit period,
+	                       Clock::time_point now);
 
 	/**
-	 * Sends a position signal to the outside environment, if ready.
-	 * This only sends a signal if the requested amount of time has passed
-	 * since the last one.
+	 * Works out the earliest deadline.
 	 */
-	void Send();
+	void Rearm();
 };
 
 #endif // PS_PLAYER_POSITION_HPP
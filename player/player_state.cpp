@@ -10,8 +10,10 @@
  * @see player/player_position.cpp
  */
 
+#include <algorithm>
 
 #include "player.hpp"
+#include "../status_page.hpp"
 
 // Basic state queries
 
@@ -49,6 +51,7 @@ bool Player::IfCurrentStateIn(Player::StateList states, std::function<bool()> f)
 const std::map<Player::State, std::string> Player::STATE_STRINGS = {
                 {State::STARTING, "Starting"},
                 {State::EJECTED, "Ejected"},
+                {State::LOADING, "Loading"},
                 {State::STOPPED, "Stopped"},
                 {State::PLAYING, "Playing"},
                 {State::QUITTING, "Quitting"}};
@@ -71,6 +74,10 @@ void Player::SetState(State state)
 
 	this->current_state = state;
 
+	if (this->status_page != nullptr) {
+		this->status_page->UpdateState(static_cast<std::uint32_t>(state));
+	}
+
 	if (this->state_listener != nullptr) {
 		this->state_listener(last_state, state);
 	}
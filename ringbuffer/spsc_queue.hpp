@@ -0,0 +1,126 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * The SpscQueue class template.
+ * @see ringbuffer/ringbuffer.hpp
+ */
+
+#ifndef PS_SPSC_QUEUE_HPP
+#define PS_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/// The size of a cache line, in bytes.
+#define SPSC_CACHE_LINE 64
+
+/**
+ * A bounded, lock-free queue between one producer and one consumer thread.
+ *
+ * Unlike RingBuffer, which moves runs of samples, this moves whole objects
+ * one at a time, and never blocks or allocates once constructed.  Callers
+ * that need to wait for space or items must arrange that themselves.
+ *
+ * The head and tail counters only ever increase; their difference is the
+ * number of items queued, and each is masked to find its slot.  They live
+ * on separate cache lines, so the two threads don't contend for them.
+ */
+template <typename T>
+class SpscQueue {
+public:
+	/**
+	 * Constructs an SpscQueue.
+	 * @param capacity The maximum number of items queued at once, which
+	 *   must be a power of two.
+	 */
+	SpscQueue(std::size_t capacity)
+	        : slots(new T[capacity]), mask(capacity - 1), head(0), tail(0)
+	{
+		assert(0 < capacity && (capacity & this->mask) == 0);
+	}
+
+	SpscQueue(const SpscQueue &) = delete;
+	SpscQueue &operator=(const SpscQueue &) = delete;
+
+	/**
+	 * Adds an item to the back of the queue, if there is room.
+	 * Only the producer may call this.
+	 * @param item The item, which is moved from only if there is room.
+	 * @return True if the item was queued; false if the queue was full.
+	 */
+	bool TryPush(T &item)
+	{
+		std::size_t t = this->tail.load(std::memory_order_relaxed);
+		std::size_t h = this->head.load(std::memory_order_acquire);
+		if (this->mask < t - h) {
+			return false;
+		}
+
+		this->slots[t & this->mask] = std::move(item);
+		this->tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Removes the item at the front of the queue, if there is one.
+	 * Only the consumer may call this.
+	 * @param item The variable to move the item into.
+	 * @return True if an item was removed; false if the queue was empty.
+	 */
+	bool TryPop(T &item)
+	{
+		std::size_t h = this->head.load(std::memory_order_relaxed);
+		std::size_t t = this->tail.load(std::memory_order_acquire);
+		if (h == t) {
+			return false;
+		}
+
+		item = std::move(this->slots[h & this->mask]);
+		this->head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * The number of items queued.
+	 * This may be stale by the time the caller sees it, unless the caller
+	 * is the only thread using the queue.
+	 * @return The item count.
+	 */
+	std::size_t Size() const
+	{
+		// Load head first: tail can't then fall behind it.
+		std::size_t h = this->head.load(std::memory_order_acquire);
+		std::size_t t = this->tail.load(std::memory_order_acquire);
+		return t - h;
+	}
+
+	/**
+	 * The maximum number of items queued at once.
+	 * @return The capacity.
+	 */
+	std::size_t Capacity() const
+	{
+		return this->mask + 1;
+	}
+
+private:
+	std::unique_ptr<T[]> slots; ///< The item storage.
+	std::size_t mask;           ///< The capacity, minus one.
+
+	/// The number of items ever removed; written by the consumer.
+	std::atomic<std::size_t> head;
+
+	/// Keeps head and tail on separate cache lines.  (C++11 can't allocate
+	/// over-aligned objects, so alignas wouldn't work on the heap.)
+	char gap[SPSC_CACHE_LINE];
+
+	/// The number of items ever added; written by the producer.
+	std::atomic<std::size_t> tail;
+};
+
+#endif // PS_SPSC_QUEUE_HPP
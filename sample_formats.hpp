@@ -3,10 +3,13 @@
 
 /**
  * @file
- * The SampleFormat enumeration.
+ * The SampleFormat enumeration, and per-format sample traits.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <limits>
 
 #ifndef PS_SAMPLE_FORMATS_HPP
 #define PS_SAMPLE_FORMATS_HPP
@@ -30,4 +33,137 @@ enum class SampleFormat : std::uint8_t {
 	PACKED_FLOAT_32        ///< Packed 32-bit floating point.
 };
 
+/**
+ * Saturates a calculation value into the range of an integer sample type.
+ * @tparam T     The integer sample type.
+ * @tparam Calc  The floating-point type used for calculations.
+ * @param value  The value to saturate and round.
+ * @return       The nearest value of type T to @a value.
+ */
+template <typename T, typename Calc>
+inline T SaturateSample(Calc value)
+{
+	const Calc lo = static_cast<Calc>(std::numeric_limits<T>::min());
+	const Calc hi = static_cast<Calc>(std::numeric_limits<T>::max());
+	return static_cast<T>(std::lrint(std::min(std::max(value, lo), hi)));
+}
+
+/**
+ * Traits describing how to do arithmetic on one channel value of a sample.
+ *
+ * Unpack converts a raw value into a signed calculation value centred on
+ * zero, and Pack converts back (saturating, for integer formats).
+ * FullScale is the magnitude of a full-scale calculation value.
+ *
+ * @tparam T  The C++ type of one channel value of a sample.
+ */
+template <typename T>
+struct SampleTraits;
+
+/// SampleTraits for PACKED_UNSIGNED_INT_8.
+template <>
+struct SampleTraits<std::uint8_t> {
+	using Calc = float; ///< Type used for calculations.
+	static Calc Unpack(std::uint8_t s)
+	{
+		return static_cast<Calc>(s) - 128.0f;
+	}
+	static std::uint8_t Pack(Calc c)
+	{
+		return SaturateSample<std::uint8_t>(c + 128.0f);
+	}
+	static Calc FullScale()
+	{
+		return 128.0f;
+	}
+};
+
+/// SampleTraits for PACKED_SIGNED_INT_16.
+template <>
+struct SampleTraits<std::int16_t> {
+	using Calc = float; ///< Type used for calculations.
+	static Calc Unpack(std::int16_t s)
+	{
+		return static_cast<Calc>(s);
+	}
+	static std::int16_t Pack(Calc c)
+	{
+		return SaturateSample<std::int16_t>(c);
+	}
+	static Calc FullScale()
+	{
+		return 32768.0f;
+	}
+};
+
+/// SampleTraits for PACKED_SIGNED_INT_32.
+/// Calculations are done in double precision, as float can't hold 32 bits.
+template <>
+struct SampleTraits<std::int32_t> {
+	using Calc = double; ///< Type used for calculations.
+	static Calc Unpack(std::int32_t s)
+	{
+		return static_cast<Calc>(s);
+	}
+	static std::int32_t Pack(Calc c)
+	{
+		return SaturateSample<std::int32_t>(c);
+	}
+	static Calc FullScale()
+	{
+		return 2147483648.0;
+	}
+};
+
+/// SampleTraits for PACKED_FLOAT_32.
+/// Float samples are not saturated, as PortAudio is run with clipping off.
+template <>
+struct SampleTraits<float> {
+	using Calc = float; ///< Type used for calculations.
+	static Calc Unpack(float s)
+	{
+		return s;
+	}
+	static float Pack(Calc c)
+	{
+		return c;
+	}
+	static Calc FullScale()
+	{
+		return 1.0f;
+	}
+};
+
+/**
+ * Calls a function on a raw sample buffer, cast to the C++ type matching the
+ * given SampleFormat.
+ *
+ * This lets sample-processing kernels be written once as a template over the
+ * channel value type, and specialised for each SampleFormat at compile time.
+ *
+ * @tparam F    The type of the function, which must accept a pointer to any
+ *              of the channel value types in SampleTraits.
+ * @param fmt   The format of the samples in @a data.
+ * @param data  The raw sample buffer.
+ * @param f     The function to call.
+ */
+template <typename F>
+inline void OnSampleFormat(SampleFormat fmt, char *data, F &&f)
+{
+	switch (fmt) {
+	case SampleFormat::PACKED_UNSIGNED_INT_8:
+		f(reinterpret_cast<std::uint8_t *>(data));
+		break;
+	case SampleFormat::PACKED_SIGNED_INT_16:
+		f(reinterpret_cast<std::int16_t *>(data));
+		break;
+	case SampleFormat::PACKED_SIGNED_INT_32:
+		f(reinterpret_cast<std::int32_t *>(data));
+		break;
+	case SampleFormat::PACKED_FLOAT_32:
+		f(reinterpret_cast<float *>(data));
+		break;
+	}
+}
+
 #endif // PS_SAMPLE_FORMATS_HPP
@@ -0,0 +1,82 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * The SeqLock class template.
+ */
+
+#ifndef PS_SEQLOCK_HPP
+#define PS_SEQLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * A sequence lock protecting a value with one writer and many readers.
+ *
+ * The writer never blocks, which makes this suitable for publishing data
+ * from the play callback.  Readers retry until they see a copy of the value
+ * that was not being written to while they read it.
+ *
+ * SeqLock is standard-layout, so it can be placed in memory shared with
+ * other processes as long as T is standard-layout too.
+ *
+ * @tparam T  The type of the protected value; must be trivially copyable.
+ */
+template <typename T>
+class SeqLock {
+public:
+	/**
+	 * Constructs a SeqLock holding a value-initialised T.
+	 */
+	SeqLock() : sequence(0), value()
+	{
+	}
+
+	/**
+	 * Publishes a new value.
+	 * This must only be called from one thread at a time.
+	 * @param v  The value to publish.
+	 */
+	void Store(const T &v)
+	{
+		std::uint32_t s = this->sequence.load(std::memory_order_relaxed);
+		this->sequence.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		std::memcpy(&this->value, &v, sizeof(T));
+
+		this->sequence.store(s + 2, std::memory_order_release);
+	}
+
+	/**
+	 * Reads a consistent copy of the most recently published value.
+	 * @return  The value.
+	 */
+	T Load() const
+	{
+		T v;
+		std::uint32_t before, after;
+
+		do {
+			before = this->sequence.load(std::memory_order_acquire);
+			std::memcpy(&v, &this->value, sizeof(T));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = this->sequence.load(std::memory_order_relaxed);
+		} while ((before & 1) != 0 || before != after);
+
+		return v;
+	}
+
+private:
+	static_assert(std::is_trivially_copyable<T>::value,
+	              "SeqLock values must be trivially copyable");
+
+	std::atomic<std::uint32_t> sequence; ///< Odd while being written.
+	T value;                             ///< The protected value.
+};
+
+#endif // PS_SEQLOCK_HPP
@@ -0,0 +1,396 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the Server class.
+ * @see server.hpp
+ */
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "cmd.hpp"
+#include "constants.h"
+#include "errors.hpp"
+#include "io.hpp"
+#include "messages.h"
+#include "server.hpp"
+
+/**
+ * One client connection to the Server.
+ *
+ * As a ResponseSink, it queues response lines in its output buffer for the
+ * Server to write out.
+ */
+class Server::Connection : public ResponseSink {
+public:
+	/**
+	 * Constructs a Connection.
+	 * @param fd The connected socket.
+	 */
+	Connection(int fd) : fd(fd), closing(false), events(0)
+	{
+		this->out.reserve(RESPONSE_BUFFER_SIZE);
+	}
+
+	void Emit(const char *line, size_t length) override
+	{
+		if (this->closing) {
+			return;
+		}
+
+		// A client this far behind isn't reading; cut it loose rather
+		// than buffer without limit.
+		if (CLIENT_OUTPUT_MAX < this->out.size() + length) {
+			Warn("client too slow, dropping:", this->fd);
+			this->out.clear();
+			this->closing = true;
+			return;
+		}
+
+		this->out.append(line, length);
+	}
+
+	/**
+	 * Whether this client's commands should be left unread until it has
+	 * read some of its output.
+	 * @return True if the client is throttled; false otherwise.
+	 */
+	bool Throttled() const
+	{
+		return CLIENT_OUTPUT_HIGH_WATER <= this->out.size();
+	}
+
+	int fd;             ///< The connected socket.
+	bool closing;       ///< Whether to close once output is written.
+	std::uint32_t events; ///< The epoll events currently waited for.
+	std::string in;     ///< Input not yet handled.
+	std::string out;    ///< Output not yet written.
+};
+
+#ifdef WIN32
+
+Server::Server(CommandHandler &handler) : handler(handler), epoll_fd(-1)
+{
+	throw ConfigError(MSG_SERVER_UNSUPPORTED);
+}
+
+Server::~Server()
+{
+}
+
+void Server::ListenUnix(const std::string &)
+{
+}
+
+void Server::ListenTcp(const std::string &)
+{
+}
+
+void Server::Poll(int)
+{
+}
+
+void Server::Flush()
+{
+}
+
+#else
+
+/**
+ * Makes a file descriptor non-blocking.
+ * @param fd The file descriptor.
+ */
+static void SetNonBlocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		throw InternalError(MSG_SERVER_SOCKET);
+	}
+}
+
+Server::Server(CommandHandler &handler) : handler(handler)
+{
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (this->epoll_fd < 0) {
+		throw InternalError(MSG_SERVER_SOCKET);
+	}
+}
+
+Server::~Server()
+{
+	if (&BroadcastSink() == this) {
+		SetBroadcastSink(nullptr);
+	}
+
+	for (auto &c : this->connections) {
+		close(c.first);
+	}
+	for (int fd : this->listeners) {
+		close(fd);
+	}
+	if (!this->unix_path.empty()) {
+		unlink(this->unix_path.c_str());
+	}
+	close(this->epoll_fd);
+}
+
+void Server::ListenUnix(const std::string &path)
+{
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (sizeof(addr.sun_path) <= path.size()) {
+		throw ConfigError(MSG_SERVER_BIND);
+	}
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw InternalError(MSG_SERVER_SOCKET);
+	}
+
+	unlink(path.c_str());
+	if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		throw ConfigError(MSG_SERVER_BIND);
+	}
+
+	this->unix_path = path;
+	Listen(fd);
+}
+
+void Server::ListenTcp(const std::string &port)
+{
+	std::istringstream is(port);
+	unsigned int port_number = 0;
+	is >> port_number;
+	if (is.fail() || port_number == 0 || 65535 < port_number) {
+		throw ConfigError(MSG_SERVER_BIND);
+	}
+
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(static_cast<std::uint16_t>(port_number));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw InternalError(MSG_SERVER_SOCKET);
+	}
+
+	int yes = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		throw ConfigError(MSG_SERVER_BIND);
+	}
+
+	Listen(fd);
+}
+
+void Server::Listen(int fd)
+{
+	SetNonBlocking(fd);
+	if (listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		throw ConfigError(MSG_SERVER_BIND);
+	}
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		throw InternalError(MSG_SERVER_SOCKET);
+	}
+
+	this->listeners.push_back(fd);
+}
+
+void Server::Poll(int timeout_ms)
+{
+	epoll_event events[SERVER_MAX_EVENTS];
+	int n = epoll_wait(this->epoll_fd, events, SERVER_MAX_EVENTS,
+	                   timeout_ms);
+
+	for (int i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+
+		auto c = this->connections.find(fd);
+		if (c == this->connections.end()) {
+			Accept(fd);
+			continue;
+		}
+
+		if (events[i].events & EPOLLERR) {
+			c->second->closing = true;
+			c->second->out.clear();
+		} else if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+			// A client that hung up can't hear replies, but the
+			// commands it sent first still count; reading them
+			// ends at EOF, which closes the connection.
+			if (events[i].events & EPOLLHUP) {
+				c->second->out.clear();
+			}
+			Read(*c->second);
+		}
+	}
+
+	// Clients that have caught up on their output may have commands
+	// waiting that were held back while they were throttled.
+	for (auto &c : this->connections) {
+		HandleLines(*c.second);
+	}
+}
+
+void Server::Flush()
+{
+	for (auto &c : this->connections) {
+		Write(*c.second);
+		Watch(*c.second);
+	}
+
+	Reap();
+}
+
+void Server::Emit(const char *line, size_t length)
+{
+	for (auto &c : this->connections) {
+		c.second->Emit(line, length);
+	}
+}
+
+void Server::Accept(int fd)
+{
+	int client;
+	while (0 <= (client = accept4(fd, nullptr, nullptr,
+	                              SOCK_NONBLOCK | SOCK_CLOEXEC))) {
+		std::unique_ptr<Connection> c(new Connection(client));
+		c->Respond(Response::OHAI, MSG_OHAI);
+
+		this->connections.emplace(client, std::move(c));
+		Debug("client connected:", client);
+	}
+}
+
+void Server::Read(Connection &c)
+{
+	char buf[SERVER_READ_SIZE];
+	size_t total = 0;
+
+	// Anything left unread past the limit waits for the next poll, as
+	// the socket stays readable.
+	while (!c.closing && !c.Throttled() && total < SERVER_READ_MAX) {
+		ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+		if (0 < n) {
+			total += static_cast<size_t>(n);
+			c.in.append(buf, static_cast<size_t>(n));
+			HandleLines(c);
+
+			// A client sending an endless line is either broken
+			// or hostile.
+			if (CLIENT_INPUT_MAX < c.in.size()) {
+				c.closing = true;
+			}
+		} else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+		                      errno != EINTR)) {
+			c.closing = true;
+		} else if (errno != EINTR) {
+			break;
+		}
+	}
+}
+
+void Server::HandleLines(Connection &c)
+{
+	size_t start = 0;
+	size_t end;
+
+	while (!c.closing && !c.Throttled() &&
+	       (end = c.in.find('\n', start)) != std::string::npos) {
+		size_t len = end - start;
+		if (0 < len && c.in[end - 1] == '\r') {
+			len--;
+		}
+
+		this->handler.HandleLine(
+		                boost::string_ref(c.in.data() + start, len), c);
+		start = end + 1;
+	}
+
+	c.in.erase(0, start);
+}
+
+void Server::Write(Connection &c)
+{
+	while (!c.out.empty()) {
+		ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if (0 <= n) {
+			c.out.erase(0, static_cast<size_t>(n));
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		} else if (errno != EINTR) {
+			c.closing = true;
+			c.out.clear();
+		}
+	}
+}
+
+void Server::Watch(Connection &c)
+{
+	std::uint32_t events = 0;
+	if (!c.closing && !c.Throttled()) {
+		events |= EPOLLIN;
+	}
+	if (!c.out.empty()) {
+		events |= EPOLLOUT;
+	}
+
+	if (events == c.events) {
+		return;
+	}
+
+	epoll_event ev;
+	ev.events = events;
+	ev.data.fd = c.fd;
+	int op = (c.events == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	if (events == 0) {
+		op = EPOLL_CTL_DEL;
+	}
+	epoll_ctl(this->epoll_fd, op, c.fd, &ev);
+	c.events = events;
+}
+
+void Server::Reap()
+{
+	for (auto it = this->connections.begin();
+	     it != this->connections.end();) {
+		Connection &c = *it->second;
+		if (c.closing && c.out.empty()) {
+			Debug("client disconnected:", c.fd);
+			close(c.fd);
+			it = this->connections.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+#endif // WIN32
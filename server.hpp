@@ -0,0 +1,142 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the Server class.
+ * @see server.cpp
+ */
+
+#ifndef PS_SERVER_HPP
+#define PS_SERVER_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "io.hpp"
+
+class CommandHandler;
+
+/**
+ * A socket server speaking the Playslave++ text protocol.
+ *
+ * The server listens on any number of Unix-domain and localhost TCP
+ * sockets, and multiplexes all of its clients with one non-blocking epoll
+ * loop, which is run a step at a time by Poll.  Each client has its own
+ * output buffer, so a slow client never blocks the player: a client whose
+ * buffer passes CLIENT_OUTPUT_HIGH_WATER has its commands left unread until
+ * it catches up, and one whose buffer passes CLIENT_OUTPUT_MAX is
+ * disconnected.
+ *
+ * Replies to commands go to the client that sent them.  The Server is also
+ * a ResponseSink which sends to every client, for use as the broadcast
+ * sink.
+ */
+class Server : public ResponseSink {
+public:
+	/**
+	 * Constructs a Server.
+	 * @param handler The command handler to which client commands are
+	 *   sent.
+	 */
+	Server(CommandHandler &handler);
+
+	/**
+	 * Destructs a Server, closing all sockets.
+	 */
+	~Server();
+
+	/**
+	 * Starts listening on a Unix-domain socket.
+	 * Any existing file at @a path is replaced.
+	 * @param path The path of the socket.
+	 */
+	void ListenUnix(const std::string &path);
+
+	/**
+	 * Starts listening on a TCP socket bound to the loopback address.
+	 * @param port The port number, as a string.
+	 */
+	void ListenTcp(const std::string &port);
+
+	/**
+	 * Performs one step of the server loop.
+	 * This accepts new clients and handles any complete command lines.
+	 * Replies are buffered until the next Flush.
+	 * @param timeout_ms The maximum time to wait for activity, in
+	 *   milliseconds.
+	 */
+	void Poll(int timeout_ms);
+
+	/**
+	 * Writes as much pending output as the clients will take, and closes
+	 * any clients that are finished with.
+	 */
+	void Flush() override;
+
+	/**
+	 * Sends a response line to every client.
+	 * @param line The start of the line.
+	 * @param length The length of the line, in bytes.
+	 */
+	void Emit(const char *line, size_t length) override;
+
+private:
+	class Connection;
+
+	CommandHandler &handler;     ///< The command handler.
+	int epoll_fd;                ///< The epoll instance.
+	std::vector<int> listeners;  ///< The listening sockets.
+	std::string unix_path;       ///< The Unix socket path, if any.
+
+	/// The client connections, by file descriptor.
+	std::map<int, std::unique_ptr<Connection>> connections;
+
+	/**
+	 * Sets a newly bound socket listening, and adds it to the loop.
+	 * @param fd The socket.
+	 */
+	void Listen(int fd);
+
+	/**
+	 * Accepts all waiting clients on a listening socket.
+	 * @param fd The listening socket.
+	 */
+	void Accept(int fd);
+
+	/**
+	 * Reads everything waiting on a client socket, and handles any
+	 * complete command lines.
+	 * @param c The client connection.
+	 */
+	void Read(Connection &c);
+
+	/**
+	 * Handles complete command lines in a client's input buffer, until
+	 * there are no more or the client is throttled.
+	 * @param c The client connection.
+	 */
+	void HandleLines(Connection &c);
+
+	/**
+	 * Writes as much of a client's pending output as it will take.
+	 * @param c The client connection.
+	 */
+	void Write(Connection &c);
+
+	/**
+	 * Updates the events the loop waits for on a client socket, to match
+	 * its buffers.
+	 * @param c The client connection.
+	 */
+	void Watch(Connection &c);
+
+	/**
+	 * Closes and forgets any clients that are finished with.
+	 */
+	void Reap();
+};
+
+#endif // PS_SERVER_HPP
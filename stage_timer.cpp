@@ -0,0 +1,297 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the StageTimer and StageTrace classes.
+ * @see stage_timer.hpp
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "errors.hpp"
+#include "messages.h"
+#include "stage_timer.hpp"
+
+/// The names of the stages, in Stage order.
+static const std::array<std::string, STAGE_COUNT> STAGE_NAMES = {
+                {"demux", "decode", "resample", "ring_write"}};
+
+const std::string &StageName(Stage stage)
+{
+	return STAGE_NAMES[static_cast<std::size_t>(stage)];
+}
+
+struct StageTrace::Buffer {
+	/**
+	 * Constructs a Buffer.
+	 * @param capacity The number of events it holds.
+	 */
+	Buffer(std::size_t capacity)
+	        : events(new Event[capacity]), capacity(capacity), next(0)
+	{
+	}
+
+	std::unique_ptr<Event[]> events; ///< The event storage.
+	std::size_t capacity;            ///< The number of events it holds.
+
+	/// The number of events claimed so far, which may pass capacity.
+	std::atomic<std::size_t> next;
+};
+
+/// The buffer of the capturing StageTrace, or nullptr if none.
+static std::atomic<StageTrace::Buffer *> trace_buffer(nullptr);
+
+/// The number of timers recording into trace_buffer.
+static std::atomic<unsigned int> trace_writers(0);
+
+#ifdef USE_STAGE_TIMING
+
+/**
+ * One thread's stage counters.
+ *
+ * Only the owning thread writes to them, but any thread may read them, so
+ * they are atomics updated with plain loads and stores.
+ */
+struct ThreadStages {
+	std::atomic<std::uint64_t> nanoseconds[STAGE_COUNT]; ///< Time spent.
+	std::atomic<std::uint64_t> calls[STAGE_COUNT];       ///< Runs.
+	std::atomic<std::uint64_t> bytes[STAGE_COUNT];       ///< Bytes.
+	std::uint32_t index; ///< The thread's index, for traces.
+};
+
+/**
+ * Every thread's stage counters.
+ */
+struct StageRegistry {
+	std::mutex mutex; ///< Protects everything below.
+
+	std::vector<const ThreadStages *> threads; ///< The live threads.
+	std::uint32_t next_index; ///< The index of the next new thread.
+
+	/// The totals of threads that have exited.
+	std::array<StageTotals, STAGE_COUNT> retired;
+};
+
+/**
+ * Gets the stage registry.
+ * @return The registry.
+ */
+static StageRegistry &Registry()
+{
+	static StageRegistry registry;
+	return registry;
+}
+
+/**
+ * Registers a thread's counters for as long as the thread lives, and folds
+ * them into the retired totals when it exits.
+ */
+struct ThreadStagesHolder {
+	ThreadStages stages; ///< The thread's counters.
+
+	/**
+	 * Registers a new thread's counters.
+	 */
+	ThreadStagesHolder()
+	{
+		for (std::size_t s = 0; s < STAGE_COUNT; s++) {
+			this->stages.nanoseconds[s] = 0;
+			this->stages.calls[s] = 0;
+			this->stages.bytes[s] = 0;
+		}
+
+		auto &r = Registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		this->stages.index = r.next_index++;
+		r.threads.push_back(&this->stages);
+	}
+
+	/**
+	 * Retires an exiting thread's counters.
+	 */
+	~ThreadStagesHolder()
+	{
+		auto &r = Registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (std::size_t s = 0; s < STAGE_COUNT; s++) {
+			r.retired[s].time += std::chrono::nanoseconds(
+			                this->stages.nanoseconds[s].load());
+			r.retired[s].calls += this->stages.calls[s].load();
+			r.retired[s].bytes += this->stages.bytes[s].load();
+		}
+
+		auto &ts = r.threads;
+		ts.erase(std::remove(ts.begin(), ts.end(), &this->stages),
+		         ts.end());
+	}
+};
+
+/**
+ * Gets the calling thread's counters, registering them on first use.
+ * @return The counters.
+ */
+static ThreadStages &LocalStages()
+{
+	static thread_local ThreadStagesHolder holder;
+	return holder.stages;
+}
+
+/**
+ * Adds to one of the calling thread's counters.
+ * Only the owning thread writes, so this needs no read-modify-write.
+ * @param counter The counter.
+ * @param amount The amount to add.
+ */
+static void Bump(std::atomic<std::uint64_t> &counter, std::uint64_t amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount,
+	              std::memory_order_relaxed);
+}
+
+/**
+ * Records a stage run into the capturing trace, if there still is one.
+ * @param event The run.
+ */
+static void TraceRun(const StageTrace::Event &event)
+{
+	// Pairs with StageTrace::Stop: either Stop sees us writing, or we see
+	// that the buffer has gone.
+	trace_writers.fetch_add(1, std::memory_order_seq_cst);
+	auto buffer = trace_buffer.load(std::memory_order_seq_cst);
+	if (buffer != nullptr) {
+		auto i = buffer->next.fetch_add(1, std::memory_order_relaxed);
+		if (i < buffer->capacity) {
+			buffer->events[i] = event;
+		}
+	}
+	trace_writers.fetch_sub(1, std::memory_order_release);
+}
+
+StageTimer::StageTimer(Stage stage)
+        : stage(stage), bytes(0), start(std::chrono::steady_clock::now())
+{
+}
+
+StageTimer::~StageTimer()
+{
+	auto took = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	                std::chrono::steady_clock::now() - this->start);
+
+	auto &t = LocalStages();
+	auto s = static_cast<std::size_t>(this->stage);
+	Bump(t.nanoseconds[s], static_cast<std::uint64_t>(took.count()));
+	Bump(t.calls[s], 1);
+	Bump(t.bytes[s], this->bytes);
+
+	if (trace_buffer.load(std::memory_order_relaxed) != nullptr) {
+		TraceRun(StageTrace::Event{this->start, took, this->bytes,
+		                           t.index, this->stage});
+	}
+}
+
+StageTotals StageTotalsFor(Stage stage)
+{
+	auto s = static_cast<std::size_t>(stage);
+
+	auto &r = Registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	StageTotals totals = r.retired[s];
+	for (auto t : r.threads) {
+		totals.time += std::chrono::nanoseconds(
+		                t->nanoseconds[s].load(std::memory_order_relaxed));
+		totals.calls += t->calls[s].load(std::memory_order_relaxed);
+		totals.bytes += t->bytes[s].load(std::memory_order_relaxed);
+	}
+	return totals;
+}
+
+#else
+
+StageTotals StageTotalsFor(Stage)
+{
+	return StageTotals{std::chrono::nanoseconds(0), 0, 0};
+}
+
+#endif // USE_STAGE_TIMING
+
+StageTrace::StageTrace(std::size_t capacity)
+        : buffer(new Buffer(capacity)),
+          start(std::chrono::steady_clock::now()),
+          capturing(true)
+{
+	trace_buffer.store(this->buffer.get(), std::memory_order_seq_cst);
+}
+
+StageTrace::~StageTrace()
+{
+	Stop();
+}
+
+void StageTrace::Stop()
+{
+	if (!this->capturing) {
+		return;
+	}
+
+	trace_buffer.store(nullptr, std::memory_order_seq_cst);
+	while (trace_writers.load(std::memory_order_seq_cst) != 0) {
+		std::this_thread::yield();
+	}
+	this->capturing = false;
+}
+
+std::size_t StageTrace::Dropped() const
+{
+	auto next = this->buffer->next.load(std::memory_order_relaxed);
+	auto capacity = this->buffer->capacity;
+	return next < capacity ? 0 : next - capacity;
+}
+
+/**
+ * Converts a duration to microseconds, as trace events count time.
+ * @param d The duration.
+ * @return The duration, in fractional microseconds.
+ */
+template <typename D>
+static double TraceMicroseconds(D d)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double,
+	                                                        std::micro>>(d)
+	                .count();
+}
+
+void StageTrace::Write(const std::string &path) const
+{
+	std::ofstream out(path, std::ios::trunc);
+	out.precision(3);
+	out << std::fixed;
+
+	auto count = std::min(this->buffer->next.load(), this->buffer->capacity);
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	for (std::size_t i = 0; i < count; i++) {
+		const Event &e = this->buffer->events[i];
+		out << (i == 0 ? "\n" : ",\n") << "{\"name\":\""
+		    << StageName(e.stage)
+		    << "\",\"cat\":\"pipeline\",\"ph\":\"X\",\"pid\":1,"
+		    << "\"tid\":" << e.thread
+		    << ",\"ts\":" << TraceMicroseconds(e.start - this->start)
+		    << ",\"dur\":" << TraceMicroseconds(e.duration)
+		    << ",\"args\":{\"bytes\":" << e.bytes << "}}";
+	}
+	out << "\n]}\n";
+
+	out.close();
+	if (out.fail()) {
+		throw FileError(MSG_TRACE_WRITE_FAIL);
+	}
+}
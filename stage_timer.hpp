@@ -0,0 +1,201 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the StageTimer and StageTrace classes.
+ * @see stage_timer.cpp
+ */
+
+#ifndef PS_STAGE_TIMER_HPP
+#define PS_STAGE_TIMER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * The stages of the decoding pipeline that are timed.
+ */
+enum class Stage : std::uint8_t {
+	DEMUX,      ///< Reading packets from the demuxer.
+	DECODE,     ///< Decoding packets into frames.
+	RESAMPLE,   ///< Converting frames to the output format.
+	RING_WRITE, ///< Writing samples into the ring buffer.
+	COUNT       ///< Not a stage: the number of stages.
+};
+
+/// The number of timed stages.
+#define STAGE_COUNT (static_cast<std::size_t>(Stage::COUNT))
+
+#ifdef USE_STAGE_TIMING
+/// Whether stage timing is compiled in (build with USE_STAGE_TIMING=1).
+const bool STAGE_TIMING = true;
+#else
+/// Whether stage timing is compiled in (build with USE_STAGE_TIMING=1).
+const bool STAGE_TIMING = false;
+#endif
+
+/**
+ * The time spent in one stage, summed over every thread.
+ */
+struct StageTotals {
+	std::chrono::nanoseconds time; ///< The total time spent in the stage.
+	std::uint64_t calls;           ///< The number of times it ran.
+	std::uint64_t bytes;           ///< The bytes it produced or consumed.
+};
+
+/**
+ * Gets the name of a stage.
+ * @param stage The stage.
+ * @return The stage's name, in lower case.
+ */
+const std::string &StageName(Stage stage);
+
+/**
+ * Gets the time spent in a stage since Playslave started.
+ * @param stage The stage.
+ * @return The totals, which are all zero if stage timing isn't compiled in.
+ */
+StageTotals StageTotalsFor(Stage stage);
+
+#ifdef USE_STAGE_TIMING
+
+/**
+ * A scoped timer for one run of a pipeline stage.
+ *
+ * The time from construction to destruction is added to the stage's totals
+ * for the calling thread.  Each thread keeps its own counters, which only it
+ * writes to, so timing never contends with other threads; the counters are
+ * only summed when read.  While a StageTrace is capturing, each run is also
+ * recorded as a trace event.
+ *
+ * Without USE_STAGE_TIMING, StageTimer is an empty class whose members do
+ * nothing, and compiles away entirely.
+ */
+class StageTimer {
+public:
+	/**
+	 * Starts timing a run of a stage.
+	 * @param stage The stage.
+	 */
+	explicit StageTimer(Stage stage);
+
+	/**
+	 * Stops timing, and records the run.
+	 */
+	~StageTimer();
+
+	StageTimer(const StageTimer &) = delete;
+	StageTimer &operator=(const StageTimer &) = delete;
+
+	/**
+	 * Counts bytes produced or consumed by the run.
+	 * @param bytes The byte count.
+	 */
+	void AddBytes(std::uint64_t bytes)
+	{
+		this->bytes += bytes;
+	}
+
+private:
+	Stage stage;         ///< The stage being timed.
+	std::uint64_t bytes; ///< The bytes counted so far.
+
+	/// When the run started.
+	std::chrono::steady_clock::time_point start;
+};
+
+#else
+
+/**
+ * A scoped timer for one run of a pipeline stage, compiled out.
+ * @see USE_STAGE_TIMING
+ */
+class StageTimer {
+public:
+	/**
+	 * Does nothing.
+	 */
+	explicit StageTimer(Stage)
+	{
+	}
+
+	/**
+	 * Does nothing.
+	 */
+	void AddBytes(std::uint64_t)
+	{
+	}
+};
+
+#endif // USE_STAGE_TIMING
+
+/**
+ * A capture of every stage run, as trace events, over a window of time.
+ *
+ * Only one StageTrace may exist at once.  Timers record into a buffer
+ * allocated up front, so capturing never allocates; runs past its capacity
+ * are dropped.  The capture can be written out in the Chrome trace-event
+ * format, for chrome://tracing or Perfetto.
+ */
+class StageTrace {
+public:
+	/**
+	 * Starts capturing.
+	 * @param capacity The maximum number of runs to capture.
+	 */
+	StageTrace(std::size_t capacity);
+
+	/**
+	 * Stops capturing, if it hasn't already stopped.
+	 */
+	~StageTrace();
+
+	StageTrace(const StageTrace &) = delete;
+	StageTrace &operator=(const StageTrace &) = delete;
+
+	/**
+	 * Stops capturing, waiting for any runs being recorded to finish.
+	 */
+	void Stop();
+
+	/**
+	 * Writes the capture as Chrome trace-event JSON.
+	 * This must only be called once capturing has stopped.
+	 * @param path The path of the file to write.
+	 * @throws FileError if the file can't be written.
+	 */
+	void Write(const std::string &path) const;
+
+	/**
+	 * The number of runs dropped because the buffer was full.
+	 * @return The dropped run count.
+	 */
+	std::size_t Dropped() const;
+
+	/// One recorded stage run.
+	struct Event {
+		std::chrono::steady_clock::time_point start; ///< Its start.
+		std::chrono::nanoseconds duration;           ///< Its length.
+		std::uint64_t bytes;   ///< The bytes it counted.
+		std::uint32_t thread;  ///< The index of the thread it ran on.
+		Stage stage;           ///< The stage.
+	};
+
+	/// The buffer timers record into.
+	struct Buffer;
+
+private:
+	/// The buffer, shared with the timers while capturing.
+	std::unique_ptr<Buffer> buffer;
+
+	/// When the capture started.
+	std::chrono::steady_clock::time_point start;
+
+	bool capturing; ///< Whether Stop is still to be called.
+};
+
+#endif // PS_STAGE_TIMER_HPP
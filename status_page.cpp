@@ -0,0 +1,97 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Implementation of the StatusPage class.
+ * @see status_page.hpp
+ */
+
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "errors.hpp"
+#include "messages.h"
+#include "status_page.hpp"
+
+#ifdef WIN32
+
+StatusPage::StatusPage(const std::string &name) : name(name), layout(nullptr)
+{
+	throw ConfigError(MSG_STATUS_UNSUPPORTED);
+}
+
+StatusPage::~StatusPage()
+{
+}
+
+#else
+
+StatusPage::StatusPage(const std::string &name) : name(name), info()
+{
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		throw ConfigError(MSG_STATUS_OPEN);
+	}
+
+	void *p = MAP_FAILED;
+	if (ftruncate(fd, sizeof(StatusPageLayout)) == 0) {
+		p = mmap(nullptr, sizeof(StatusPageLayout),
+		         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		throw ConfigError(MSG_STATUS_OPEN);
+	}
+
+	// Publish the magic number last, so readers don't trust a half-built
+	// page.
+	this->layout = new (p) StatusPageLayout();
+	this->layout->version = STATUS_PAGE_VERSION;
+	std::atomic_thread_fence(std::memory_order_release);
+	this->layout->magic = STATUS_PAGE_MAGIC;
+}
+
+StatusPage::~StatusPage()
+{
+	assert(this->layout != nullptr);
+	this->layout->~StatusPageLayout();
+	munmap(this->layout, sizeof(StatusPageLayout));
+	shm_unlink(this->name.c_str());
+}
+
+#endif // WIN32
+
+void StatusPage::UpdateTransport(const StatusTransport &transport)
+{
+	this->layout->transport.Store(transport);
+}
+
+void StatusPage::UpdateState(std::uint32_t state)
+{
+	this->info.state = state;
+	this->layout->info.Store(this->info);
+}
+
+void StatusPage::UpdateFile(std::uint64_t file_id, const std::string &path,
+                            std::uint32_t sample_rate)
+{
+	this->info.file_id = file_id;
+	this->info.sample_rate = sample_rate;
+
+	std::strncpy(this->info.path, path.c_str(), sizeof(this->info.path));
+	this->info.path[sizeof(this->info.path) - 1] = '\0';
+
+	this->layout->info.Store(this->info);
+}
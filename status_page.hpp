@@ -0,0 +1,118 @@
+// This file is part of Playslave-C++.
+// Playslave-C++ is licenced under the MIT license: see LICENSE.txt.
+
+/**
+ * @file
+ * Declaration of the StatusPage class and its shared memory layout.
+ * @see status_page.cpp
+ */
+
+#ifndef PS_STATUS_PAGE_HPP
+#define PS_STATUS_PAGE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "seqlock.hpp"
+
+/// Magic number at the start of a status page ('PSST', little-endian).
+const std::uint32_t STATUS_PAGE_MAGIC = 0x54535350;
+
+/// Version of the status page layout; bump on incompatible changes.
+const std::uint32_t STATUS_PAGE_VERSION = 3;
+
+/// The maximum length of the file path in the status page, including NUL.
+#define STATUS_PAGE_PATH_SIZE 1024
+
+/**
+ * Status written by the play callback (or, when the stream is stopped, by
+ * the control thread).
+ */
+struct StatusTransport {
+	std::uint64_t file_id;          ///< The file this status is for.
+	std::uint64_t position_samples; ///< The position, in samples.
+	std::uint64_t ring_fill;        ///< Samples waiting in the ring buffer.
+	std::uint64_t underruns;        ///< Callbacks short of samples.
+	std::uint64_t callbacks;        ///< Play callbacks since load.
+	std::uint64_t dead_air_alarms;  ///< Dead air alarms since load.
+	std::uint64_t dead_air_samples; ///< Length of the current dead air.
+};
+
+/**
+ * Status written by the control thread.
+ */
+struct StatusInfo {
+	std::uint64_t file_id;     ///< Incremented on each load; 0 if none.
+	std::uint32_t state;       ///< The Player::State, as an integer.
+	std::uint32_t sample_rate; ///< The sample rate of the file, in Hz.
+	char path[STATUS_PAGE_PATH_SIZE]; ///< NUL-terminated path of the file.
+};
+
+/**
+ * The layout of a status page in shared memory.
+ *
+ * All integers are native-endian.  Each half of the page is protected by a
+ * sequence lock: a 32-bit counter, immediately followed by the data, that
+ * is odd while the data is being written.  Readers should copy the data
+ * between two reads of the counter, and retry if the counter was odd or
+ * changed.
+ */
+struct StatusPageLayout {
+	std::uint32_t magic;   ///< Always STATUS_PAGE_MAGIC.
+	std::uint32_t version; ///< Always STATUS_PAGE_VERSION.
+	SeqLock<StatusTransport> transport; ///< Playback status.
+	SeqLock<StatusInfo> info;           ///< Loaded file and state.
+};
+
+/**
+ * A POSIX shared memory segment publishing the Player's status.
+ *
+ * Local clients can map the segment and read the current state and exact
+ * playhead at whatever rate they like, without any IPC round-trips.
+ */
+class StatusPage {
+public:
+	/**
+	 * Creates and maps a status page.
+	 * @param name  The shared memory object name, eg "/playslave".
+	 */
+	StatusPage(const std::string &name);
+
+	/**
+	 * Unmaps and unlinks the status page.
+	 */
+	~StatusPage();
+
+	/**
+	 * Publishes playback status.
+	 * This must only be called by one thread at a time: the play
+	 * callback while the stream is running, and the control thread
+	 * otherwise.
+	 * @param transport  The new playback status.
+	 */
+	void UpdateTransport(const StatusTransport &transport);
+
+	/**
+	 * Publishes a state change.
+	 * This must only be called from the control thread.
+	 * @param state  The new state, as an integer.
+	 */
+	void UpdateState(std::uint32_t state);
+
+	/**
+	 * Publishes a change of loaded file.
+	 * This must only be called from the control thread.
+	 * @param file_id      The new file ID, or 0 if none is loaded.
+	 * @param path         The path of the new file.
+	 * @param sample_rate  The sample rate of the new file.
+	 */
+	void UpdateFile(std::uint64_t file_id, const std::string &path,
+	                std::uint32_t sample_rate);
+
+private:
+	std::string name;         ///< The shared memory object name.
+	StatusPageLayout *layout; ///< The mapped page.
+	StatusInfo info; ///< The control thread's copy of the info half.
+};
+
+#endif // PS_STATUS_PAGE_HPP